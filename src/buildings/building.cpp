@@ -7,6 +7,7 @@
 #include "mesh.h"
 #include "registery.h"
 #include "resource_fetcher.h"
+#include "storage_house.h"
 
 const char * GameResourceToString( GameResource resource ) {
 	switch ( resource ) {
@@ -43,6 +44,14 @@ bool IsBuildingInsideArea( const CpntBuilding & building, const Area & area ) {
 	}
 }
 
+void CountAdjacentRoads( CpntBuilding & building, const Map & map ) {
+	building.numAdjacentRoads = 0;
+	for ( const Cell & cell : building.AdjacentCells( map ) ) {
+		building.numAdjacentRoads += map.GetTile( cell ) == MapTile::ROAD;
+	}
+	building.hasRoadConnection = building.numAdjacentRoads > 0;
+}
+
 bool IsCellAdjacentToBuilding( const CpntBuilding & building, Cell cell, const Map & map ) {
 	if ( IsCellInsideBuilding( building, cell ) ) {
 		return false;
@@ -83,7 +92,9 @@ void SystemHousing::Update( Registery & reg, Duration ticks ) {
 		if ( housing.tier == 0 ) {
 			auto & inventory = reg.GetComponent< CpntResourceInventory >( e );
 			if ( inventory.GetResourceAmount( GameResource::WHEAT ) >= 1 &&
-			     IsServiceFulfilled( housing.lastServiceAccess[ ( int )GameService::WATER ], theGame->clock ) ) {
+			     IsServiceFulfilled(
+			         GetLastServiceAccess( reg.GetComponent< CpntBuilding >( e ), housing, GameService::WATER ),
+			         theGame->clock ) ) {
 				auto & model = reg.GetComponent< CpntRenderModel >( e );
 				model.model = g_modelAtlas.GetModel( PackerResources::HOUSE_DAE );
 				housing.tier = 1;
@@ -104,14 +115,6 @@ void SystemHousing::Update( Registery & reg, Duration ticks ) {
 
 void SystemHousing::HandleMessage( Registery & reg, const Message & msg ) {
 	switch ( msg.type ) {
-	case MESSAGE_SERVICE_PROVIDED: {
-		GameService   service = CastPayloadAs< GameService >( msg.payload );
-		CpntHousing * housing = reg.TryGetComponent< CpntHousing >( msg.recipient );
-		if ( housing != nullptr ) {
-			housing->lastServiceAccess[ ( u32 )service ] = theGame->clock;
-		}
-		break;
-	}
 	case MESSAGE_HOUSE_MIGRANT_ARRIVED: {
 		// a migrant has arrived
 		CpntHousing * housing = reg.TryGetComponent< CpntHousing >( msg.recipient );
@@ -130,8 +133,7 @@ void SystemHousing::HandleMessage( Registery & reg, const Message & msg ) {
 }
 
 void SystemHousing::OnCpntAttached( Entity e, CpntHousing & t ) {
-	// A house has spawned, let's track when it receives a service
-	ListenTo( MESSAGE_SERVICE_PROVIDED, e );
+	t.builtAt = theGame->clock;
 	for ( u32 i = 0; i < t.numCurrentlyLiving; i++ ) {
 		PostMsg( MESSAGE_WORKER_AVAILABLE, INVALID_ENTITY, INVALID_ENTITY );
 	}
@@ -143,27 +145,90 @@ void SystemHousing::OnCpntRemoved( Entity e, CpntHousing & t ) {
 	}
 }
 
+// Closest of the candidates that can be reached by road from one of the start cells, in a single search
+static Entity LookForClosestCandidate( Registery &                       reg,
+                                       const ng::DynamicArray< Entity > & candidates,
+                                       const ng::DynamicArray< Cell > &   startCells,
+                                       u32                                maxDistance,
+                                       ng::DynamicArray< Cell > &         outPath ) {
+	thread_local ng::DynamicArray< CpntBuilding > candidateBuildings( 16 );
+	if ( candidates.Empty() ) {
+		return INVALID_ENTITY;
+	}
+	candidateBuildings.Clear();
+	for ( Entity e : candidates ) {
+		candidateBuildings.PushBack( reg.GetComponent< CpntBuilding >( e ) );
+	}
+
+	u32 goalIndex = 0;
+	if ( !FindPathToClosestBuilding( startCells, candidateBuildings, theGame->map, theGame->roadNetwork, outPath,
+	                                 goalIndex, maxDistance ) ) {
+		return INVALID_ENTITY;
+	}
+	return candidates[ goalIndex ];
+}
+
+Entity LookForClosestBuilding( Registery &                                                 reg,
+                               const ng::DynamicArray< Cell > &                            startCells,
+                               const std::function< bool( Entity, const CpntBuilding & ) > & filter,
+                               u32                                                         maxDistance,
+                               ng::DynamicArray< Cell > &                                  outPath ) {
+	thread_local ng::DynamicArray< Entity > candidates( 16 );
+	candidates.Clear();
+	for ( auto [ e, building ] : reg.IterateOver< CpntBuilding >() ) {
+		if ( filter( e, building ) ) {
+			candidates.PushBack( e );
+		}
+	}
+	return LookForClosestCandidate( reg, candidates, startCells, maxDistance, outPath );
+}
+
 Entity LookForClosestBuildingKind( Registery &                reg,
                                    BuildingKind               kind,
                                    const CpntBuilding &       origin,
                                    u32                        maxDistance,
                                    ng::DynamicArray< Cell > & outPath ) {
-	Entity closestStorage = INVALID_ENTITY;
-	u32    closestStorageDistance = maxDistance;
-
-	for ( auto [ e, building ] : reg.IterateOver< CpntBuilding >() ) {
-		if ( building.kind != kind ) {
-			continue;
-		}
-		u32  distance = 0;
-		bool pathFound = FindPathBetweenBuildings( origin, reg.GetComponent< CpntBuilding >( e ), theGame->map,
-		                                           theGame->roadNetwork, outPath, closestStorageDistance, &distance );
-		if ( pathFound && distance < closestStorageDistance ) {
-			closestStorage = e;
-			closestStorageDistance = distance;
+	const SystemBuilding &    system = theGame->systemManager.GetSystem< SystemBuilding >();
+	const SpatialBucketGrid & grid = system.buildingsOfKind[ ( int )kind ];
+	if ( !grid.IsInitialized() ) {
+		return INVALID_ENTITY;
+	}
+
+	ng::DynamicArray< Cell > startCells;
+	GetRoadCellsAroundBuilding( origin, theGame->map, startCells );
+
+	// Distances are counted between road cells next to the buildings, and buildings are filed by their corner, so a
+	// ring can't hold anything closer than its min distance minus this
+	u64 slack = ( u64 )origin.tileSizeX + origin.tileSizeZ + system.maxExtentOfKind[ ( int )kind ] + 2;
+
+	thread_local ng::DynamicArray< SpatialBucketGrid::Entry > ring;
+	thread_local ng::DynamicArray< Entity >                   candidates( 16 );
+	thread_local ng::DynamicArray< CpntBuilding >             noGoals;
+	candidates.Clear();
+
+	// A single search over the roads, rings join it as it gets far enough for their buildings to be the closest
+	u32  r = 0;
+	u32  numVisited = 0;
+	auto gatherRings = [ & ]( u32 distance, ng::DynamicArray< CpntBuilding > & outGoals ) {
+		while ( numVisited < grid.Size() && SpatialBucketGrid::RingMinDistance( r ) <= distance + slack ) {
+			ring.Clear();
+			if ( !grid.GatherRing( origin.cell, r++, ring ) ) {
+				return false;
+			}
+			numVisited += ring.Size();
+			for ( const SpatialBucketGrid::Entry & entry : ring ) {
+				candidates.PushBack( entry.entity );
+				outGoals.PushBack( reg.GetComponent< CpntBuilding >( entry.entity ) );
+			}
 		}
+		return numVisited < grid.Size();
+	};
+	u32 goalIndex = 0;
+	if ( !FindPathToClosestBuilding( startCells, noGoals, theGame->map, theGame->roadNetwork, outPath, goalIndex,
+	                                 maxDistance, nullptr, gatherRings ) ) {
+		return INVALID_ENTITY;
 	}
-	return closestStorage;
+	return candidates[ goalIndex ];
 }
 
 Entity LookForStorageContainingOneOfResourceList( Registery &                reg,
@@ -172,35 +237,31 @@ Entity LookForStorageContainingOneOfResourceList( Registery &                reg
                                                   u32                        resourceListSize,
                                                   u32                        maxDistance,
                                                   ng::DynamicArray< Cell > & outPath ) {
-	Entity closestStorage = INVALID_ENTITY;
-	u32    closestStorageDistance = maxDistance;
-
-	for ( auto [ e, building ] : reg.IterateOver< CpntBuilding >() ) {
-		if ( building.kind != BuildingKind::STORAGE_HOUSE ) {
-			continue;
-		}
-		const CpntResourceInventory & inventory = reg.GetComponent< CpntResourceInventory >( e );
-		bool                          hasAtLeastOneResourceInList = false;
-		for ( u32 i = 0; i < resourceListSize; i++ ) {
-			if ( inventory.GetResourceAmount( resourceList[ i ] ) > 0 ) {
-				hasAtLeastOneResourceInList = true;
-				break;
+	thread_local ng::DynamicArray< Entity > candidates( 16 );
+	candidates.Clear();
+	for ( u32 i = 0; i < resourceListSize; i++ ) {
+		u32 alreadyFound = candidates.Size();
+		theGame->logistics.FindStorages( resourceList[ i ], false, origin, maxDistance, candidates );
+		// A storage can hold several resources of the list
+		for ( u32 j = alreadyFound; j < candidates.Size(); ) {
+			bool isDuplicate = false;
+			for ( u32 k = 0; k < alreadyFound && !isDuplicate; k++ ) {
+				isDuplicate = candidates[ k ] == candidates[ j ];
+			}
+			if ( isDuplicate ) {
+				candidates.DeleteIndexFast( j );
+			} else {
+				j++;
 			}
 		}
-
-		if ( !hasAtLeastOneResourceInList ) {
-			continue;
-		}
-
-		u32  distance = 0;
-		bool pathFound = FindPathBetweenBuildings( origin, reg.GetComponent< CpntBuilding >( e ), theGame->map,
-		                                           theGame->roadNetwork, outPath, closestStorageDistance, &distance );
-		if ( pathFound && distance < closestStorageDistance ) {
-			closestStorage = e;
-			closestStorageDistance = distance;
-		}
 	}
-	return closestStorage;
+	if ( candidates.Empty() ) {
+		return INVALID_ENTITY;
+	}
+
+	ng::DynamicArray< Cell > startCells;
+	GetRoadCellsAroundBuilding( origin, theGame->map, startCells );
+	return LookForClosestCandidate( reg, candidates, startCells, maxDistance, outPath );
 }
 
 Entity LookForStorageAcceptingResource( Registery &                reg,
@@ -208,26 +269,16 @@ Entity LookForStorageAcceptingResource( Registery &                reg,
                                         GameResource               resource,
                                         u32                        maxDistance,
                                         ng::DynamicArray< Cell > & outPath ) {
-	Entity closestStorage = INVALID_ENTITY;
-	u32    closestStorageDistance = maxDistance;
-
-	for ( auto [ e, building ] : reg.IterateOver< CpntBuilding >() ) {
-		if ( building.kind != BuildingKind::STORAGE_HOUSE ) {
-			continue;
-		}
-		const CpntResourceInventory & inventory = reg.GetComponent< CpntResourceInventory >( e );
-		if ( inventory.GetResourceCapacity( resource ) > 0 ) {
-			u32  distance = 0;
-			bool pathFound =
-			    FindPathBetweenBuildings( origin, reg.GetComponent< CpntBuilding >( e ), theGame->map,
-			                              theGame->roadNetwork, outPath, closestStorageDistance, &distance );
-			if ( pathFound && distance < closestStorageDistance ) {
-				closestStorage = e;
-				closestStorageDistance = distance;
-			}
-		}
+	thread_local ng::DynamicArray< Entity > candidates( 16 );
+	candidates.Clear();
+	theGame->logistics.FindStorages( resource, true, origin, maxDistance, candidates );
+	if ( candidates.Empty() ) {
+		return INVALID_ENTITY;
 	}
-	return closestStorage;
+
+	ng::DynamicArray< Cell > startCells;
+	GetRoadCellsAroundBuilding( origin, theGame->map, startCells );
+	return LookForClosestCandidate( reg, candidates, startCells, maxDistance, outPath );
 }
 
 void SystemBuildingProducing::Update( Registery & reg, Duration ticks ) {
@@ -328,7 +379,8 @@ void SystemMarket::Update( Registery & reg, Duration ticks ) {
 					reg.AssignComponent< CpntRenderModel >( wanderer,
 					                                        g_modelAtlas.GetModel( PackerResources::CUBE_DAE ) );
 					CpntNavAgent & navAgent = reg.AssignComponent< CpntNavAgent >( wanderer );
-					navAgent.pathfindingNextSteps = path;
+					CompressPath( path );
+					navAgent.pathfindingNextSteps = std::move( path );
 					navAgent.deleteAtDestination = true;
 					CpntTransform & transform = reg.AssignComponent< CpntTransform >( wanderer );
 					transform.SetTranslation( GetPointInMiddleOfCell( navAgent.pathfindingNextSteps.Last() ) );
@@ -414,21 +466,19 @@ void SystemSeller::Update( Registery & reg, Duration ticks ) {
 		if ( currentCell != seller.lastCellDistributed ) {
 			seller.lastCellDistributed = currentCell;
 
-			// Four cardinal directions
-			ng::StaticArray< Cell, 4 > neighbors;
-			GetNeighborsOfCell( currentCell, theGame->map, neighbors );
-
 			// Look for houses adjacent to the seller
-			for ( auto [ houseEntity, house ] : reg.IterateOver< CpntHousing >() ) {
-				auto const & building = reg.GetComponent< CpntBuilding >( houseEntity );
-				if ( IsCellAdjacentToBuilding( building, currentCell, theGame->map ) ) {
-					// distribute resources
-					auto & houseInventory = reg.GetComponent< CpntResourceInventory >( houseEntity );
-					ForEveryGameResource( resource ) {
-						if ( houseInventory.GetResourceCapacity( resource ) > 0 ) {
-							PostTransactionMessage( resource, houseInventory.GetResourceCapacity( resource ), true,
-							                        houseEntity, seller.market );
-						}
+			ng::StaticArray< Entity, 4 > adjacentBuildings;
+			theGame->map.FindBuildingsAdjacentToCell( currentCell, adjacentBuildings );
+			for ( const Entity & houseEntity : adjacentBuildings ) {
+				if ( !reg.HasComponent< CpntHousing >( houseEntity ) ) {
+					continue;
+				}
+				// distribute resources
+				auto & houseInventory = reg.GetComponent< CpntResourceInventory >( houseEntity );
+				ForEveryGameResource( resource ) {
+					if ( houseInventory.GetResourceCapacity( resource ) > 0 ) {
+						PostTransactionMessage( resource, houseInventory.GetResourceCapacity( resource ), true,
+						                        houseEntity, seller.market );
 					}
 				}
 			}
@@ -437,31 +487,23 @@ void SystemSeller::Update( Registery & reg, Duration ticks ) {
 }
 
 void SystemServiceWanderer::Update( Registery & reg, Duration ticks ) {
+	ServiceCoverage & coverage = theGame->serviceCoverage;
+	if ( !coverage.IsSizedFor( theGame->map ) ) {
+		coverage.Init( theGame->map.sizeX, theGame->map.sizeZ );
+	}
 	for ( auto [ e, wanderer ] : reg.IterateOver< CpntServiceWanderer >() ) {
 		auto & transform = reg.GetComponent< CpntTransform >( e );
-		Cell   currentCell = GetCellForPoint( transform.GetTranslation() );
-		if ( currentCell != wanderer.lastCellDistributed ) {
-			wanderer.lastCellDistributed = currentCell;
-
-			// Four cardinal directions
-			ng::StaticArray< Cell, 4 > neighbors;
-			GetNeighborsOfCell( currentCell, theGame->map, neighbors );
-
-			// Look for houses adjacent to the wanderer
-			for ( auto [ houseEntity, house ] : reg.IterateOver< CpntHousing >() ) {
-				auto const & building = reg.GetComponent< CpntBuilding >( houseEntity );
-				for ( const Cell & neighborCell : neighbors ) {
-					if ( IsCellInsideBuilding( building, neighborCell ) ) {
-						// provide service
-						PostMsg< GameService >( MESSAGE_SERVICE_PROVIDED, wanderer.service, houseEntity, e );
-						break; // no need to look for other cells, we found the building
-					}
-				}
-			}
-		}
+		// Houses around will see it when they look at the cell
+		coverage.Stamp( wanderer.service, GetCellForPoint( transform.GetTranslation() ), theGame->clock );
 	}
 }
 
+TimePoint GetLastServiceAccess( const CpntBuilding & building, const CpntHousing & housing, GameService service ) {
+	TimePoint lastVisit =
+	    theGame->serviceCoverage.GetLastVisitAround( service, building.cell, building.tileSizeX, building.tileSizeZ );
+	return lastVisit > housing.builtAt ? lastVisit : 0;
+}
+
 void SystemServiceBuilding::Update( Registery & reg, Duration ticks ) {
 	for ( auto [ e, serviceBuilding ] : reg.IterateOver< CpntServiceBuilding >() ) {
 		if ( serviceBuilding.wanderer == INVALID_ENTITY ) {
@@ -490,7 +532,8 @@ void SystemServiceBuilding::Update( Registery & reg, Duration ticks ) {
 					reg.AssignComponent< CpntRenderModel >( wanderer,
 					                                        g_modelAtlas.GetModel( PackerResources::CUBE_DAE ) );
 					CpntNavAgent & navAgent = reg.AssignComponent< CpntNavAgent >( wanderer );
-					navAgent.pathfindingNextSteps = path;
+					CompressPath( path );
+					navAgent.pathfindingNextSteps = std::move( path );
 					navAgent.deleteAtDestination = true;
 					CpntTransform & transform = reg.AssignComponent< CpntTransform >( wanderer );
 					transform.SetTranslation( GetPointInMiddleOfCell( navAgent.pathfindingNextSteps.Last() ) );
@@ -525,61 +568,110 @@ void SystemServiceBuilding::OnCpntRemoved( Entity e, CpntServiceBuilding & t ) {
 	}
 }
 
+void SystemResourceInventory::Update( Registery & reg, Duration ticks ) {
+	for ( Entity e : newInventories ) {
+		if ( !reg.HasComponent< CpntStorageHouse >( e ) || !reg.HasComponent< CpntBuilding >( e ) ||
+		     !reg.HasComponent< CpntResourceInventory >( e ) ) {
+			continue;
+		}
+		theGame->logistics.AddStorage( e, reg.GetComponent< CpntBuilding >( e ),
+		                               reg.GetComponent< CpntResourceInventory >( e ), theGame->map );
+	}
+	newInventories.Clear();
+}
+
+void SystemResourceInventory::OnCpntAttached( Entity e, CpntResourceInventory & t ) { newInventories.PushBack( e ); }
+
+void SystemResourceInventory::OnCpntRemoved( Entity e, CpntResourceInventory & t ) {
+	theGame->logistics.RemoveStorage( e );
+}
+
 void SystemResourceInventory::HandleMessage( Registery & reg, const Message & msg ) {
 	switch ( msg.type ) {
 	case MESSAGE_INVENTORY_TRANSACTION: {
-		CpntResourceInventory * giver = reg.TryGetComponent< CpntResourceInventory >( msg.sender );
-		CpntResourceInventory * recipient = reg.TryGetComponent< CpntResourceInventory >( msg.recipient );
-		if ( giver == nullptr ) {
-			ng::Debugf( "A transaction has been aborted, the giver is invalid\n" );
-			return;
-		}
-		if ( recipient == nullptr ) {
-			ng::Debugf( "A transaction has been aborted, the recipient is invalid\n" );
-			return;
-		}
 		const TransactionMessagePayload & payload = CastPayloadAs< TransactionMessagePayload >( msg.payload );
-
-		u32 amountAvailable = giver->RemoveResource( payload.resource, payload.quantity );
-		u32 amountConsumed = recipient->StoreRessource( payload.resource, amountAvailable );
-		u32 amountToGiveBack = amountAvailable - amountConsumed;
-		if ( amountToGiveBack > 0 && payload.acceptPayback ) {
-			// Send back the amount we couldn't store
-			giver->StoreRessource( payload.resource, amountToGiveBack );
-		}
-		PostMsg( MESSAGE_INVENTORY_TRANSACTION_COMPLETED, msg.sender, msg.recipient );
-		if ( amountConsumed > 0 ) {
-			PostMsg( MESSAGE_INVENTORY_UPDATE, msg.sender, INVALID_ENTITY );
-			PostMsg( MESSAGE_INVENTORY_UPDATE, msg.recipient, INVALID_ENTITY );
-		}
+		ledger.PushBack( InventoryTransaction{ msg.sender, msg.recipient, payload.resource, payload.quantity,
+		                                       payload.acceptPayback } );
 		break;
 	}
 	case MESSAGE_FULL_INVENTORY_TRANSACTION: {
-		CpntResourceInventory * giver = reg.TryGetComponent< CpntResourceInventory >( msg.sender );
-		CpntResourceInventory * recipient = reg.TryGetComponent< CpntResourceInventory >( msg.recipient );
+		ledger.PushBack( InventoryTransaction{ msg.sender, msg.recipient, GameResource::NUM_RESOURCES } );
+		break;
+	}
+	default:
+		ng_assert_msg( false, "Message type %d can't be handled by this system\n", msg.type );
+	}
+}
+
+void SystemResourceInventory::OnMessagesFlushed( Registery & reg ) {
+	if ( !ledger.Empty() ) {
+		ResolveLedger( reg );
+	}
+}
+
+void SystemResourceInventory::ResolveLedger( Registery & reg ) {
+	struct TouchedInventory {
+		Entity e;
+		bool   hasChanged = false;
+		// Givers are told their transactions are done, the last recipient goes as sender
+		Entity lastRecipient = INVALID_ENTITY;
+	};
+	thread_local ng::DynamicArray< TouchedInventory >          touched;
+	thread_local std::unordered_map< Entity, u32, EntityHash > indexOfTouched;
+	touched.Clear();
+	indexOfTouched.clear();
+	auto touch = [ & ]( Entity e ) -> TouchedInventory & {
+		auto [ it, inserted ] = indexOfTouched.emplace( e, touched.Size() );
+		if ( inserted ) {
+			touched.PushBack( TouchedInventory{ e } );
+		}
+		return touched[ it->second ];
+	};
+
+	for ( const InventoryTransaction & transaction : ledger ) {
+		CpntResourceInventory * giver = reg.TryGetComponent< CpntResourceInventory >( transaction.giver );
+		CpntResourceInventory * recipient = reg.TryGetComponent< CpntResourceInventory >( transaction.recipient );
 		if ( giver == nullptr ) {
 			ng::Debugf( "A transaction has been aborted, the giver is invalid\n" );
-			return;
+			continue;
 		}
 		if ( recipient == nullptr ) {
 			ng::Debugf( "A transaction has been aborted, the recipient is invalid\n" );
-			return;
+			continue;
 		}
+
 		u32 amountConsumed = 0;
-		for ( int i = 0; i < ( int )GameResource::NUM_RESOURCES; i++ ) {
-			GameResource resource = ( GameResource )i;
-			u32 amountAvailable = giver->RemoveResource( resource, recipient->GetResourceCapacity( resource ) );
-			amountConsumed += recipient->StoreRessource( resource, amountAvailable );
-		}
-		PostMsg( MESSAGE_INVENTORY_TRANSACTION_COMPLETED, msg.sender, msg.recipient );
-		if ( amountConsumed > 0 ) {
-			PostMsg( MESSAGE_INVENTORY_UPDATE, msg.sender, INVALID_ENTITY );
-			PostMsg( MESSAGE_INVENTORY_UPDATE, msg.recipient, INVALID_ENTITY );
+		if ( transaction.resource == GameResource::NUM_RESOURCES ) {
+			ForEveryGameResource( resource ) {
+				u32 amountAvailable = giver->RemoveResource( resource, recipient->GetResourceCapacity( resource ) );
+				amountConsumed += recipient->StoreRessource( resource, amountAvailable );
+			}
+		} else {
+			u32 amountAvailable = giver->RemoveResource( transaction.resource, transaction.quantity );
+			amountConsumed = recipient->StoreRessource( transaction.resource, amountAvailable );
+			u32 amountToGiveBack = amountAvailable - amountConsumed;
+			if ( amountToGiveBack > 0 && transaction.acceptPayback ) {
+				// Send back the amount we couldn't store
+				giver->StoreRessource( transaction.resource, amountToGiveBack );
+			}
 		}
-		break;
+
+		TouchedInventory & touchedGiver = touch( transaction.giver );
+		touchedGiver.lastRecipient = transaction.recipient;
+		touchedGiver.hasChanged |= amountConsumed > 0;
+		touch( transaction.recipient ).hasChanged |= amountConsumed > 0;
 	}
-	default:
-		ng_assert_msg( false, "Message type %d can't be handled by this system\n", msg.type );
+	ledger.Clear();
+
+	for ( const TouchedInventory & inventory : touched ) {
+		CpntResourceInventory & cpntInventory = reg.GetComponent< CpntResourceInventory >( inventory.e );
+		theGame->logistics.Refresh( inventory.e, cpntInventory );
+		if ( inventory.lastRecipient != INVALID_ENTITY ) {
+			PostMsg( MESSAGE_INVENTORY_TRANSACTION_COMPLETED, inventory.e, inventory.lastRecipient );
+		}
+		if ( inventory.hasChanged ) {
+			PostMsg( MESSAGE_INVENTORY_UPDATE, inventory.e, INVALID_ENTITY );
+		}
 	}
 }
 
@@ -593,7 +685,7 @@ void SystemMigrant::HandleMessage( Registery & reg, const Message & msg ) {
 			reg.MarkForDelete( migrant );
 		} else {
 			CpntNavAgent & agent = reg.GetComponent< CpntNavAgent >( migrant );
-			theGame->systemManager.GetSystem< SystemPathfinding >().CopyPath( payload.id, agent.pathfindingNextSteps );
+			theGame->systemManager.GetSystem< SystemPathfinding >().TakePath( payload.id, agent.pathfindingNextSteps );
 			ListenTo( MESSAGE_NAVAGENT_DESTINATION_REACHED, migrant );
 		}
 		break;
@@ -615,15 +707,37 @@ void SystemMigrant::OnCpntAttached( Entity e, CpntMigrant & t ) {
 }
 
 void SystemBuilding::Update( Registery & reg, Duration ticks ) {
-	totalEmployed = 0;
-	totalEmployeesNeeded = 0;
-	for ( auto [ entity, building ] : reg.IterateOver< CpntBuilding >() ) {
-		while ( building.workersEmployed < building.workersNeeded && totalUnemployed > 0 ) {
-			totalUnemployed--;
-			building.workersEmployed++;
-		}
-		totalEmployed += building.workersEmployed;
-		totalEmployeesNeeded += building.workersNeeded - building.workersEmployed;
+	// Workers of removed buildings wait here until a vacancy opens
+	while ( totalUnemployed > 0 && !buildingsHiring.empty() ) {
+		Entity e = buildingsHiring.begin()->building;
+		totalUnemployed--;
+		Hire( e, reg.GetComponent< CpntBuilding >( e ) );
+	}
+}
+
+void SystemBuilding::Hire( Entity e, CpntBuilding & building ) {
+	ng_assert( building.workersEmployed < building.workersNeeded );
+	building.workersEmployed++;
+	totalEmployed++;
+	totalEmployeesNeeded--;
+	if ( building.workersEmployed == building.workersNeeded ) {
+		buildingsHiring.erase( { building.hiringRank, e } );
+	}
+	if ( building.workersEmployed == 1 ) {
+		buildingsEmploying.insert( { building.hiringRank, e } );
+	}
+}
+
+void SystemBuilding::Fire( Entity e, CpntBuilding & building ) {
+	ng_assert( building.workersEmployed > 0 );
+	building.workersEmployed--;
+	totalEmployed--;
+	totalEmployeesNeeded++;
+	if ( building.workersEmployed == 0 ) {
+		buildingsEmploying.erase( { building.hiringRank, e } );
+	}
+	if ( building.workersEmployed + 1 == building.workersNeeded ) {
+		buildingsHiring.insert( { building.hiringRank, e } );
 	}
 }
 
@@ -631,15 +745,10 @@ void SystemBuilding::HandleMessage( Registery & reg, const Message & msg ) {
 	switch ( msg.type ) {
 	case MESSAGE_WORKER_AVAILABLE: {
 		// we have a new worker to distribute
-		bool addedSomewhere = false;
-		for ( auto [ entity, building ] : reg.IterateOver< CpntBuilding >() ) {
-			if ( building.workersEmployed < building.workersNeeded ) {
-				addedSomewhere = true;
-				building.workersEmployed++;
-				break;
-			}
-		}
-		if ( !addedSomewhere ) {
+		if ( !buildingsHiring.empty() ) {
+			Entity e = buildingsHiring.begin()->building;
+			Hire( e, reg.GetComponent< CpntBuilding >( e ) );
+		} else {
 			// we have nowhere to employ this worker, let's go to pole emploi
 			totalUnemployed++;
 		}
@@ -647,15 +756,10 @@ void SystemBuilding::HandleMessage( Registery & reg, const Message & msg ) {
 	}
 	case MESSAGE_WORKER_REMOVED: {
 		// We have to remove a worker somewhere
-		bool removedSomewhere = false;
-		for ( auto [ entity, building ] : reg.IterateOver< CpntBuilding >() ) {
-			if ( building.workersEmployed > 0 ) {
-				removedSomewhere = true;
-				building.workersEmployed--;
-				break;
-			}
-		}
-		if ( !removedSomewhere ) {
+		if ( !buildingsEmploying.empty() ) {
+			Entity e = buildingsEmploying.begin()->building;
+			Fire( e, reg.GetComponent< CpntBuilding >( e ) );
+		} else {
 			ng_assert( totalUnemployed > 0 );
 			// That's one less chomeur
 			if ( totalUnemployed > 0 ) {
@@ -664,28 +768,33 @@ void SystemBuilding::HandleMessage( Registery & reg, const Message & msg ) {
 		}
 		break;
 	}
-	case MESSAGE_ROAD_CELL_ADDED: {
-		Cell cell = CastPayloadAs< Cell >( msg.payload );
-		for ( auto [ entity, building ] : reg.IterateOver< CpntBuilding >() ) {
-			if ( building.hasRoadConnection == false && IsCellAdjacentToBuilding( building, cell, theGame->map ) ) {
-				building.hasRoadConnection = true;
+	case MESSAGE_ROAD_CELL_ADDED:
+	case MESSAGE_ROAD_CELL_REMOVED: {
+		// Only the buildings bordering the cell can see their count change
+		Cell                         cell = CastPayloadAs< Cell >( msg.payload );
+		ng::StaticArray< Entity, 4 > adjacentBuildings;
+		theGame->map.FindBuildingsAdjacentToCell( cell, adjacentBuildings );
+		for ( const Entity & entity : adjacentBuildings ) {
+			CpntBuilding * building = reg.TryGetComponent< CpntBuilding >( entity );
+			if ( building != nullptr ) {
+				CountAdjacentRoads( *building, theGame->map );
 			}
 		}
 		break;
 	}
-	case MESSAGE_ROAD_CELL_REMOVED: {
-		Cell removedCell = CastPayloadAs< Cell >( msg.payload );
-		for ( auto [ entity, building ] : reg.IterateOver< CpntBuilding >() ) {
-			if ( building.hasRoadConnection == true &&
-			     IsCellAdjacentToBuilding( building, removedCell, theGame->map ) ) {
-				building.hasRoadConnection = false;
-				// we removed a road connected to a building, but it still might has a connection with another cell
-				for ( const Cell & cell : building.AdjacentCells( theGame->map ) ) {
-					if ( theGame->map.GetTile( cell ) == MapTile::ROAD && cell != removedCell ) {
-						building.hasRoadConnection = true;
-						break;
-					}
-				}
+	case MESSAGE_ROAD_REGION_CHANGED: {
+		// Same thing with the buildings having an adjacent cell inside the region
+		const MapRegion & region = CastPayloadAs< MapRegion >( msg.payload );
+		u32               minX = region.min.x > 0 ? region.min.x - 1 : 0;
+		u32               minZ = region.min.z > 0 ? region.min.z - 1 : 0;
+		thread_local ng::DynamicArray< Entity > buildingsAround;
+		buildingsAround.Clear();
+		theGame->map.FindBuildingsInArea( minX, minZ, region.max.x + 2 - minX, region.max.z + 2 - minZ,
+		                                  buildingsAround );
+		for ( const Entity & entity : buildingsAround ) {
+			CpntBuilding * building = reg.TryGetComponent< CpntBuilding >( entity );
+			if ( building != nullptr ) {
+				CountAdjacentRoads( *building, theGame->map );
 			}
 		}
 		break;
@@ -696,25 +805,41 @@ void SystemBuilding::HandleMessage( Registery & reg, const Message & msg ) {
 }
 
 void SystemBuilding::OnCpntAttached( Entity e, CpntBuilding & t ) {
+	t.hiringRank = nextHiringRank++;
+	totalEmployed += t.workersEmployed;
+	totalEmployeesNeeded += t.workersNeeded - t.workersEmployed;
+	if ( t.workersEmployed < t.workersNeeded ) {
+		buildingsHiring.insert( { t.hiringRank, e } );
+	}
+	if ( t.workersEmployed > 0 ) {
+		buildingsEmploying.insert( { t.hiringRank, e } );
+	}
+
 	// Let's see if we have worker to attach
 	while ( t.workersEmployed < t.workersNeeded && totalUnemployed > 0 ) {
 		totalUnemployed--;
-		t.workersEmployed++;
+		Hire( e, t );
 	}
 
 	// Let's check if we have a road connection
-	t.hasRoadConnection = false;
-	for ( const Cell & cell : t.AdjacentCells( theGame->map ) ) {
-		if ( theGame->map.GetTile( cell ) == MapTile::ROAD ) {
-			t.hasRoadConnection = true;
-			break;
-		}
+	CountAdjacentRoads( t, theGame->map );
+
+	SpatialBucketGrid & grid = buildingsOfKind[ ( int )t.kind ];
+	if ( !grid.IsInitialized() ) {
+		grid.Init( theGame->map.sizeX, theGame->map.sizeZ );
 	}
+	grid.Insert( e, t.cell );
+	maxExtentOfKind[ ( int )t.kind ] = MAX( maxExtentOfKind[ ( int )t.kind ], t.tileSizeX + t.tileSizeZ );
 }
 
 void SystemBuilding::OnCpntRemoved( Entity e, CpntBuilding & t ) {
 	// A building is removed, lets send its workforce to pole emploi
+	buildingsHiring.erase( { t.hiringRank, e } );
+	buildingsEmploying.erase( { t.hiringRank, e } );
+	totalEmployed -= t.workersEmployed;
+	totalEmployeesNeeded -= t.workersNeeded - t.workersEmployed;
 	totalUnemployed += t.workersEmployed;
+	buildingsOfKind[ ( int )t.kind ].Remove( e, t.cell );
 }
 
 void SystemBuilding::DebugDraw() { ImGui::Text( "%d chomeurs", totalUnemployed ); }
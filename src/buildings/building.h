@@ -7,7 +7,9 @@
 
 #include "../system.h"
 #include <concurrentqueue.h>
+#include <functional>
 #include <map>
+#include <set>
 
 struct Area {
 	enum class Shape {
@@ -28,6 +30,7 @@ enum class BuildingKind {
 	FOUNTAIN,
 	WOODSHOP,
 	DEBUG_DUMP,
+	NUM_BUILDING_KINDS, // keep me at the end
 };
 
 struct CpntBuilding {
@@ -37,7 +40,9 @@ struct CpntBuilding {
 	u32          tileSizeZ;
 	u32          workersNeeded = 0;
 	u32          workersEmployed = 0;
-	bool         hasRoadConnection = false;
+	u64          hiringRank = 0; // order of attachment, the labor market serves the lowest first
+	u32          numAdjacentRoads = 0;
+	bool         hasRoadConnection = false; // numAdjacentRoads > 0
 
 	double GetEfficiency() const {
 		if ( !hasRoadConnection ) {
@@ -179,7 +184,6 @@ struct CpntSeller {
 };
 
 struct CpntServiceWanderer {
-	Cell        lastCellDistributed = INVALID_CELL;
 	GameService service;
 };
 
@@ -222,18 +226,40 @@ struct CpntHousing {
 	u32      tier = 0;
 	Duration foodConsuptionSpeedPerHabitant = DurationFromSeconds( 60 ); // every habitant eats one food per minute
 	TimePoint lastAteAt = 0;
+	// Walkers that went by before the house was built don't serve it
+	TimePoint builtAt = 0;
 
-	TimePoint lastServiceAccess[ ( int )GameService::NUM_SERVICES ] = {};
 	bool      isServiceRequired[ ( int )GameService::NUM_SERVICES ] = {};
 };
 
+struct InventoryTransaction {
+	Entity       giver;
+	Entity       recipient;
+	// NUM_RESOURCES moves everything the recipient has room for
+	GameResource resource;
+	u32          quantity = 0;
+	bool         acceptPayback = false;
+};
+
 struct SystemResourceInventory : public System< CpntResourceInventory > {
 	SystemResourceInventory() {
 		ListenToGlobal( MESSAGE_INVENTORY_TRANSACTION );
 		ListenToGlobal( MESSAGE_FULL_INVENTORY_TRANSACTION );
 	}
-	virtual void Update( Registery & reg, Duration ticks ) override {}
+	virtual void Update( Registery & reg, Duration ticks ) override;
 	virtual void HandleMessage( Registery & reg, const Message & msg ) override;
+	virtual void OnMessagesFlushed( Registery & reg ) override;
+	virtual void OnCpntAttached( Entity e, CpntResourceInventory & t ) override;
+	virtual void OnCpntRemoved( Entity e, CpntResourceInventory & t ) override;
+
+	// Transactions are recorded as they come and resolved together, in the order they were posted. A giver serves
+	// them first come first served, and each inventory gets a single completion and update message for the batch
+	ng::DynamicArray< InventoryTransaction > ledger;
+	void                                     ResolveLedger( Registery & reg );
+
+	// Inventories attached since the last update, the storages among them go to the logistics index once their other
+	// components are attached too
+	ng::DynamicArray< Entity > newInventories;
 };
 
 struct SystemHousing : public System< CpntHousing > {
@@ -251,6 +277,7 @@ struct SystemBuilding : public System< CpntBuilding > {
 		ListenToGlobal( MESSAGE_WORKER_REMOVED );
 		ListenToGlobal( MESSAGE_ROAD_CELL_ADDED );
 		ListenToGlobal( MESSAGE_ROAD_CELL_REMOVED );
+		ListenToGlobal( MESSAGE_ROAD_REGION_CHANGED );
 	}
 	virtual void Update( Registery & reg, Duration ticks ) override;
 	virtual void HandleMessage( Registery & reg, const Message & msg ) override;
@@ -258,6 +285,25 @@ struct SystemBuilding : public System< CpntBuilding > {
 	virtual void OnCpntRemoved( Entity e, CpntBuilding & t ) override;
 	virtual void DebugDraw() override;
 
+	// Buildings sorted by hiringRank, workers are hired in the first one with a vacancy and fired from the first
+	// one with an employee
+	struct LaborMarketEntry {
+		u64    rank;
+		Entity building;
+
+		bool operator<( const LaborMarketEntry & rhs ) const { return rank < rhs.rank; }
+	};
+	std::set< LaborMarketEntry > buildingsHiring;
+	std::set< LaborMarketEntry > buildingsEmploying;
+	u64                          nextHiringRank = 0;
+
+	void Hire( Entity e, CpntBuilding & building );
+	void Fire( Entity e, CpntBuilding & building );
+
+	// Buildings filed under their corner cell by kind, so the closest ones can be looked for before walking the roads
+	SpatialBucketGrid buildingsOfKind[ ( int )BuildingKind::NUM_BUILDING_KINDS ];
+	u32               maxExtentOfKind[ ( int )BuildingKind::NUM_BUILDING_KINDS ] = {};
+
 	u32 totalUnemployed = 0;
 	u32 totalEmployed = 0;
 	u32 totalEmployeesNeeded = 0;
@@ -303,6 +349,23 @@ const char * GameResourceToString( GameResource resource );
 bool         IsCellInsideBuilding( const CpntBuilding & building, Cell cell );
 bool         IsBuildingInsideArea( const CpntBuilding & building, const Area & area );
 bool         IsCellAdjacentToBuilding( const CpntBuilding & building, Cell cell, const Map & map );
+// Last time a walker of the service went by the house since it was built, read from theGame->serviceCoverage
+TimePoint    GetLastServiceAccess( const CpntBuilding & building, const CpntHousing & housing, GameService service );
+// Counts the ROAD cells around the building and updates hasRoadConnection
+void         CountAdjacentRoads( CpntBuilding & building, const Map & map );
+// Closest building accepted by filter that can be reached by road from one of the start cells, in a single search
+Entity LookForClosestBuilding( Registery &                                                 reg,
+                               const ng::DynamicArray< Cell > &                            startCells,
+                               const std::function< bool( Entity, const CpntBuilding & ) > & filter,
+                               u32                                                         maxDistance,
+                               ng::DynamicArray< Cell > &                                  outPath );
+// Closest building of kind by road. A single search over the roads, the rings around origin join it once it got far
+// enough for their buildings to be the closest
+Entity LookForClosestBuildingKind( Registery &                reg,
+                                   BuildingKind               kind,
+                                   const CpntBuilding &       origin,
+                                   u32                        maxDistance,
+                                   ng::DynamicArray< Cell > & outPath );
 
 struct TransactionMessagePayload {
 	GameResource resource;
@@ -76,8 +76,8 @@ void SystemDeliveryGuy::HandleMessage( Registery & reg, const Message & msg ) {
 		}
 		auto & agent = reg.GetComponent< CpntNavAgent >( msg.recipient );
 		auto & transform = reg.GetComponent< CpntTransform >( msg.recipient );
-		guy.targetEntity = theGame->systemManager.GetSystem< SystemPathfinding >().CopyAndDeletePath(
-		    response.id, agent.pathfindingNextSteps );
+		guy.targetEntity =
+		    theGame->systemManager.GetSystem< SystemPathfinding >().TakePath( response.id, agent.pathfindingNextSteps );
 		transform.SetTranslation( GetPointInMiddleOfCell( agent.pathfindingNextSteps.Last() ) );
 		break;
 	}
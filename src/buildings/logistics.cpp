@@ -0,0 +1,97 @@
+#include "logistics.h"
+
+void LogisticsIndex::AddStorage( Entity                        e,
+                                 const CpntBuilding &          building,
+                                 const CpntResourceInventory & inventory,
+                                 const Map &                   map ) {
+	if ( IsStorage( e ) ) {
+		return;
+	}
+	if ( storages.empty() ) {
+		ForEveryGameResource( resource ) {
+			withStock[ ( int )resource ].Init( map.sizeX, map.sizeZ );
+			withCapacity[ ( int )resource ].Init( map.sizeX, map.sizeZ );
+		}
+	}
+	Storage & storage = storages[ e ];
+	storage.building = building;
+	storage.inventory = inventory;
+	maxStorageExtent = MAX( maxStorageExtent, building.tileSizeX + building.tileSizeZ );
+	FileStorage( e, storage, true );
+	version++;
+}
+
+void LogisticsIndex::RemoveStorage( Entity e ) {
+	auto it = storages.find( e );
+	if ( it == storages.end() ) {
+		return;
+	}
+	FileStorage( e, it->second, false );
+	storages.erase( it );
+	version++;
+}
+
+void LogisticsIndex::Refresh( Entity e, const CpntResourceInventory & inventory ) {
+	auto it = storages.find( e );
+	if ( it == storages.end() ) {
+		return;
+	}
+	FileStorage( e, it->second, false );
+	it->second.inventory = inventory;
+	FileStorage( e, it->second, true );
+	version++;
+}
+
+void LogisticsIndex::FileStorage( Entity e, const Storage & storage, bool add ) {
+	const Cell cell = storage.building.cell;
+	ForEveryGameResource( resource ) {
+		int i = ( int )resource;
+		u32 stock = storage.inventory.GetResourceAmount( resource );
+		u32 capacity = storage.inventory.GetResourceCapacity( resource );
+		if ( add ) {
+			if ( stock > 0 ) {
+				withStock[ i ].Insert( e, cell );
+			}
+			if ( capacity > 0 ) {
+				withCapacity[ i ].Insert( e, cell );
+			}
+			totalStock[ i ] += stock;
+			totalCapacity[ i ] += capacity;
+		} else {
+			if ( stock > 0 ) {
+				withStock[ i ].Remove( e, cell );
+			}
+			if ( capacity > 0 ) {
+				withCapacity[ i ].Remove( e, cell );
+			}
+			totalStock[ i ] -= stock;
+			totalCapacity[ i ] -= capacity;
+		}
+	}
+}
+
+void LogisticsIndex::FindStorages( GameResource                 resource,
+                                   bool                         withCapacity,
+                                   const CpntBuilding &         origin,
+                                   u32                          maxDistance,
+                                   ng::DynamicArray< Entity > & out ) const {
+	const SpatialBucketGrid & grid = withCapacity ? this->withCapacity[ ( int )resource ] : withStock[ ( int )resource ];
+	if ( grid.Size() == 0 ) {
+		return;
+	}
+	// Distances are counted between road cells next to the buildings, and storages are filed by their corner
+	u64 reach = ( u64 )maxDistance + origin.tileSizeX + origin.tileSizeZ + maxStorageExtent + 2;
+
+	thread_local ng::DynamicArray< SpatialBucketGrid::Entry > ring;
+	u32                                                       numFound = 0;
+	for ( u32 r = 0; SpatialBucketGrid::RingMinDistance( r ) <= reach && numFound < grid.Size(); r++ ) {
+		ring.Clear();
+		if ( !grid.GatherRing( origin.cell, r, ring ) ) {
+			break;
+		}
+		for ( const SpatialBucketGrid::Entry & entry : ring ) {
+			out.PushBack( entry.entity );
+		}
+		numFound += ring.Size();
+	}
+}
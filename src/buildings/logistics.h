@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../entity.h"
+#include "../map.h"
+#include "building.h"
+#include <unordered_map>
+
+// Storage houses sorted out by the resources they can give or take, so that nobody has to look at every building to
+// find one. SystemResourceInventory keeps it up to date as transactions go through
+struct LogisticsIndex {
+	struct Storage {
+		CpntBuilding          building;
+		CpntResourceInventory inventory;
+	};
+
+	void AddStorage( Entity e, const CpntBuilding & building, const CpntResourceInventory & inventory, const Map & map );
+	void RemoveStorage( Entity e );
+	// Call it whenever the inventory of e changed, it does nothing if e is not a storage
+	void Refresh( Entity e, const CpntResourceInventory & inventory );
+	bool IsStorage( Entity e ) const { return storages.find( e ) != storages.end(); }
+
+	// Storages holding some resource, or with room for it, nearest to origin first
+	// The ones too far to be reached by road within maxDistance are left out
+	void FindStorages( GameResource               resource,
+	                   bool                       withCapacity,
+	                   const CpntBuilding &       origin,
+	                   u32                        maxDistance,
+	                   ng::DynamicArray< Entity > & out ) const;
+
+	u32 GetTotalStock( GameResource resource ) const { return totalStock[ ( int )resource ]; }
+	u32 GetTotalCapacity( GameResource resource ) const { return totalCapacity[ ( int )resource ]; }
+
+	std::unordered_map< Entity, Storage, EntityHash > storages;
+	// Bumped on every change to the storages, so copies of them can tell they are stale
+	u64 version = 0;
+
+  private:
+	void FileStorage( Entity e, const Storage & storage, bool add );
+
+	SpatialBucketGrid withStock[ ( int )GameResource::NUM_RESOURCES ];
+	SpatialBucketGrid withCapacity[ ( int )GameResource::NUM_RESOURCES ];
+	u32               totalStock[ ( int )GameResource::NUM_RESOURCES ] = {};
+	u32               totalCapacity[ ( int )GameResource::NUM_RESOURCES ] = {};
+	u32               maxStorageExtent = 0; // largest tileSizeX + tileSizeZ among the storages
+};
@@ -39,52 +39,49 @@ bool CanPlaceBuilding( const Cell cell, BuildingKind kind, const Map & map ) {
 		if ( cell.x + size.x >= map.sizeX || cell.z + size.y >= map.sizeZ ) {
 			return false;
 		}
-		for ( u32 x = cell.x; x < cell.x + size.x; x++ ) {
-			for ( u32 z = cell.z; z < cell.z + size.y; z++ ) {
-				if ( map.GetTile( x, z ) != MapTile::EMPTY ) {
-					return false;
-				}
-			}
-		}
-		return true;
+		return map.IsAreaEmpty( cell.x, cell.z, size.x, size.y );
 	}
 	}
 }
 
-Entity FindBuildingByPosition( Registery & reg, const Cell cell ) {
-	for ( auto [ e, building ] : reg.IterateOver< CpntBuilding >() ) {
-		if ( IsCellInsideBuilding( building, cell ) ) {
-			return e;
+Entity FindBuildingByPosition( const Cell cell, const Map & map ) { return map.GetBuildingAt( cell ); }
+
+static void RemoveBuildingFromMap( const CpntBuilding & building, Map & map ) {
+	for ( u32 x = building.cell.x; x < building.cell.x + building.tileSizeX; x++ ) {
+		for ( u32 z = building.cell.z; z < building.cell.z + building.tileSizeZ; z++ ) {
+			map.SetTile( x, z, MapTile::EMPTY );
 		}
 	}
-	return INVALID_ENTITY;
+	map.SetBuildingArea( building.cell, building.tileSizeX, building.tileSizeZ, INVALID_ENTITY );
 }
 
 bool DeleteBuildingByPosition( Registery & reg, const Cell cell, Map & map ) {
-	for ( auto [ e, building ] : reg.IterateOver< CpntBuilding >() ) {
-		if ( IsCellInsideBuilding( building, cell ) ) {
-			reg.MarkForDelete( e );
-			for ( u32 x = building.cell.x; x < building.cell.x + building.tileSizeX; x++ ) {
-				for ( u32 z = building.cell.z; z < building.cell.z + building.tileSizeZ; z++ ) {
-					map.SetTile( x, z, MapTile::EMPTY );
-				}
-			}
-			return true;
-		}
+	Entity e = map.GetBuildingAt( cell );
+	if ( e == INVALID_ENTITY ) {
+		return false;
+	}
+	const CpntBuilding * building = reg.TryGetComponent< CpntBuilding >( e );
+	if ( building == nullptr ) {
+		return false;
 	}
-	return false;
+	reg.MarkForDelete( e );
+	RemoveBuildingFromMap( *building, map );
+	return true;
 }
 
 int DeleteBuildingsInsideArea( Registery & reg, const Area & area, Map & map ) {
+	ng_assert( area.shape == Area::Shape::RECTANGLE );
+	thread_local ng::DynamicArray< Entity > buildingsInArea;
+	buildingsInArea.Clear();
+	map.FindBuildingsInArea( area.center.x, area.center.z, MAX( area.sizeX, 0 ), MAX( area.sizeZ, 0 ),
+	                         buildingsInArea );
+
 	int numDeletions = 0;
-	for ( auto [ e, building ] : reg.IterateOver< CpntBuilding >() ) {
-		if ( IsBuildingInsideArea( building, area ) ) {
+	for ( Entity e : buildingsInArea ) {
+		const CpntBuilding * building = reg.TryGetComponent< CpntBuilding >( e );
+		if ( building != nullptr ) {
 			reg.MarkForDelete( e );
-			for ( u32 x = building.cell.x; x < building.cell.x + building.tileSizeX; x++ ) {
-				for ( u32 z = building.cell.z; z < building.cell.z + building.tileSizeZ; z++ ) {
-					map.SetTile( x, z, MapTile::EMPTY );
-				}
-			}
+			RemoveBuildingFromMap( *building, map );
 			numDeletions++;
 		}
 	}
@@ -150,6 +147,7 @@ Entity PlaceBuilding( Registery & reg, const Cell cell, BuildingKind kind, Map &
 			map.SetTile( x, z, MapTile::BLOCKED );
 		}
 	}
+	map.SetBuildingArea( cell, size.x, size.y, e );
 
 	reg.AssignComponent< CpntRenderModel >( e, GetBuildingModel( kind ) );
 
@@ -7,7 +7,7 @@ struct Map;
 struct Model;
 
 bool          CanPlaceBuilding( const Cell cell, BuildingKind kind, const Map & map );
-Entity        FindBuildingByPosition( Registery & reg, const Cell cell );
+Entity        FindBuildingByPosition( const Cell cell, const Map & map );
 Entity        PlaceBuilding( Registery & reg, const Cell cell, BuildingKind kind, Map & map );
 bool          DeleteBuildingByPosition( Registery & reg, const Cell cell, Map & map );
 int           DeleteBuildingsInsideArea( Registery & reg, const Area & area, Map & map );
@@ -36,8 +36,8 @@ void SystemFetcher::HandleMessage( Registery & reg, const Message & msg ) {
 		}
 		auto & agent = reg.GetComponent< CpntNavAgent >( msg.recipient );
 		auto & transform = reg.GetComponent< CpntTransform >( msg.recipient );
-		fetcher.target = theGame->systemManager.GetSystem< SystemPathfinding >().CopyAndDeletePath(
-		    response.id, agent.pathfindingNextSteps );
+		fetcher.target =
+		    theGame->systemManager.GetSystem< SystemPathfinding >().TakePath( response.id, agent.pathfindingNextSteps );
 		transform.SetTranslation( GetPointInMiddleOfCell( agent.pathfindingNextSteps.Last() ) );
 		break;
 	}
@@ -61,18 +61,14 @@ void SystemFetcher::HandleMessage( Registery & reg, const Message & msg ) {
 
 			// Now let's go back to our parent
 			cpntFetcher.direction = CpntResourceFetcher::CurrentDirection::TO_PARENT;
+			// Every fetcher of a building walks back on the same flow field, no need to ask for a path
 			CpntBuilding * parentBuilding = reg.TryGetComponent< CpntBuilding >( cpntFetcher.parent );
 			if ( parentBuilding == nullptr ) {
 				ng::Errorf( "A fetcher arrived at destination, but there is no parent to go back anymore! :(\n" );
 				reg.MarkForDelete( fetcher );
-			} else {
-				PathfindingTask task{};
-				task.type = PathfindingTask::Type::FROM_CELL_TO_BUILDING;
-				task.start.cell = GetCellForTransform( reg.GetComponent< CpntTransform >( fetcher ) );
-				task.goal.building = *parentBuilding;
-				task.movementAllowed = ROAD_NETWORK_AND_ROAD_BLOCK;
-				task.requester = fetcher;
-				PostMsg< PathfindingTask >( MESSAGE_PATHFINDING_REQUEST, task, INVALID_ENTITY, fetcher );
+			} else if ( !theGame->systemManager.GetSystem< SystemNavAgent >().FollowFlowField(
+			                reg, fetcher, cpntFetcher.parent, ROAD_NETWORK_AND_ROAD_BLOCK ) ) {
+				reg.MarkForDelete( fetcher );
 			}
 		} else if ( cpntFetcher.direction == CpntResourceFetcher::CurrentDirection::TO_PARENT ) {
 			// We are back to the parent
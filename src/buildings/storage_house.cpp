@@ -10,14 +10,33 @@ constexpr glm::vec3 offsetsForResources[ CpntStorageHouse::MAX_RESOURCES ] = {
     { 0.0f, 0.0f, 1.0f },  { -1.0f, 0.0f, -1.0f }, { -1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 1.0f },
 };
 
+SystemStorageHouse::SystemStorageHouse() {
+	ForEveryGameResource( resource ) { resourceBatches[ ( int )resource ].Init( GetGameResourceModel( resource ) ); }
+}
+
 void SystemStorageHouse::OnCpntAttached( Entity e, CpntStorageHouse & t ) { ListenTo( MESSAGE_INVENTORY_UPDATE, e ); }
 
 void SystemStorageHouse::OnCpntRemoved( Entity e, CpntStorageHouse & t ) {
 	for ( u32 i = 0; i < CpntStorageHouse::MAX_RESOURCES; i++ ) {
-		if ( t.displayedResources[ i ] != INVALID_ENTITY ) {
-			theGame->registery->MarkForDelete( t.displayedResources[ i ] );
+		if ( t.displayedResources[ i ] != GameResource::NUM_RESOURCES ) {
+			resourceBatches[ ( int )t.displayedResources[ i ] ].RemoveInstanceWithKey( SlotKey( e, i ) );
+		}
+	}
+}
+
+void SystemStorageHouse::ComputeDisplayedResources( const CpntResourceInventory & inventory,
+                                                    GameResource ( &outSlots )[ CpntStorageHouse::MAX_RESOURCES ] ) {
+	u32 offset = 0;
+	ForEveryGameResource( resource ) {
+		for ( u32 quantity = 0;
+		      quantity < inventory.GetResourceAmount( resource ) && offset < CpntStorageHouse::MAX_RESOURCES;
+		      quantity++ ) {
+			outSlots[ offset++ ] = resource;
 		}
 	}
+	for ( ; offset < CpntStorageHouse::MAX_RESOURCES; offset++ ) {
+		outSlots[ offset ] = GameResource::NUM_RESOURCES;
+	}
 }
 
 void SystemStorageHouse::HandleMessage( Registery & reg, const Message & msg ) {
@@ -26,24 +45,25 @@ void SystemStorageHouse::HandleMessage( Registery & reg, const Message & msg ) {
 		auto & storage = reg.GetComponent< CpntStorageHouse >( msg.recipient );
 		auto & inventory = reg.GetComponent< CpntResourceInventory >( msg.recipient );
 		auto & transform = reg.GetComponent< CpntTransform >( msg.recipient );
-		for ( Entity & e : storage.displayedResources ) {
-			if ( e != INVALID_ENTITY ) {
-				reg.MarkForDelete( e );
-				e = INVALID_ENTITY;
+
+		// Only the slots that show something else are touched
+		GameResource slots[ CpntStorageHouse::MAX_RESOURCES ];
+		ComputeDisplayedResources( inventory, slots );
+		for ( u32 i = 0; i < CpntStorageHouse::MAX_RESOURCES; i++ ) {
+			GameResource displayed = storage.displayedResources[ i ];
+			if ( slots[ i ] == displayed ) {
+				continue;
 			}
-		}
-		int offset = 0;
-		ForEveryGameResource( resource ) {
-			for ( int quantity = 0;
-			      quantity < inventory.GetResourceAmount( resource ) && offset < CpntStorageHouse::MAX_RESOURCES;
-			      quantity++ ) {
-				Entity resourceSprite = reg.CreateEntity();
-				storage.displayedResources[ offset ] = resourceSprite;
-				auto & childTransform = reg.AssignComponent< CpntTransform >( resourceSprite, transform.GetMatrix() );
-				childTransform.SetTranslation( childTransform.GetTranslation() + offsetsForResources[ offset ] );
-				reg.AssignComponent< CpntRenderModel >( resourceSprite, GetGameResourceModel( resource ) );
-				offset++;
+			u64 key = SlotKey( msg.recipient, i );
+			if ( displayed != GameResource::NUM_RESOURCES ) {
+				resourceBatches[ ( int )displayed ].RemoveInstanceWithKey( key );
+			}
+			if ( slots[ i ] != GameResource::NUM_RESOURCES ) {
+				CpntTransform slotTransform( transform.GetMatrix() );
+				slotTransform.SetTranslation( slotTransform.GetTranslation() + offsetsForResources[ i ] );
+				resourceBatches[ ( int )slots[ i ] ].AddInstanceWithKey( key, slotTransform.GetMatrix() );
 			}
+			storage.displayedResources[ i ] = slots[ i ];
 		}
 		break;
 	}
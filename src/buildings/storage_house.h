@@ -1,21 +1,33 @@
 #pragma once
 #include "../entity.h"
+#include "../mesh.h"
 #include "../system.h"
+#include "building.h"
 
 struct CpntStorageHouse {
 	CpntStorageHouse() {
 		for ( u32 i = 0; i < MAX_RESOURCES; i++ ) {
-			displayedResources[i] = INVALID_ENTITY;
+			displayedResources[i] = GameResource::NUM_RESOURCES;
 		}
 	}
 	static constexpr u32 MAX_RESOURCES = 8;
-	Entity displayedResources[ MAX_RESOURCES ];
+	// What is shown on each slot, NUM_RESOURCES for the empty ones
+	GameResource displayedResources[ MAX_RESOURCES ];
 };
 
 struct SystemStorageHouse : public System<CpntStorageHouse> {
+	SystemStorageHouse();
 	virtual void OnCpntAttached( Entity e, CpntStorageHouse & t ) override;
 	virtual void OnCpntRemoved( Entity e, CpntStorageHouse & t ) override;
 	virtual void HandleMessage( Registery & reg, const Message & msg ) override;
 	virtual void Update( Registery & reg, Duration ticks ) override;
 	virtual void DebugDraw() override;
+
+	// Fills the slots in order with what the inventory holds, one slot per unit
+	static void ComputeDisplayedResources( const CpntResourceInventory & inventory,
+	                                       GameResource ( &outSlots )[ CpntStorageHouse::MAX_RESOURCES ] );
+	static u64  SlotKey( Entity e, u32 slot ) { return ( u64 )e.id * CpntStorageHouse::MAX_RESOURCES + slot; }
+
+	// Every storage house shows its stock through these, keyed by SlotKey
+	InstancedModelBatch resourceBatches[ ( int )GameResource::NUM_RESOURCES ];
 };
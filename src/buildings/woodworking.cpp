@@ -1,4 +1,5 @@
 #include "woodworking.h"
+#include "../environment/trees.h"
 #include "../game.h"
 #include "../mesh.h"
 #include "../packer_resource_list.h"
@@ -74,62 +75,140 @@ void SystemWoodworker::Update( Registery & reg, Duration ticks ) {
 		if ( woodworker.choppingSince > 0 ) {
 			woodworker.choppingSince += ticks;
 			if ( woodworker.choppingSince >= woodworker.timeToChopOneTree ) {
+				theGame->systemManager.GetSystem< SystemTree >().ChopTree( reg, woodworker.tree );
+				woodworker.tree = INVALID_ENTITY;
 				// Time to get back to the woodshop
 				woodworker.currentDestination = CpntWoodworker::Destination::TO_WOODSHOP;
 				woodworker.choppingSince = 0;
-				CpntBuilding &  targetBuilding = reg.GetComponent< CpntBuilding >( woodworker.woodshop );
-				PathfindingTask task{};
-				task.type = PathfindingTask::Type::FROM_CELL_TO_BUILDING;
-				task.start.cell = GetCellForPoint( reg.GetComponent< CpntTransform >( e ).GetTranslation() );
-				task.goal.building = targetBuilding;
-				task.movementAllowed = ASTAR_ALLOW_DIAGONALS;
-				task.requester = e;
-				PostMsg< PathfindingTask >( MESSAGE_PATHFINDING_REQUEST, task, INVALID_ENTITY, e );
-				ListenTo( MESSAGE_PATHFINDING_RESPONSE, e );
+				// Woodworkers of the same woodshop all walk back on the same flow field
+				if ( !theGame->systemManager.GetSystem< SystemNavAgent >().FollowFlowField(
+				         reg, e, woodworker.woodshop, ASTAR_ALLOW_DIAGONALS ) ) {
+					ng::Errorf( "Could not find a path for woodworker\n" );
+					reg.MarkForDelete( e );
+				}
 			}
 		}
 	}
 }
 
 void SystemWoodworker::OnCpntAttached( Entity e, CpntWoodworker & t ) {
-	// Let's find a path to the nearest tree
-	CpntBuilding * woodshop = theGame->registery->TryGetComponent< CpntBuilding >( t.woodshop );
-	if ( woodshop ) {
+	// Let's claim the nearest tree nobody is going for
+	CpntBuilding * building = theGame->registery->TryGetComponent< CpntBuilding >( t.woodshop );
+	CpntWoodshop * woodshop = theGame->registery->TryGetComponent< CpntWoodshop >( t.woodshop );
+	if ( building && woodshop ) {
+		const Map &  map = theGame->map;
+		SystemTree & trees = theGame->systemManager.GetSystem< SystemTree >();
+		for ( int64 i = ( int64 )woodshop->unreachableTrees.Size() - 1; i >= 0; i-- ) {
+			if ( !trees.index.IsTree( woodshop->unreachableTrees[ i ] ) ) {
+				woodshop->unreachableTrees.DeleteIndexFast( ( u32 )i );
+			}
+		}
+		// A tree is only worth it if one side of the woodshop leads to it
+		ng::DynamicArray< Cell > exits;
+		ng::DynamicArray< u32 >  exitRegions;
+		for ( Cell cell : building->AdjacentCells( map ) ) {
+			u32 region = trees.regions.GetRegion( cell, map );
+			if ( region != NavigableRegions::NO_REGION ) {
+				exits.PushBack( cell );
+				exitRegions.PushBack( region );
+			}
+		}
+		auto canApproach = [ & ]( Entity tree, Cell approach ) {
+			return woodshop->unreachableTrees.FindIndexByValue( tree ) == -1 &&
+			       exitRegions.FindIndexByValue( trees.regions.GetRegion( approach, map ) ) != -1;
+		};
+		Cell approach;
+		t.tree = trees.index.ReserveClosestTree( building->cell, e, map, approach, canApproach );
+		// Leave from the side of the woodshop facing the tree
+		Cell start = INVALID_CELL;
+		u64  startDistance = ULLONG_MAX;
+		if ( t.tree != INVALID_ENTITY ) {
+			u32 region = trees.regions.GetRegion( approach, map );
+			for ( u32 i = 0; i < exits.Size(); i++ ) {
+				const Cell & cell = exits[ i ];
+				int64 dx = std::abs( ( int64 )cell.x - approach.x );
+				int64 dz = std::abs( ( int64 )cell.z - approach.z );
+				u64   distance = ( u64 )( dx + dz );
+				if ( exitRegions[ i ] == region && distance < startDistance ) {
+					start = cell;
+					startDistance = distance;
+				}
+			}
+		}
+		if ( start == INVALID_CELL ) {
+			ng::Errorf( "Could not find a tree for woodworker\n" );
+			theGame->registery->MarkForDelete( e );
+			return;
+		}
+
 		PathfindingTask task{};
-		task.type = PathfindingTask::Type::FROM_BUILDING_TO_TILE_TYPE;
-		task.start.building = *woodshop;
-		task.goal.tileType = MapTile::TREE;
+		task.type = PathfindingTask::Type::FROM_CELL_TO_CELL;
+		task.start.cell = start;
+		task.goal.cell = approach;
 		task.movementAllowed = ASTAR_ALLOW_DIAGONALS;
 		task.requester = e;
+		// Trees can be far, start walking before the search is done
+		task.acceptPartialPath = true;
 		PostMsg< PathfindingTask >( MESSAGE_PATHFINDING_REQUEST, task, INVALID_ENTITY, e );
 		ListenTo( MESSAGE_PATHFINDING_RESPONSE, e );
 	}
 }
 
+void SystemWoodworker::OnCpntRemoved( Entity e, CpntWoodworker & t ) {
+	if ( t.tree != INVALID_ENTITY ) {
+		theGame->systemManager.GetSystem< SystemTree >().index.ReleaseTree( t.tree );
+	}
+}
+
 void SystemWoodworker::HandleMessage( Registery & reg, const Message & msg ) {
 	switch ( msg.type ) {
 	case MESSAGE_PATHFINDING_RESPONSE: {
-		auto &           payload = CastPayloadAs< PathfindingTaskResponse >( msg.payload );
-		CpntWoodworker * woodworker = reg.TryGetComponent< CpntWoodworker >( msg.recipient );
-		if ( woodworker != nullptr ) {
-			if ( payload.ok == false ) {
-				ng::Errorf( "Could not find a path for woodworker\n" );
-				reg.MarkForDelete( msg.recipient );
-				return;
+		auto &              payload = CastPayloadAs< PathfindingTaskResponse >( msg.payload );
+		SystemPathfinding & pathfinding = theGame->systemManager.GetSystem< SystemPathfinding >();
+		CpntWoodworker *    woodworker = reg.TryGetComponent< CpntWoodworker >( msg.recipient );
+		if ( woodworker == nullptr ) {
+			if ( payload.ok ) {
+				pathfinding.DeletePath( payload.id );
+			}
+			break;
+		}
+		if ( payload.ok == false ) {
+			ng::Errorf( "Could not find a path for woodworker\n" );
+			// Don't send anyone else there
+			CpntWoodshop * woodshop = reg.TryGetComponent< CpntWoodshop >( woodworker->woodshop );
+			if ( woodshop != nullptr && woodworker->tree != INVALID_ENTITY ) {
+				woodshop->unreachableTrees.PushBack( woodworker->tree );
 			}
-			CpntNavAgent &  navAgent = reg.GetComponent< CpntNavAgent >( msg.recipient );
-			CpntTransform & transform = reg.GetComponent< CpntTransform >( msg.recipient );
-			theGame->systemManager.GetSystem< SystemPathfinding >().CopyAndDeletePath( payload.id,
-			                                                                           navAgent.pathfindingNextSteps );
-			transform.SetTranslation( GetPointInMiddleOfCell( navAgent.pathfindingNextSteps.Last() ) );
-			ListenTo( MESSAGE_NAVAGENT_DESTINATION_REACHED, msg.recipient );
+			reg.MarkForDelete( msg.recipient );
+			return;
+		}
+		CpntNavAgent &  navAgent = reg.GetComponent< CpntNavAgent >( msg.recipient );
+		CpntTransform & transform = reg.GetComponent< CpntTransform >( msg.recipient );
+		if ( payload.isPartial ) {
+			// Head towards the tree while the search goes on
+			pathfinding.TakePath( payload.id, woodworker->partialPath );
+			navAgent.pathfindingNextSteps = woodworker->partialPath;
+		} else if ( woodworker->partialPath.Empty() == false ) {
+			ng::DynamicArray< Cell > finalPath;
+			pathfinding.TakePath( payload.id, finalPath );
+			SwapInFinalPath( woodworker->partialPath, finalPath, navAgent.pathfindingNextSteps );
+			woodworker->partialPath.Clear();
+			break;
+		} else {
+			pathfinding.TakePath( payload.id, navAgent.pathfindingNextSteps );
 		}
+		transform.SetTranslation( GetPointInMiddleOfCell( navAgent.pathfindingNextSteps.Last() ) );
+		ListenTo( MESSAGE_NAVAGENT_DESTINATION_REACHED, msg.recipient );
 		break;
 	}
 	case MESSAGE_NAVAGENT_DESTINATION_REACHED: {
 		CpntWoodworker * woodworker = reg.TryGetComponent< CpntWoodworker >( msg.recipient );
 		if ( woodworker != nullptr ) {
 			if ( woodworker->currentDestination == CpntWoodworker::Destination::TO_TREE ) {
+				if ( woodworker->partialPath.Empty() == false ) {
+					// End of the partial path, wait there for the real one
+					break;
+				}
 				woodworker->choppingSince = 1;
 			} else if ( woodworker->currentDestination == CpntWoodworker::Destination::TO_WOODSHOP ) {
 				PostMsg( MESSAGE_WOODSHOP_WORKER_RETURNED, woodworker->woodshop, msg.recipient );
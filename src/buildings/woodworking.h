@@ -2,6 +2,8 @@
 
 #include "../entity.h"
 #include "../game_time.h"
+#include "../map.h"
+#include "../ngLib/ngcontainers.h"
 #include "../system.h"
 
 struct CpntWoodshop {
@@ -9,6 +11,8 @@ struct CpntWoodshop {
 	Entity   deliveryGuy = INVALID_ENTITY;
 	Duration timeBetweenWorkerMissions = DurationFromSeconds( 5 );
 	Duration timeSinceLastWorkerSpawned = 0;
+	// Trees a worker of this woodshop failed to find a path to, nobody from here goes for them again
+	ng::DynamicArray< Entity > unreachableTrees;
 };
 
 struct SystemWoodshop : public System< CpntWoodshop > {
@@ -26,11 +30,17 @@ struct CpntWoodworker {
 		TO_WOODSHOP,
 	};
 	Entity      woodshop = INVALID_ENTITY;
+	// Reserved in the tree index until it is chopped or the woodworker dies
+	Entity      tree = INVALID_ENTITY;
 	Destination currentDestination = Destination::TO_TREE;
+
+	// Path we started walking on while the search to the tree goes on, empty once the final one came in
+	ng::DynamicArray< Cell > partialPath;
 };
 
 struct SystemWoodworker : public System< CpntWoodworker > {
 	void Update( Registery & reg, Duration ticks ) override;
 	void OnCpntAttached( Entity e, CpntWoodworker & t ) override;
+	void OnCpntRemoved( Entity e, CpntWoodworker & t ) override;
 	void HandleMessage( Registery & reg, const Message & msg ) override;
 };
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/matrix_decompose.hpp>
+#include <functional>
 #include <typeindex>
 #include <typeinfo>
 
@@ -19,6 +20,10 @@ struct Entity {
 
 	bool operator==( const Entity & rhs ) const { return id == rhs.id && version == rhs.version; }
 };
+struct EntityHash {
+	size_t operator()( const Entity & e ) const { return std::hash< u64 >()( ( ( u64 )e.id << 32 ) | e.version ); }
+};
+
 constexpr u32    INVALID_ENTITY_INDEX = ( u32 )-1;
 constexpr Entity INVALID_ENTITY = { ( u32 )-1, 0 };
 
@@ -31,14 +36,15 @@ struct CpntTransform {
 
 	glm::vec3 Transform( const glm::vec3 source ) const { return matrix * glm::vec4( source, 1.0f ); }
 
+	// The translation only ends up in the last column of the matrix, no need to compute everything again
 	void Translate( const glm::vec3 & v ) {
 		translation += v;
-		ComputeMatrix();
+		matrix[ 3 ] = glm::vec4( translation, 1.0f );
 	}
 
 	void SetTranslation( const glm::vec3 & v ) {
 		translation = v;
-		ComputeMatrix();
+		matrix[ 3 ] = glm::vec4( translation, 1.0f );
 	}
 
 	void SetScale( float v ) {
@@ -1,12 +1,130 @@
 #include "trees.h"
 #include "../game.h"
 #include "../mesh.h"
+#include "../navigation.h"
 #include "../packer_resource_list.h"
 
+void TreeIndex::AddTree( Entity tree, Cell cell, const Map & map ) {
+	if ( IsTree( tree ) ) {
+		return;
+	}
+	if ( trees.empty() ) {
+		available.Init( map.sizeX, map.sizeZ );
+	}
+	trees[ tree ] = Tree{ cell, INVALID_ENTITY };
+	available.Insert( tree, cell );
+}
+
+void TreeIndex::RemoveTree( Entity tree ) {
+	auto it = trees.find( tree );
+	if ( it == trees.end() ) {
+		return;
+	}
+	if ( it->second.reservedBy == INVALID_ENTITY ) {
+		available.Remove( tree, it->second.cell );
+	}
+	trees.erase( it );
+}
+
+static bool FindApproachCell( Entity                            treeEntity,
+                              Cell                              tree,
+                              Cell                              origin,
+                              const Map &                       map,
+                              const TreeIndex::ApproachFilter & canApproach,
+                              Cell &                            outApproachCell ) {
+	ng::StaticArray< Cell, 4 > neighbors;
+	GetNeighborsOfCell( tree, map, neighbors );
+	u64 bestDistance = ULLONG_MAX;
+	for ( const Cell & neighbor : neighbors ) {
+		if ( !map.IsTileAStarNavigable( neighbor ) || ( canApproach && !canApproach( treeEntity, neighbor ) ) ) {
+			continue;
+		}
+		u64 distance = ( u64 )std::abs( ( int64 )neighbor.x - origin.x ) + std::abs( ( int64 )neighbor.z - origin.z );
+		if ( distance < bestDistance ) {
+			bestDistance = distance;
+			outApproachCell = neighbor;
+		}
+	}
+	return bestDistance != ULLONG_MAX;
+}
+
+Entity TreeIndex::ReserveClosestTree( Cell                   origin,
+                                     Entity                 worker,
+                                     const Map &            map,
+                                     Cell &                 outApproachCell,
+                                     const ApproachFilter & canApproach /*= nullptr*/ ) {
+	if ( available.Size() == 0 ) {
+		return INVALID_ENTITY;
+	}
+
+	thread_local ng::DynamicArray< SpatialBucketGrid::Entry > ring;
+	Entity                                                    closest = INVALID_ENTITY;
+	u32                                                       closestDistance = ULONG_MAX;
+	u32                                                       numVisited = 0;
+	// A tree in ring r is at least RingMinDistance(r) away along x or z, once that is further than the best one we
+	// can stop
+	for ( u32 r = 0; numVisited < available.Size() && SpatialBucketGrid::RingMinDistance( r ) <= closestDistance;
+	      r++ ) {
+		ring.Clear();
+		if ( !available.GatherRing( origin, r, ring ) ) {
+			break;
+		}
+		numVisited += ring.Size();
+		for ( const SpatialBucketGrid::Entry & entry : ring ) {
+			u32 distance = MAX( ( u32 )std::abs( ( int64 )entry.cell.x - origin.x ),
+			                    ( u32 )std::abs( ( int64 )entry.cell.z - origin.z ) );
+			Cell approach;
+			if ( distance < closestDistance &&
+			     FindApproachCell( entry.entity, entry.cell, origin, map, canApproach, approach ) ) {
+				closest = entry.entity;
+				closestDistance = distance;
+				outApproachCell = approach;
+			}
+		}
+	}
+	if ( closest == INVALID_ENTITY ) {
+		return INVALID_ENTITY;
+	}
+
+	Tree & tree = trees[ closest ];
+	tree.reservedBy = worker;
+	available.Remove( closest, tree.cell );
+	return closest;
+}
+
+void TreeIndex::ReleaseTree( Entity tree ) {
+	auto it = trees.find( tree );
+	if ( it == trees.end() || it->second.reservedBy == INVALID_ENTITY ) {
+		return;
+	}
+	it->second.reservedBy = INVALID_ENTITY;
+	available.Insert( tree, it->second.cell );
+}
+
+Entity TreeIndex::GetReservation( Entity tree ) const {
+	auto it = trees.find( tree );
+	return it == trees.end() ? INVALID_ENTITY : it->second.reservedBy;
+}
+
 SystemTree::SystemTree() { instances.Init( g_modelAtlas.GetModel( PackerResources::PINE_DAE) ); }
 
 void SystemTree::OnCpntAttached( Entity e, CpntTree & t ) {
-	instances.AddInstance( e, theGame->registery->GetComponent< CpntTransform >( e ).GetMatrix() );
+	const CpntTransform & transform = theGame->registery->GetComponent< CpntTransform >( e );
+	instances.AddInstance( e, transform.GetMatrix() );
+	index.AddTree( e, GetCellForTransform( transform ), theGame->map );
+}
+
+void SystemTree::OnCpntRemoved( Entity e, CpntTree & t ) {
+	instances.RemoveInstance( e );
+	index.RemoveTree( e );
 }
 
-void SystemTree::OnCpntRemoved( Entity e, CpntTree & t ) { instances.RemoveInstance( e ); }
+void SystemTree::ChopTree( Registery & reg, Entity tree ) {
+	CpntTransform * transform = reg.TryGetComponent< CpntTransform >( tree );
+	if ( transform == nullptr || !index.IsTree( tree ) ) {
+		return;
+	}
+	theGame->map.SetTile( GetCellForTransform( *transform ), MapTile::EMPTY );
+	index.RemoveTree( tree );
+	reg.MarkForDelete( tree );
+}
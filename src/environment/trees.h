@@ -1,13 +1,56 @@
 #pragma once
 #include "../system.h"
+#include "../map.h"
 #include "../mesh.h"
+#include "../navigation.h"
+#include <functional>
+#include <unordered_map>
 
 struct CpntTree {};
 
+// Live trees filed by cell. Woodworkers reserve the tree they walk to, reserved trees are taken out of the grid so
+// that two woodworkers never go for the same one
+struct TreeIndex {
+	void AddTree( Entity tree, Cell cell, const Map & map );
+	// Drops the reservation as well
+	void RemoveTree( Entity tree );
+	bool IsTree( Entity tree ) const { return trees.contains( tree ); }
+
+	// Tells if the worker can walk to a cell next to the tree
+	using ApproachFilter = std::function< bool( Entity tree, Cell approachCell ) >;
+
+	// Reserves for worker the closest tree nobody claimed that has a free cell next to it, which is where the worker
+	// should walk to. Returns INVALID_ENTITY when there is none
+	Entity ReserveClosestTree( Cell                   origin,
+	                           Entity                 worker,
+	                           const Map &            map,
+	                           Cell &                 outApproachCell,
+	                           const ApproachFilter & canApproach = nullptr );
+	void   ReleaseTree( Entity tree );
+	Entity GetReservation( Entity tree ) const;
+
+	u32 GetNumTrees() const { return ( u32 )trees.size(); }
+	u32 GetNumReserved() const { return ( u32 )trees.size() - available.Size(); }
+
+  private:
+	struct Tree {
+		Cell   cell;
+		Entity reservedBy = INVALID_ENTITY;
+	};
+	std::unordered_map< Entity, Tree, EntityHash > trees;
+	SpatialBucketGrid                              available;
+};
+
 struct SystemTree : public System< CpntTree > {
 	SystemTree();
 	virtual void OnCpntAttached( Entity e, CpntTree & t ) override;
 	virtual void OnCpntRemoved( Entity e, CpntTree & t ) override;
 
+	// The tree is gone, its cell can be walked on again
+	void ChopTree( Registery & reg, Entity tree );
+
 	InstancedModelBatch instances;
-};
\ No newline at end of file
+	TreeIndex           index;
+	// So that woodworkers only go for trees they can get to
+	NavigableRegions regions;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "buildings/logistics.h"
 #include "entity.h"
 #include "game_time.h"
 #include "io.h"
@@ -8,6 +9,7 @@
 #include "packer.h"
 #include "registery.h"
 #include "renderer.h"
+#include "service.h"
 #include "system.h"
 #include "window.h"
 
@@ -30,18 +32,20 @@ struct Game {
 		LOADING,
 	};
 
-	Registery *   registery = nullptr;
-	SystemManager systemManager;
-	State         state;
-	IO            io;
-	Window        window;
-	PackerPackage package;
-	Map           map;
-	RoadNetwork   roadNetwork;
-	Renderer      renderer;
-	TimePoint     clock = 0;
-	Duration      ticks = 1;
-	float         speed = 1.0f;
+	Registery *     registery = nullptr;
+	SystemManager   systemManager;
+	State           state;
+	IO              io;
+	Window          window;
+	PackerPackage   package;
+	Map             map;
+	RoadNetwork     roadNetwork;
+	LogisticsIndex  logistics;
+	ServiceCoverage serviceCoverage;
+	Renderer        renderer;
+	TimePoint       clock = 0;
+	Duration        ticks = 1;
+	float           speed = 1.0f;
 };
 
 extern Game * theGame;
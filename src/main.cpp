@@ -225,9 +225,11 @@ int main( int ac, char ** av ) {
 
 #if 1
 	// Run functionnal tests
+	map.BeginEdit();
 	for ( u32 x = 0; x < 20; x++ ) {
 		SpawnRoadTile( registery, map, Cell( x, 0 ) );
 	}
+	map.CommitEdit();
 	PlaceBuilding( registery, Cell( 1, 1 ), BuildingKind::FOUNTAIN, map );
 	PlaceBuilding( registery, Cell( 2, 1 ), BuildingKind::MARKET, map );
 	PlaceBuilding( registery, Cell( 5, 1 ), BuildingKind::FARM, map );
@@ -442,13 +444,7 @@ int main( int ac, char ** av ) {
 			                                          ( int )floorf( mouseProjectionOnGround.z ) );
 
 			Cell   mouseCellPosition = GetCellForPoint( mouseProjectionOnGroundFloored );
-			Entity hoveredEntity = INVALID_ENTITY;
-			for ( auto const & [ e, building ] : registery.IterateOver< CpntBuilding >() ) {
-				if ( IsCellInsideBuilding( building, mouseCellPosition ) ) {
-					hoveredEntity = e;
-					break;
-				}
-			}
+			Entity hoveredEntity = map.GetBuildingAt( mouseCellPosition );
 
 			static MouseAction  currentMouseAction = MouseAction::SELECT;
 			static BuildingKind buildingKindSelected;
@@ -518,10 +514,12 @@ int main( int ac, char ** av ) {
 						ImGui::Text( "Number of incoming migrants : %d\n", housing.numIncomingMigrants );
 						for ( int i = 0; i < ( int )GameService::NUM_SERVICES; i++ ) {
 							if ( housing.isServiceRequired[ i ] == true ) {
-								ImGui::Text(
-								    "Service %d: is fulfilled ? %s, last accessed %lld frames ago", i,
-								    IsServiceFulfilled( housing.lastServiceAccess[ i ], theGame->clock ) ? "Yes" : "No",
-								    theGame->clock - housing.lastServiceAccess[ i ] );
+								TimePoint lastAccess =
+								    GetLastServiceAccess( registery.GetComponent< CpntBuilding >( selectedEntity ),
+								                          housing, ( GameService )i );
+								ImGui::Text( "Service %d: is fulfilled ? %s, last accessed %lld frames ago", i,
+								             IsServiceFulfilled( lastAccess, theGame->clock ) ? "Yes" : "No",
+								             theGame->clock - lastAccess );
 							}
 						}
 					}
@@ -571,7 +569,7 @@ int main( int ac, char ** av ) {
 			if ( currentMouseAction == MouseAction::SELECT ) {
 				// TODO: how could we highlight object under cursor?
 				if ( io.mouse.IsButtonPressed( Mouse::Button::LEFT ) ) {
-					selectedEntity = FindBuildingByPosition( registery, mouseCellPosition );
+					selectedEntity = FindBuildingByPosition( mouseCellPosition, map );
 				}
 			} else {
 				selectedEntity = INVALID_ENTITY;
@@ -629,6 +627,7 @@ int main( int ac, char ** av ) {
 
 			if ( currentMouseAction == MouseAction::BUILD_ROAD &&
 			     io.mouse.IsButtonDown( Mouse::Button::LEFT ) == false && mouseStartedDragging == true ) {
+				map.BeginEdit();
 				for ( u32 x = mouseDragCellStart.x; x != mouseCellPosition.x;
 				      mouseDragCellStart.x < mouseCellPosition.x ? x++ : x-- ) {
 					Cell cell( x, mouseDragCellStart.z );
@@ -647,6 +646,7 @@ int main( int ac, char ** av ) {
 				if ( map.GetTile( cell ) == MapTile::EMPTY ) {
 					SpawnRoadTile( registery, map, cell );
 				}
+				map.CommitEdit();
 
 				mouseStartedDragging = false;
 			}
@@ -664,6 +664,7 @@ int main( int ac, char ** av ) {
 					offsetZ = 1;
 				}
 
+				map.BeginEdit();
 				for ( u32 x = start.x; x < start.x + offsetX; x++ ) {
 					for ( u32 z = start.z; z < start.z + offsetZ; z++ ) {
 						if ( map.GetTile( x, z ) == MapTile::ROAD || map.GetTile( x, z ) == MapTile::ROAD_BLOCK ) {
@@ -671,6 +672,7 @@ int main( int ac, char ** av ) {
 						}
 					}
 				}
+				map.CommitEdit();
 
 				Area areaOfDeletion{};
 				areaOfDeletion.center = start;
@@ -1,24 +1,210 @@
 #include "map.h"
 #include "game.h"
 #include "navigation.h"
+#include <cstring>
+
+BuildingChunk::BuildingChunk() {
+	for ( Entity & owner : owners ) {
+		owner = INVALID_ENTITY;
+	}
+}
 
 void Map::AllocateGrid( u32 sizeX, u32 sizeZ ) {
 	this->sizeX = sizeX;
 	this->sizeZ = sizeZ;
+	numChunksX = ( sizeX + TileChunk::SIZE - 1 ) / TileChunk::SIZE;
+	numChunksZ = ( sizeZ + TileChunk::SIZE - 1 ) / TileChunk::SIZE;
+
+	// Chunks come to life when something is written in them
+	chunks.clear();
+	chunks.resize( ( u64 )numChunksX * numChunksZ );
+	dirtyChunks.Clear();
+}
+
+Map & Map::operator=( const Map & other ) {
+	if ( this == &other ) {
+		return *this;
+	}
+	sizeX = other.sizeX;
+	sizeZ = other.sizeZ;
+	numChunksX = other.numChunksX;
+	numChunksZ = other.numChunksZ;
+	roadVersion = other.roadVersion;
+	tileVersion = other.tileVersion;
+	// Only the pointers are copied, see WriteTile
+	chunks = other.chunks;
+	dirtyChunks = other.dirtyChunks;
+	return *this;
+}
+
+u64 Map::ComputeMemoryUsage() const {
+	u64 total = chunks.size() * sizeof( MapChunk );
+	for ( const MapChunk & chunk : chunks ) {
+		if ( chunk.tiles != nullptr ) {
+			total += sizeof( TileChunk );
+		}
+		if ( chunk.buildings != nullptr ) {
+			total += sizeof( BuildingChunk );
+		}
+	}
+	return total;
+}
+
+void Map::ConsumeDirtyChunks( ng::DynamicArray< u32 > & out ) {
+	for ( u32 chunkIndex : dirtyChunks ) {
+		chunks[ chunkIndex ].dirty = false;
+		out.PushBack( chunkIndex );
+	}
+	dirtyChunks.Clear();
+}
+
+void Map::WriteTile( u32 x, u32 z, MapTile type ) {
+	u32        chunkIndex = GetChunkIndex( Cell( x, z ) );
+	MapChunk & chunk = chunks[ chunkIndex ];
+	chunk.version = tileVersion;
+	MapTile previous = GetTile( x, z );
+	if ( ( IsTileAStarNavigable( previous ) && !IsTileAStarNavigable( type ) ) ||
+	     ( IsTileWalkable( previous ) && !IsTileWalkable( type ) ) ) {
+		chunk.closedVersion = tileVersion;
+	}
+	if ( !chunk.dirty ) {
+		chunk.dirty = true;
+		dirtyChunks.PushBack( chunkIndex );
+	}
+
+	if ( chunk.tiles == nullptr ) {
+		if ( type == MapTile::EMPTY ) {
+			return;
+		}
+		chunk.tiles = std::make_shared< TileChunk >();
+		for ( TileBlock & block : chunk.tiles->blocks ) {
+			block = TileBlock{ {}, 0, ~0ull, 0 };
+		}
+	} else if ( chunk.tiles.use_count() > 1 ) {
+		// Another map, probably a pathfinding snapshot, still reads this one
+		chunk.tiles = std::make_shared< TileChunk >( *chunk.tiles );
+	}
+
+	TileBlock & block = chunk.tiles->blocks[ IndexInChunk( x, z ) ];
+	u32         index = IndexInBlock( x, z );
+	u32         shift = ( index & 1 ) * 4;
+	block.types[ index >> 1 ] = ( block.types[ index >> 1 ] & ~( 0xf << shift ) ) | ( ( u8 )type << shift );
+
+	u64  bit = 1ull << index;
+	bool wasOccupied = block.occupied & bit;
+	block.walkable = IsTileWalkable( type ) ? block.walkable | bit : block.walkable & ~bit;
+	block.navigable = IsTileAStarNavigable( type ) ? block.navigable | bit : block.navigable & ~bit;
+	block.occupied = type != MapTile::EMPTY ? block.occupied | bit : block.occupied & ~bit;
+
+	chunk.tiles->numOccupied += ( type != MapTile::EMPTY ) - wasOccupied;
+	if ( chunk.tiles->numOccupied == 0 ) {
+		chunk.tiles = nullptr;
+	}
+}
+
+void Map::SetBuildingArea( Cell corner, u32 areaSizeX, u32 areaSizeZ, Entity building ) {
+	ng_assert( corner.x + areaSizeX <= sizeX && corner.z + areaSizeZ <= sizeZ );
+	for ( u32 x = corner.x; x < corner.x + areaSizeX; x++ ) {
+		for ( u32 z = corner.z; z < corner.z + areaSizeZ; z++ ) {
+			MapChunk & chunk = chunks[ GetChunkIndex( Cell( x, z ) ) ];
+			if ( chunk.buildings == nullptr ) {
+				if ( building == INVALID_ENTITY ) {
+					continue;
+				}
+				chunk.buildings = std::make_shared< BuildingChunk >();
+			} else if ( chunk.buildings.use_count() > 1 ) {
+				chunk.buildings = std::make_shared< BuildingChunk >( *chunk.buildings );
+			}
+
+			Entity & owner = chunk.buildings->owners[ IndexInBuildingChunk( x, z ) ];
+			chunk.buildings->numOwnedCells += ( building != INVALID_ENTITY ) - ( owner != INVALID_ENTITY );
+			owner = building;
+			if ( chunk.buildings->numOwnedCells == 0 ) {
+				chunk.buildings = nullptr;
+			}
+		}
+	}
+}
+
+void Map::FindBuildingsAdjacentToCell( Cell cell, ng::StaticArray< Entity, 4 > & out ) const {
+	Entity buildingOnCell = GetBuildingAt( cell );
+	// Out of the map neighbors wrap around to huge coordinates, GetBuildingAt ignores them
+	Cell neighbors[ 4 ] = { Cell( cell.x - 1, cell.z ), Cell( cell.x + 1, cell.z ), Cell( cell.x, cell.z - 1 ),
+	                        Cell( cell.x, cell.z + 1 ) };
+	for ( const Cell & neighbor : neighbors ) {
+		Entity building = GetBuildingAt( neighbor );
+		if ( building == INVALID_ENTITY || building == buildingOnCell ) {
+			continue;
+		}
+		// Buildings are rectangles, a cell outside of one can't have two neighbors inside it
+		out.PushBack( building );
+	}
+}
 
-	tiles = new MapTile[ ( u64 )sizeX * sizeZ ];
-	for ( u32 x = 0; x < sizeX; x++ ) {
-		for ( u32 z = 0; z < sizeZ; z++ ) {
-			tiles[ x * sizeZ + z ] = MapTile::EMPTY;
+void Map::FindBuildingsInArea( u32 x, u32 z, u32 areaSizeX, u32 areaSizeZ, ng::DynamicArray< Entity > & out ) const {
+	u32 endX = ( u32 )MIN( ( u64 )x + areaSizeX, ( u64 )sizeX );
+	u32 endZ = ( u32 )MIN( ( u64 )z + areaSizeZ, ( u64 )sizeZ );
+	for ( u32 cellX = x; cellX < endX; cellX++ ) {
+		for ( u32 cellZ = z; cellZ < endZ; cellZ++ ) {
+			const BuildingChunk * chunk = chunks[ GetChunkIndex( Cell( cellX, cellZ ) ) ].buildings.get();
+			if ( chunk == nullptr ) {
+				// Jump to the next chunk along z
+				cellZ |= TileChunk::SIZE - 1;
+				continue;
+			}
+			Entity owner = chunk->owners[ IndexInBuildingChunk( cellX, cellZ ) ];
+			if ( owner == INVALID_ENTITY ) {
+				continue;
+			}
+			// Buildings and the area are both rectangles, so is their overlap and it has a single corner cell
+			bool isCorner = ( cellX == x || GetBuildingAt( Cell( cellX - 1, cellZ ) ) != owner ) &&
+			                ( cellZ == z || GetBuildingAt( Cell( cellX, cellZ - 1 ) ) != owner );
+			if ( isCorner ) {
+				out.PushBack( owner );
+			}
 		}
 	}
 }
 
-MapTile Map::GetTile( Cell coord ) const { return GetTile( coord.x, coord.z ); }
-MapTile Map::GetTile( u32 x, u32 z ) const { return tiles[ x * sizeZ + z ]; }
+bool Map::IsAreaEmpty( u32 x, u32 z, u32 areaSizeX, u32 areaSizeZ ) const {
+	ng_assert( x + areaSizeX <= sizeX && z + areaSizeZ <= sizeZ );
+	if ( areaSizeX == 0 || areaSizeZ == 0 ) {
+		return true;
+	}
+	u32 lastX = x + areaSizeX - 1;
+	u32 lastZ = z + areaSizeZ - 1;
+	for ( u32 bx = x >> 3; bx <= lastX >> 3; bx++ ) {
+		// Rows of the block covered by the area, one byte per row
+		u32 fromX = MAX( x, bx << 3 ) & 7;
+		u32 toX = MIN( lastX, ( bx << 3 ) + 7 ) & 7;
+		u64 rows = ( ~0ull >> ( 56 - toX * 8 ) ) & ( ~0ull << ( fromX * 8 ) );
+		for ( u32 bz = z >> 3; bz <= lastZ >> 3; bz++ ) {
+			const TileBlock * block = FindBlock( bx << 3, bz << 3 );
+			if ( block == nullptr ) {
+				continue;
+			}
+			u32 fromZ = MAX( z, bz << 3 ) & 7;
+			u32 toZ = MIN( lastZ, ( bz << 3 ) + 7 ) & 7;
+			u64 columns = ( ( 0xffu >> ( 7 - toZ ) ) & ( 0xffu << fromZ ) ) * 0x0101010101010101ull;
+			if ( block->occupied & rows & columns ) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
 
 void Map::SetTile( Cell coord, MapTile type ) { SetTile( coord.x, coord.z, type ); }
 void Map::SetTile( u32 x, u32 z, MapTile type ) {
+	if ( IsTileWalkable( x, z ) || IsTileWalkable( type ) ) {
+		roadVersion++;
+	}
+	tileVersion++;
+	if ( editDepth > 0 ) {
+		tilesBeforeEdit.try_emplace( Cell( x, z ), GetTile( x, z ) );
+		WriteTile( x, z, type );
+		return;
+	}
 	if ( IsTileWalkable( x, z ) ) {
 		Cell cell(x, z);
 		theGame->roadNetwork.RemoveRoadCellFromNetwork( cell, *this );
@@ -29,5 +215,122 @@ void Map::SetTile( u32 x, u32 z, MapTile type ) {
 		theGame->roadNetwork.AddRoadCellToNetwork( cell, *this );
 		PostMsgGlobal<Cell>( MESSAGE_ROAD_CELL_ADDED, cell );
 	}
-	tiles[ x * sizeZ + z ] = type;
+	WriteTile( x, z, type );
+}
+
+void MapRegion::Extend( Cell cell ) {
+	if ( !IsValid() ) {
+		min = cell;
+		max = cell;
+		return;
+	}
+	min.x = MIN( min.x, cell.x );
+	min.z = MIN( min.z, cell.z );
+	max.x = MAX( max.x, cell.x );
+	max.z = MAX( max.z, cell.z );
+}
+
+void Map::BeginEdit() { editDepth++; }
+
+void Map::CommitEdit() {
+	ng_assert( editDepth > 0 );
+	if ( editDepth == 0 || --editDepth > 0 ) {
+		return;
+	}
+
+	ng::DynamicArray< Cell > removedRoads;
+	ng::DynamicArray< Cell > addedRoads;
+	MapRegion                region;
+	for ( auto [ cell, previousTile ] : tilesBeforeEdit ) {
+		bool wasWalkable = IsTileWalkable( previousTile );
+		bool isWalkable = IsTileWalkable( cell );
+		if ( wasWalkable != isWalkable ) {
+			( wasWalkable ? removedRoads : addedRoads ).PushBack( cell );
+			region.Extend( cell );
+		}
+	}
+
+	if ( region.IsValid() ) {
+		ng::DynamicArray< Cell > changedRoads;
+		changedRoads.Append( removedRoads );
+		changedRoads.Append( addedRoads );
+
+		// The roads going through the edit have to be cut as they were before it
+		auto swapWithTilesBeforeEdit = [ this, &changedRoads ]() {
+			for ( const Cell & cell : changedRoads ) {
+				MapTile & before = tilesBeforeEdit[ cell ];
+				MapTile   current = GetTile( cell );
+				WriteTile( cell.x, cell.z, before );
+				before = current;
+			}
+		};
+		swapWithTilesBeforeEdit();
+		theGame->roadNetwork.DetachRoadsAroundCells( changedRoads, *this );
+		swapWithTilesBeforeEdit();
+
+		theGame->roadNetwork.ApplyCellEdits( removedRoads, addedRoads, *this );
+		PostMsgGlobal< MapRegion >( MESSAGE_ROAD_REGION_CHANGED, region );
+	}
+	tilesBeforeEdit.clear();
+}
+
+void SpatialBucketGrid::Init( u32 mapSizeX, u32 mapSizeZ ) {
+	numBucketsX = MAX( ( mapSizeX + BUCKET_SIZE - 1 ) / BUCKET_SIZE, 1u );
+	numBucketsZ = MAX( ( mapSizeZ + BUCKET_SIZE - 1 ) / BUCKET_SIZE, 1u );
+	buckets.clear();
+	buckets.resize( ( u64 )numBucketsX * numBucketsZ );
+	numEntries = 0;
+}
+
+void SpatialBucketGrid::Insert( Entity e, Cell cell ) {
+	ng_assert( IsInitialized() );
+	buckets[ BucketIndex( cell ) ].push_back( Entry{ e, cell } );
+	numEntries++;
+}
+
+bool SpatialBucketGrid::Remove( Entity e, Cell cell ) {
+	std::vector< Entry > & bucket = buckets[ BucketIndex( cell ) ];
+	for ( size_t i = 0; i < bucket.size(); i++ ) {
+		if ( bucket[ i ].entity == e ) {
+			bucket[ i ] = bucket.back();
+			bucket.pop_back();
+			numEntries--;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SpatialBucketGrid::GatherRing( Cell origin, u32 ring, ng::DynamicArray< Entry > & out ) const {
+	int64 originX = MIN( origin.x / BUCKET_SIZE, numBucketsX - 1 );
+	int64 originZ = MIN( origin.z / BUCKET_SIZE, numBucketsZ - 1 );
+	int64 minX = originX - ring;
+	int64 maxX = originX + ring;
+	int64 minZ = originZ - ring;
+	int64 maxZ = originZ + ring;
+	if ( minX < 0 && maxX >= numBucketsX && minZ < 0 && maxZ >= numBucketsZ ) {
+		return false;
+	}
+
+	auto gatherBucket = [ & ]( int64 x, int64 z ) {
+		if ( x < 0 || x >= numBucketsX || z < 0 || z >= numBucketsZ ) {
+			return;
+		}
+		for ( const Entry & entry : buckets[ x * numBucketsZ + z ] ) {
+			out.PushBack( entry );
+		}
+	};
+	if ( ring == 0 ) {
+		gatherBucket( originX, originZ );
+		return true;
+	}
+	for ( int64 x = minX; x <= maxX; x++ ) {
+		gatherBucket( x, minZ );
+		gatherBucket( x, maxZ );
+	}
+	for ( int64 z = minZ + 1; z < maxZ; z++ ) {
+		gatherBucket( minX, z );
+		gatherBucket( maxX, z );
+	}
+	return true;
 }
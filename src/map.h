@@ -1,6 +1,12 @@
 #pragma once
 
+#include "entity.h"
+#include "ngLib/ngcontainers.h"
 #include "ngLib/types.h"
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 constexpr float CELL_SIZE = 1.0f;
 
@@ -21,7 +27,23 @@ struct Cell {
 
 constexpr Cell INVALID_CELL{ ( u32 )-1, ( u32 )-1 };
 
-enum class MapTile {
+struct CellHash {
+	size_t operator()( const Cell & cell ) const { return std::hash< u64 >()( ( ( u64 )cell.x << 32 ) | cell.z ); }
+};
+
+// Bounding box of the cells touched by an edit, max is included
+struct MapRegion {
+	Cell min = INVALID_CELL;
+	Cell max = INVALID_CELL;
+
+	bool IsValid() const { return min.IsValid(); }
+	bool Contains( Cell cell ) const {
+		return IsValid() && cell.x >= min.x && cell.x <= max.x && cell.z >= min.z && cell.z <= max.z;
+	}
+	void Extend( Cell cell );
+};
+
+enum class MapTile : u8 {
 	EMPTY,
 	ROAD,
 	ROAD_BLOCK,
@@ -29,35 +51,177 @@ enum class MapTile {
 	TREE,
 };
 
+// Tiles are stored by 8x8 blocks so that neighbors are most of the time in the same cache line
+// Each block also keeps a bit per cell for the hot queries, cell (lx, lz) is bit lx * 8 + lz
+struct TileBlock {
+	static constexpr u32 SIZE = 8;
+
+	u8  types[ SIZE * SIZE / 2 ]; // 4 bits per tile
+	u64 walkable;
+	u64 navigable;
+	u64 occupied; // anything but EMPTY
+};
+
+// Blocks are grouped in chunks, which are only allocated once they hold something else than EMPTY tiles
+struct TileChunk {
+	static constexpr u32 SIZE = 64;
+	static constexpr u32 NUM_BLOCKS = SIZE / TileBlock::SIZE;
+
+	TileBlock blocks[ NUM_BLOCKS * NUM_BLOCKS ];
+	u32       numOccupied = 0;
+};
+
+// Building covering each cell of a chunk, INVALID_ENTITY where there is none
+struct BuildingChunk {
+	BuildingChunk();
+
+	Entity owners[ TileChunk::SIZE * TileChunk::SIZE ]; // cell (lx, lz) is lx * SIZE + lz
+	u32    numOwnedCells = 0;
+};
+
+struct MapChunk {
+	// nullptr while every tile of the chunk is EMPTY
+	// Copies of the map share their chunks, a chunk is duplicated the first time it is written to
+	std::shared_ptr< TileChunk > tiles;
+	// Same as tiles, nullptr while no building stands in the chunk
+	std::shared_ptr< BuildingChunk > buildings;
+	u64                          version = 0; // tileVersion of the last edit inside the chunk
+	// tileVersion of the last edit that took a cell away from the agents, a tree cut down does not move it
+	u64                          closedVersion = 0;
+	bool                         dirty = false;
+};
+
 struct Map {
-	~Map() {
-		if ( tiles != nullptr ) {
-			delete[] tiles;
-		}
-	}
+	Map() = default;
+	Map( const Map & other ) { *this = other; }
+	Map & operator=( const Map & other );
 
 	void AllocateGrid( u32 sizeX, u32 sizeZ );
 
-	MapTile GetTile( Cell coord ) const;
-	MapTile GetTile( u32 x, u32 z ) const;
-	void    SetTile( Cell coord, MapTile type );
-	void    SetTile( u32 x, u32 z, MapTile type );
+	MapTile GetTile( Cell coord ) const { return GetTile( coord.x, coord.z ); }
+	MapTile GetTile( u32 x, u32 z ) const {
+		const TileBlock * block = FindBlock( x, z );
+		if ( block == nullptr ) {
+			return MapTile::EMPTY;
+		}
+		u32 index = IndexInBlock( x, z );
+		return ( MapTile )( ( block->types[ index >> 1 ] >> ( ( index & 1 ) * 4 ) ) & 0xf );
+	}
+	void SetTile( Cell coord, MapTile type );
+	void SetTile( u32 x, u32 z, MapTile type );
 
-	bool IsTileWalkable( Cell cell ) const { return IsTileWalkable( GetTile( cell.x, cell.z ) ); }
+	bool IsTileWalkable( Cell cell ) const { return IsTileWalkable( cell.x, cell.z ); }
 	bool IsTileWalkable( u32 x, u32 z ) const {
-		MapTile tile = GetTile( x, z );
-		return IsTileWalkable( tile );
+		const TileBlock * block = FindBlock( x, z );
+		return block != nullptr && TestBit( block->walkable, x, z );
 	}
 	bool IsTileWalkable( MapTile type ) const { return type == MapTile::ROAD || type == MapTile::ROAD_BLOCK; }
 
-	bool IsTileAStarNavigable( Cell cell ) const { return IsTileAStarNavigable( GetTile( cell ) ); }
+	bool IsTileAStarNavigable( Cell cell ) const {
+		const TileBlock * block = FindBlock( cell.x, cell.z );
+		return block == nullptr || TestBit( block->navigable, cell.x, cell.z );
+	}
 	bool IsTileAStarNavigable( MapTile type ) const { return type == MapTile::EMPTY || type == MapTile::ROAD; }
 
 	bool IsValidTile( int64 x, int64 z ) const { return x >= 0 && x < sizeX && z >= 0 && z < sizeZ; }
 
+	// True when every tile of the area is EMPTY, the area has to be inside the map
+	bool IsAreaEmpty( u32 x, u32 z, u32 areaSizeX, u32 areaSizeZ ) const;
+
+	// Building standing on a cell, INVALID_ENTITY when there is none or when the cell is outside the map
+	Entity GetBuildingAt( Cell cell ) const {
+		if ( cell.x >= sizeX || cell.z >= sizeZ ) {
+			return INVALID_ENTITY;
+		}
+		const BuildingChunk * chunk = chunks[ GetChunkIndex( cell ) ].buildings.get();
+		return chunk != nullptr ? chunk->owners[ IndexInBuildingChunk( cell.x, cell.z ) ] : INVALID_ENTITY;
+	}
+	// Buildings next to the cell but not on it, each once, at most one per side
+	void FindBuildingsAdjacentToCell( Cell cell, ng::StaticArray< Entity, 4 > & out ) const;
+	// Marks every cell of the area as covered by building, pass INVALID_ENTITY to free them
+	void SetBuildingArea( Cell corner, u32 areaSizeX, u32 areaSizeZ, Entity building );
+	// Pushes each building overlapping the area once, the parts of the area outside the map are ignored
+	void FindBuildingsInArea( u32 x, u32 z, u32 areaSizeX, u32 areaSizeZ, ng::DynamicArray< Entity > & out ) const;
+
+	u64 ComputeMemoryUsage() const;
+
+	u32              GetNumChunksX() const { return numChunksX; }
+	u32              GetNumChunksZ() const { return numChunksZ; }
+	u32              GetChunkIndex( Cell cell ) const { return ( cell.x >> 6 ) * numChunksZ + ( cell.z >> 6 ); }
+	const MapChunk & GetChunk( u32 chunkIndex ) const { return chunks[ chunkIndex ]; }
+	// Indices of the chunks edited since the last call, in the order they were first edited
+	void ConsumeDirtyChunks( ng::DynamicArray< u32 > & out );
+
+	// Tiles set between BeginEdit and CommitEdit are written right away, but the road network is only patched once
+	// on commit and a single MESSAGE_ROAD_REGION_CHANGED covers every road added or removed
+	// Edits can be nested, only the outermost commit does the work
+	void BeginEdit();
+	void CommitEdit();
+	bool IsEditing() const { return editDepth > 0; }
+
 	u32 sizeX = 0;
 	u32 sizeZ = 0;
 
+	// Bumped on every edit, so whatever was computed from the map can tell when it went stale
+	// roadVersion only moves when a road is added or removed
+	u64 roadVersion = 0;
+	u64 tileVersion = 0;
+
+  private:
+	static u32  IndexInBlock( u32 x, u32 z ) { return ( ( x & 7 ) << 3 ) | ( z & 7 ); }
+	static u32  IndexInChunk( u32 x, u32 z ) { return ( ( x >> 3 ) & 7 ) * TileChunk::NUM_BLOCKS + ( ( z >> 3 ) & 7 ); }
+	static bool TestBit( u64 bits, u32 x, u32 z ) { return ( bits >> IndexInBlock( x, z ) ) & 1; }
+	static u32  IndexInBuildingChunk( u32 x, u32 z ) { return ( x & 63 ) * TileChunk::SIZE + ( z & 63 ); }
+
+	// nullptr when the chunk of the cell is not allocated, which means the block is all EMPTY
+	const TileBlock * FindBlock( u32 x, u32 z ) const {
+		const TileChunk * chunk = chunks[ ( x >> 6 ) * numChunksZ + ( z >> 6 ) ].tiles.get();
+		return chunk != nullptr ? &chunk->blocks[ IndexInChunk( x, z ) ] : nullptr;
+	}
+
+	// Writes the tile and its bits, without touching the road network
+	void WriteTile( u32 x, u32 z, MapTile type );
+
+	std::vector< MapChunk > chunks;
+	u32                     numChunksX = 0;
+	u32                     numChunksZ = 0;
+	ng::DynamicArray< u32 > dirtyChunks;
+
+	u32 editDepth = 0;
+	// What the edited cells were before BeginEdit
+	std::unordered_map< Cell, MapTile, CellHash > tilesBeforeEdit;
+};
+
+// Entities filed by the square of the map their cell is in, so that the ones near a cell can be visited first without
+// looking at the others
+struct SpatialBucketGrid {
+	static constexpr u32 BUCKET_SIZE = 16;
+
+	struct Entry {
+		Entity entity;
+		Cell   cell;
+	};
+
+	void Init( u32 mapSizeX, u32 mapSizeZ );
+	bool IsInitialized() const { return !buckets.empty(); }
+	void Insert( Entity e, Cell cell );
+	// Returns false if the entity was not filed under this cell
+	bool Remove( Entity e, Cell cell );
+	u32  Size() const { return numEntries; }
+
+	// Appends the entries of the buckets at ring from the bucket of origin, ring 0 being the bucket itself
+	// Returns false when the whole ring is outside the grid, further rings are empty as well then
+	bool GatherRing( Cell origin, u32 ring, ng::DynamicArray< Entry > & out ) const;
+	// No cell filed in ring can be closer to origin than this, along x or z
+	static u32 RingMinDistance( u32 ring ) { return ring == 0 ? 0 : ( ring - 1 ) * BUCKET_SIZE + 1; }
+
   private:
-	MapTile * tiles = nullptr;
+	u32 BucketIndex( Cell cell ) const {
+		return MIN( cell.x / BUCKET_SIZE, numBucketsX - 1 ) * numBucketsZ + MIN( cell.z / BUCKET_SIZE, numBucketsZ - 1 );
+	}
+
+	std::vector< std::vector< Entry > > buckets;
+	u32                                 numBucketsX = 0;
+	u32                                 numBucketsZ = 0;
+	u32                                 numEntries = 0;
 };
@@ -271,6 +271,7 @@ void InstancedModelBatch::AddInstance( Entity e, const glm::mat4 & transform ) {
 	Instance & instance = instances.AllocateOne();
 	instance.transform = transform;
 	instance.id = e;
+	instance.key = NO_KEY;
 	dirty = true;
 }
 
@@ -278,14 +279,37 @@ void InstancedModelBatch::AddInstanceAtPosition( const glm::vec3 & position ) {
 	Instance & instance = instances.AllocateOne();
 	instance.transform = glm::translate( glm::mat4( 1.0f ), position );
 	instance.id = INVALID_ENTITY;
+	instance.key = NO_KEY;
 	dirty = true;
 }
 
+void InstancedModelBatch::AddInstanceWithKey( u64 key, const glm::mat4 & transform ) {
+	auto [ it, inserted ] = instanceOfKey.emplace( key, instances.Size() );
+	if ( inserted ) {
+		Instance & instance = instances.AllocateOne();
+		instance.id = INVALID_ENTITY;
+		instance.key = key;
+	}
+	instances[ it->second ].transform = transform;
+	dirty = true;
+}
+
+void InstancedModelBatch::DeleteInstance( u32 index ) {
+	if ( instances[ index ].key != NO_KEY ) {
+		instanceOfKey.erase( instances[ index ].key );
+	}
+	instances.DeleteIndexFast( index );
+	// The last instance took its place
+	if ( index < instances.Size() && instances[ index ].key != NO_KEY ) {
+		instanceOfKey[ instances[ index ].key ] = index;
+	}
+}
+
 bool InstancedModelBatch::RemoveInstance( Entity e ) {
 	bool modified = false;
 	for ( int64 i = ( int64 )instances.Size() - 1; i >= 0; i-- ) {
 		if ( instances[ i ].id == e ) {
-			instances.DeleteIndexFast( i );
+			DeleteInstance( ( u32 )i );
 			modified = true;
 		}
 	}
@@ -302,7 +326,7 @@ bool InstancedModelBatch::RemoveInstancesWithPosition( const glm::vec3 & positio
 	bool modified = false;
 	for ( int64 i = ( int64 )instances.Size() - 1; i >= 0; i-- ) {
 		if ( instances[ i ].transform == transform ) {
-			instances.DeleteIndexFast( i );
+			DeleteInstance( ( u32 )i );
 			modified = true;
 		}
 	}
@@ -313,6 +337,16 @@ bool InstancedModelBatch::RemoveInstancesWithPosition( const glm::vec3 & positio
 	return false;
 }
 
+bool InstancedModelBatch::RemoveInstanceWithKey( u64 key ) {
+	auto it = instanceOfKey.find( key );
+	if ( it == instanceOfKey.end() ) {
+		return false;
+	}
+	DeleteInstance( it->second );
+	dirty = true;
+	return true;
+}
+
 void InstancedModelBatch::Init( const Model * model ) {
 	this->model = model;
 	glGenBuffers( 1, &arrayBuffer );
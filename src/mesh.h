@@ -2,6 +2,7 @@
 
 #include <glm/glm.hpp>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 #include "entity.h"
@@ -81,22 +82,33 @@ struct CpntRenderModel {
 struct SystemRenderModel : System< CpntRenderModel > {};
 
 struct InstancedModelBatch {
+	static constexpr u64 NO_KEY = ( u64 )-1;
+
 	const Model * model;
 	struct Instance {
 		glm::mat4 transform;
 		Entity    id;
+		u64       key = NO_KEY;
 	};
 	ng::DynamicArray< Instance > instances;
 	bool                         dirty = false;
 	u32                          arrayBuffer;
+	// Where the instances added with a key are, so they can be removed without going through the whole batch
+	std::unordered_map< u64, u32 > instanceOfKey;
 
 	void AddInstance( Entity e, const glm::mat4 & transform );
 	void AddInstanceAtPosition( const glm::vec3 & position );
+	// Replaces the instance with the same key if there is one
+	void AddInstanceWithKey( u64 key, const glm::mat4 & transform );
 	bool RemoveInstance( Entity e );
 	bool RemoveInstancesWithPosition( const glm::vec3 & position );
+	bool RemoveInstanceWithKey( u64 key );
 	void Init( const Model * model );
 	void UpdateArrayBuffer();
 	void Render( Shader & shader );
+
+  private:
+	void DeleteInstance( u32 index );
 };
 
 Texture CreateTextureFromResource( const PackerResource & resource );
@@ -11,7 +11,6 @@ enum MessageType {
 	MESSAGE_PATHFINDING_DELETE_ENTRY,
 	MESSAGE_NAVAGENT_DESTINATION_REACHED,
 	MESSAGE_NAVAGENT_MOVED_CELL,
-	MESSAGE_SERVICE_PROVIDED,
 	MESSAGE_FULL_INVENTORY_TRANSACTION,
 	MESSAGE_INVENTORY_TRANSACTION,
 	MESSAGE_INVENTORY_TRANSACTION_COMPLETED,
@@ -21,6 +20,7 @@ enum MessageType {
 	MESSAGE_WORKER_REMOVED,
 	MESSAGE_ROAD_CELL_REMOVED,
 	MESSAGE_ROAD_CELL_ADDED,
+	MESSAGE_ROAD_REGION_CHANGED, // payload is a MapRegion, posted once by Map::CommitEdit
 	MESSAGE_WOODSHOP_WORKER_RETURNED,
 	MessageType_COUNT, // leave this a the end
 };
@@ -1,30 +1,25 @@
 #include "navigation.h"
 #include "buildings/building.h"
+#include "game.h"
 #include "message.h"
 #include "ngLib/logs.h"
 #include "ngLib/ngcontainers.h"
 #include "ngLib/nglib.h"
 #include "ngLib/types.h"
+#include "pathfinding_job.h"
 #include "registery.h"
 #include <algorithm>
 #include <array>
 #include <functional>
+#include <queue>
 #include <tracy/Tracy.hpp>
+#include <unordered_set>
 #include <vector>
 
-struct AStarStep {
-	Cell                coord;
-	RoadNetwork::Node * node = nullptr;
-	AStarStep *         parent = nullptr;
-	int                 f, g, h;
-
-	bool operator==( const AStarStep & rhs ) const { return coord == rhs.coord; }
-	bool operator<( const AStarStep & rhs ) const { return coord < rhs.coord; }
-
-	bool operator==( const Cell & rhs ) const { return coord == rhs; }
-	bool operator<( const Cell & rhs ) const { return coord < rhs; }
-	bool operator>( const Cell & rhs ) const { return !( coord < rhs || coord == rhs ); }
-};
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#include <emmintrin.h>
+#define NG_MOVEMENT_SSE
+#endif
 
 static auto InsertNodeSorted( std::vector< AStarStep * > & set, AStarStep * step ) {
 	return set.insert( std::upper_bound( set.begin(), set.end(), step,
@@ -145,30 +140,60 @@ CardinalDirection OppositeDirection( CardinalDirection direction ) {
 }
 
 static thread_local ng::ObjectPool< AStarStep > aStarStepPool;
+thread_local PathfindingCounters                pathfindingCounters;
 
-bool AStar( Cell start, Cell goal, MovementAllowed movement, const Map & map, ng::DynamicArray< Cell > & outPath ) {
-	ZoneScoped;
+static AStarStep * PopAStarStep() {
+	pathfindingCounters.bytesUsed += sizeof( AStarStep );
+	return aStarStepPool.Pop();
+}
 
-	ng_assert( movement == ASTAR_ALLOW_DIAGONALS || movement == ASTAR_FORBID_DIAGONALS );
-	if ( !map.IsTileAStarNavigable( start ) || !map.IsTileAStarNavigable( goal ) ) {
-		return false;
+AStarStep * AStarSearch::AllocateStep() {
+	u32 block = numSteps / STEPS_PER_BLOCK;
+	if ( block == stepBlocks.size() ) {
+		stepBlocks.push_back( std::make_unique< AStarStep[] >( STEPS_PER_BLOCK ) );
 	}
+	AStarStep * step = &stepBlocks[ block ][ numSteps % STEPS_PER_BLOCK ];
+	numSteps++;
+	*step = AStarStep();
+	pathfindingCounters.bytesUsed += sizeof( AStarStep );
+	return step;
+}
 
-	std::vector< AStarStep * > openSet;
+void AStarSearch::Start( Cell start, Cell goal, MovementAllowed movement, const Map & map ) {
+	ng_assert( movement == ASTAR_ALLOW_DIAGONALS || movement == ASTAR_FORBID_DIAGONALS );
+	this->goal = goal;
+	this->movement = movement;
+	status = Status::RUNNING;
+	numExpansions = 0;
+	numSteps = 0;
+	openSet.clear();
 	openSet.reserve( 256 );
-	std::vector< AStarStep * > closedSet;
+	closedSet.clear();
 	closedSet.reserve( 256 );
+	current = nullptr;
+	closest = nullptr;
+	if ( !map.IsTileAStarNavigable( start ) || !map.IsTileAStarNavigable( goal ) ) {
+		status = Status::NOT_FOUND;
+		return;
+	}
 
-	AStarStep * startStep = aStarStepPool.Pop();
-	startStep->parent = nullptr;
+	AStarStep * startStep = AllocateStep();
 	startStep->coord = start;
 	startStep->h = Heuristic( start, goal, movement );
 	startStep->g = 1;
 	startStep->f = startStep->h + startStep->g;
 	openSet.push_back( startStep );
+	closest = startStep;
+}
+
+ResumableSearch::Status AStarSearch::Step( const Map & map, u32 maxExpansions ) {
+	ZoneScoped;
 
-	AStarStep * current = nullptr;
-	while ( openSet.empty() == false ) {
+	for ( u32 expansion = 0; expansion < maxExpansions && status == Status::RUNNING; expansion++ ) {
+		if ( openSet.empty() ) {
+			status = Status::NOT_FOUND;
+			break;
+		}
 		auto currentIt = openSet.begin();
 		{
 			ZoneScopedN( "Find cell with lowest score" );
@@ -184,8 +209,14 @@ bool AStar( Cell start, Cell goal, MovementAllowed movement, const Map & map, ng
 		}
 
 		if ( current->coord == goal ) {
+			status = Status::FOUND;
 			break;
 		}
+		pathfindingCounters.nodesExpanded++;
+		numExpansions++;
+		if ( current->h < closest->h ) {
+			closest = current;
+		}
 
 		InsertNodeSorted( closedSet, current );
 		openSet.erase( currentIt );
@@ -212,7 +243,7 @@ bool AStar( Cell start, Cell goal, MovementAllowed movement, const Map & map, ng
 
 				AStarStep * neighbor = BinarySearchNode( openSet, neighborCoords );
 				if ( neighbor == nullptr ) {
-					neighbor = aStarStepPool.Pop();
+					neighbor = AllocateStep();
 					neighbor->coord = neighborCoords;
 					neighbor->parent = current;
 					neighbor->g = totalCost;
@@ -227,58 +258,221 @@ bool AStar( Cell start, Cell goal, MovementAllowed movement, const Map & map, ng
 			}
 		}
 	}
-	if ( current == nullptr ) {
-		return false;
-	}
-	if ( current->coord != goal ) {
-		return false;
-	}
+	return status;
+}
 
-	// return reconstruct path
+void AStarSearch::BuildPath( ng::DynamicArray< Cell > & outPath ) const {
+	ng_assert( status == Status::FOUND );
 	outPath.Clear();
-	outPath.PushBack( current->coord );
-
-	auto cursor = current->parent;
-	while ( cursor != nullptr ) {
+	for ( const AStarStep * cursor = current; cursor != nullptr; cursor = cursor->parent ) {
 		outPath.PushBack( cursor->coord );
-		cursor = cursor->parent;
 	}
+}
 
-	for ( AStarStep * step : openSet ) {
-		aStarStepPool.Push( step );
+bool AStarSearch::BuildBestPartialPath( ng::DynamicArray< Cell > & outPath ) const {
+	if ( closest == nullptr ) {
+		return false;
 	}
-	for ( AStarStep * step : closedSet ) {
-		aStarStepPool.Push( step );
+	outPath.Clear();
+	for ( const AStarStep * cursor = closest; cursor != nullptr; cursor = cursor->parent ) {
+		outPath.PushBack( cursor->coord );
 	}
+	return true;
+}
+
+bool AStar( Cell start, Cell goal, MovementAllowed movement, const Map & map, ng::DynamicArray< Cell > & outPath ) {
+	ZoneScoped;
 
+	thread_local AStarSearch search;
+	search.Start( start, goal, movement, map );
+	if ( search.Step( map, ( u32 )-1 ) != ResumableSearch::Status::FOUND ) {
+		return false;
+	}
+	search.BuildPath( outPath );
 	return true;
 }
 
 void SystemNavAgent::Update( Registery & reg, Duration ticks ) {
+	if ( flowFields.IsWaitingForBuilds() ) {
+		std::shared_ptr< const FlowField > built;
+		while ( theGame->systemManager.GetSystem< SystemPathfinding >().builtFlowFields.try_dequeue( built ) ) {
+			flowFields.Store( std::move( built ) );
+		}
+	}
+	arrivedAgents.Clear();
+	CpntRegistery< CpntTransform > & transforms = reg.GetComponentRegistery< CpntTransform >();
 	for ( auto [ e, agent ] : reg.IterateOver< CpntNavAgent >() ) {
-		CpntTransform & transform = reg.GetComponent< CpntTransform >( e );
-		float           remainingSpeed = agent.movementSpeed * ticks;
-		while ( agent.pathfindingNextSteps.Empty() == false && remainingSpeed > 0.0f ) {
-			Cell      nextStep = agent.pathfindingNextSteps.Last();
-			glm::vec3 nextCoord = GetPointInMiddleOfCell( nextStep );
-			float     distance = glm::distance( transform.GetTranslation(), nextCoord );
-			if ( distance > agent.movementSpeed * ticks ) {
-				glm::vec3 direction = glm::normalize( nextCoord - transform.GetTranslation() );
-				transform.Translate( direction * ( agent.movementSpeed * ticks ) );
-			} else {
-				transform.SetTranslation( nextCoord );
-				agent.pathfindingNextSteps.PopBack();
-				if ( agent.pathfindingNextSteps.Empty() == true ) {
-					// we are at destination
-					PostMsg( MESSAGE_NAVAGENT_DESTINATION_REACHED, e, e );
-					if ( agent.deleteAtDestination ) {
-						reg.MarkForDelete( e );
-					}
+		CpntTransform & transform = transforms.GetComponent( e );
+		if ( agent.flowFieldDestination != INVALID_ENTITY ) {
+			MoveAlongFlowField( reg, e, agent, transform, ticks );
+		} else if ( agent.pathfindingNextSteps.Empty() == false && agent.movementSpeed * ticks > 0.0f ) {
+			batch.Add( e, agent, transform, agent.movementSpeed * ticks );
+			if ( batch.IsFull() ) {
+				MoveBatch();
+			}
+		}
+	}
+	MoveBatch();
+
+	for ( Entity e : arrivedAgents ) {
+		PostMsg( MESSAGE_NAVAGENT_DESTINATION_REACHED, e, e );
+		if ( reg.GetComponent< CpntNavAgent >( e ).deleteAtDestination ) {
+			reg.MarkForDelete( e );
+		}
+	}
+	RequestFlowFields( reg );
+}
+
+void SystemNavAgent::MoveBatch() {
+	u32 count = batch.count;
+	// Steps are corners, an agent passing one of them during the tick goes on toward the next one in another pass
+	while ( count > 0 ) {
+		MoveAgentsTowardTargets( batch.posX, batch.posZ, batch.targetX, batch.targetZ, batch.step, count );
+		u32 kept = 0;
+		for ( u32 i = 0; i < count; i++ ) {
+			CpntNavAgent * agent = batch.agents[ i ];
+			float          leftover = batch.step[ i ];
+			if ( leftover >= 0.0f ) {
+				agent->pathfindingNextSteps.PopBack();
+				if ( agent->pathfindingNextSteps.Empty() ) {
+					arrivedAgents.PushBack( batch.entities[ i ] );
+				} else if ( leftover > 0.0f ) {
+					glm::vec3 nextCoord = GetPointInMiddleOfCell( agent->pathfindingNextSteps.Last() );
+					batch.MoveLane( i, kept );
+					batch.targetX[ kept ] = nextCoord.x;
+					batch.targetZ[ kept ] = nextCoord.z;
+					kept++;
+					continue;
 				}
 			}
-			remainingSpeed -= distance;
+			// Done for this tick, transforms are only written once
+			CpntTransform * transform = batch.transforms[ i ];
+			glm::vec3       translation = transform->GetTranslation();
+			translation.x = batch.posX[ i ];
+			translation.z = batch.posZ[ i ];
+			transform->SetTranslation( translation );
+		}
+		count = kept;
+	}
+	batch.count = 0;
+}
+
+void NavAgentBatch::Add( Entity e, CpntNavAgent & agent, CpntTransform & transform, float distance ) {
+	ng_assert( count < MAX_AGENTS );
+	glm::vec3 position = transform.GetTranslation();
+	glm::vec3 target = GetPointInMiddleOfCell( agent.pathfindingNextSteps.Last() );
+	entities[ count ] = e;
+	agents[ count ] = &agent;
+	transforms[ count ] = &transform;
+	posX[ count ] = position.x;
+	posZ[ count ] = position.z;
+	targetX[ count ] = target.x;
+	targetZ[ count ] = target.z;
+	step[ count ] = distance;
+	count++;
+}
+
+void NavAgentBatch::MoveLane( u32 from, u32 to ) {
+	entities[ to ] = entities[ from ];
+	agents[ to ] = agents[ from ];
+	transforms[ to ] = transforms[ from ];
+	posX[ to ] = posX[ from ];
+	posZ[ to ] = posZ[ from ];
+	targetX[ to ] = targetX[ from ];
+	targetZ[ to ] = targetZ[ from ];
+	step[ to ] = step[ from ];
+}
+
+void MoveAgentsTowardTargets(
+    float * posX, float * posZ, const float * targetX, const float * targetZ, float * step, u32 count ) {
+	// Agents standing on their target would divide by zero, they arrive anyway since step is positive
+	constexpr float minDistance = 1e-6f;
+	u32             i = 0;
+#ifdef NG_MOVEMENT_SSE
+	const __m128 one = _mm_set1_ps( 1.0f );
+	const __m128 epsilon = _mm_set1_ps( minDistance );
+	for ( ; i + 4 <= count; i += 4 ) {
+		__m128 x = _mm_loadu_ps( posX + i );
+		__m128 z = _mm_loadu_ps( posZ + i );
+		__m128 tx = _mm_loadu_ps( targetX + i );
+		__m128 tz = _mm_loadu_ps( targetZ + i );
+		__m128 s = _mm_loadu_ps( step + i );
+		__m128 dx = _mm_sub_ps( tx, x );
+		__m128 dz = _mm_sub_ps( tz, z );
+		__m128 distance = _mm_sqrt_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dz, dz ) ) );
+		__m128 t = _mm_min_ps( _mm_div_ps( s, _mm_max_ps( distance, epsilon ) ), one );
+		// Arriving agents are snapped on the target so rounding never leaves them a hair away from it
+		__m128 arrived = _mm_cmple_ps( distance, s );
+		x = _mm_add_ps( x, _mm_mul_ps( dx, t ) );
+		z = _mm_add_ps( z, _mm_mul_ps( dz, t ) );
+		x = _mm_or_ps( _mm_and_ps( arrived, tx ), _mm_andnot_ps( arrived, x ) );
+		z = _mm_or_ps( _mm_and_ps( arrived, tz ), _mm_andnot_ps( arrived, z ) );
+		_mm_storeu_ps( posX + i, x );
+		_mm_storeu_ps( posZ + i, z );
+		_mm_storeu_ps( step + i, _mm_sub_ps( s, distance ) );
+	}
+#endif
+	for ( ; i < count; i++ ) {
+		float dx = targetX[ i ] - posX[ i ];
+		float dz = targetZ[ i ] - posZ[ i ];
+		float distance = sqrtf( dx * dx + dz * dz );
+		bool  arrived = distance <= step[ i ];
+		float t = arrived ? 1.0f : step[ i ] / std::max( distance, minDistance );
+		posX[ i ] = arrived ? targetX[ i ] : posX[ i ] + dx * t;
+		posZ[ i ] = arrived ? targetZ[ i ] : posZ[ i ] + dz * t;
+		step[ i ] -= distance;
+	}
+}
+
+void CompressPath( ng::DynamicArray< Cell > & path ) {
+	if ( path.Size() > 2 ) {
+		u32 kept = 1;
+		for ( u32 i = 1; i + 1 < path.Size(); i++ ) {
+			const Cell & previous = path[ kept - 1 ];
+			const Cell & current = path[ i ];
+			const Cell & next = path[ i + 1 ];
+			int64        dx1 = ( int64 )current.x - previous.x;
+			int64        dz1 = ( int64 )current.z - previous.z;
+			int64        dx2 = ( int64 )next.x - current.x;
+			int64        dz2 = ( int64 )next.z - current.z;
+			// Same line and same way if the cross product is null and the dot product positive
+			bool isStraight = dx1 * dz2 == dz1 * dx2 && dx1 * dx2 + dz1 * dz2 > 0;
+			if ( !isStraight ) {
+				path[ kept++ ] = current;
+			}
+		}
+		path[ kept++ ] = path.Last();
+		while ( path.Size() > kept ) {
+			path.PopBack();
 		}
 	}
+	path.Shrink();
+}
+
+void SwapInFinalPath( const ng::DynamicArray< Cell > & partialPath,
+                      const ng::DynamicArray< Cell > & finalPath,
+                      ng::DynamicArray< Cell > &       nextSteps ) {
+	// Paths go from the destination to the start, partialPath[ walked ] is the last waypoint the agent reached
+	u32 walked = MIN( nextSteps.Size(), partialPath.Size() );
+	for ( u32 i = walked; i < partialPath.Size(); i++ ) {
+		for ( u32 j = 0; j < finalPath.Size(); j++ ) {
+			if ( finalPath[ j ] != partialPath[ i ] ) {
+				continue;
+			}
+			nextSteps.Clear();
+			for ( u32 k = 0; k <= j; k++ ) {
+				nextSteps.PushBack( finalPath[ k ] );
+			}
+			// Back to the waypoint we last reached
+			while ( i-- > walked ) {
+				nextSteps.PushBack( partialPath[ i ] );
+			}
+			return;
+		}
+	}
+	// Both paths leave from the same cell, this only happens when the agent did not start walking yet
+	nextSteps.Clear();
+	nextSteps.Append( finalPath );
 }
 
 void GetNeighborsOfCell( Cell base, const Map & map, ng::StaticArray< Cell, 4 > & neighbors ) {
@@ -319,8 +513,543 @@ static void GetWalkableNeighborsOfCell( Cell base, const Map & map, ng::StaticAr
 	}
 }
 
+bool SystemNavAgent::FollowFlowField( Registery & reg, Entity e, Entity destination, MovementAllowed movement ) {
+	if ( reg.TryGetComponent< CpntBuilding >( destination ) == nullptr ) {
+		return false;
+	}
+	CpntNavAgent & agent = reg.GetComponent< CpntNavAgent >( e );
+	agent.pathfindingNextSteps.Clear();
+	agent.flowFieldDestination = destination;
+	agent.flowFieldMovement = movement;
+	agent.flowFieldNextCell = INVALID_CELL;
+	return true;
+}
+
+void SystemNavAgent::MoveAlongFlowField(
+    Registery & reg, Entity e, CpntNavAgent & agent, CpntTransform & transform, Duration ticks ) {
+	float remainingSpeed = agent.movementSpeed * ticks;
+	while ( remainingSpeed > 0.0f ) {
+		if ( agent.flowFieldNextCell == INVALID_CELL ) {
+			Cell current = GetCellForTransform( transform );
+			// If the destination is gone, we stop here and let the owner of the agent figure it out
+			if ( reg.TryGetComponent< CpntBuilding >( agent.flowFieldDestination ) == nullptr ) {
+				agent.flowFieldDestination = INVALID_ENTITY;
+				PostMsg( MESSAGE_NAVAGENT_DESTINATION_REACHED, e, e );
+				if ( agent.deleteAtDestination ) {
+					reg.MarkForDelete( e );
+				}
+				return;
+			}
+			FlowFieldCache::Entry & entry = flowFields.Get( agent.flowFieldDestination, agent.flowFieldMovement );
+			const FlowField *       field = entry.field.get();
+			if ( field == nullptr || !field->Reaches( current ) ) {
+				if ( field != nullptr && field->isComplete && field->IsUpToDate( theGame->map ) ) {
+					ng::Errorf( "An agent can't reach its destination from where it stands\n" );
+					agent.flowFieldDestination = INVALID_ENTITY;
+					reg.MarkForDelete( e );
+					return;
+				}
+				entry.QueueCell( current );
+				return;
+			}
+			if ( field->NeedsRebuild( theGame->map ) ) {
+				// An outdated field still leads somewhere most of the time, we walk on it until the new one is ready
+				entry.QueueCell( current );
+			}
+			if ( field->IsDestination( current ) ) {
+				agent.flowFieldDestination = INVALID_ENTITY;
+				PostMsg( MESSAGE_NAVAGENT_DESTINATION_REACHED, e, e );
+				if ( agent.deleteAtDestination ) {
+					reg.MarkForDelete( e );
+				}
+				return;
+			}
+			if ( !field->GetNextCell( current, theGame->map, agent.flowFieldNextCell ) ) {
+				// The map changed and there is no way to the destination anymore, wait until there is one
+				return;
+			}
+		}
+
+		glm::vec3 nextCoord = GetPointInMiddleOfCell( agent.flowFieldNextCell );
+		float     distance = glm::distance( transform.GetTranslation(), nextCoord );
+		if ( distance > remainingSpeed ) {
+			glm::vec3 direction = glm::normalize( nextCoord - transform.GetTranslation() );
+			transform.Translate( direction * remainingSpeed );
+		} else {
+			transform.SetTranslation( nextCoord );
+			agent.flowFieldNextCell = INVALID_CELL;
+		}
+		remainingSpeed -= distance;
+	}
+}
+
+void SystemNavAgent::RequestFlowFields( Registery & reg ) {
+	SystemPathfinding * pathfinding = nullptr;
+	for ( FlowFieldCache::Entry & entry : flowFields.entries ) {
+		if ( entry.isBuilding || entry.cellsToReach.Empty() ) {
+			continue;
+		}
+		entry.queuedCells.clear();
+		// Agents keep queuing their cell while a build runs, the field it brought may reach them already
+		if ( entry.field != nullptr && !entry.field->NeedsRebuild( theGame->map ) ) {
+			for ( u32 i = 0; i < entry.cellsToReach.Size(); ) {
+				if ( entry.field->Reaches( entry.cellsToReach[ i ] ) ) {
+					entry.cellsToReach.DeleteIndexFast( i );
+				} else {
+					i++;
+				}
+			}
+		}
+		CpntBuilding * building = reg.TryGetComponent< CpntBuilding >( entry.destination );
+		if ( building == nullptr || entry.cellsToReach.Empty() ) {
+			entry.cellsToReach.Clear();
+			continue;
+		}
+		if ( pathfinding == nullptr ) {
+			pathfinding = &theGame->systemManager.GetSystem< SystemPathfinding >();
+		}
+		// The new field goes at least as far as the old one, so that agents walking on it are not left behind
+		u32 minCost = entry.field != nullptr ? entry.field->maxCost : 0;
+		pathfinding->flowFieldTasks.enqueue( SystemPathfinding::FlowFieldTask{
+		    entry.destination, *building, entry.movement, std::move( entry.cellsToReach ), minCost } );
+		entry.isBuilding = true;
+	}
+}
+
+void SystemNavAgent::DebugDraw() {
+	u64 numCells = 0;
+	for ( const FlowFieldCache::Entry & entry : flowFields.entries ) {
+		numCells += entry.field != nullptr ? entry.field->costs.size() : 0;
+	}
+	ImGui::Text( "%llu flow fields cached, %llu cells", ( u64 )flowFields.entries.size(), numCells );
+}
+
+// Walks the neighbors an agent can step on with this kind of movement, with the cost of each step
+template < typename Callback >
+static void ForEachFlowFieldNeighbor( Cell cell, MovementAllowed movement, const Map & map, Callback callback ) {
+	if ( movement == ROAD_NETWORK || movement == ROAD_NETWORK_AND_ROAD_BLOCK ) {
+		ng::StaticArray< Cell, 4 > neighbors;
+		GetWalkableNeighborsOfCell( cell, map, neighbors );
+		for ( const Cell & neighbor : neighbors ) {
+			callback( neighbor, 1u );
+		}
+		return;
+	}
+	for ( u32 x = cell.x == 0 ? cell.x : cell.x - 1; x <= cell.x + 1; x++ ) {
+		for ( u32 z = cell.z == 0 ? cell.z : cell.z - 1; z <= cell.z + 1; z++ ) {
+			if ( ( x == cell.x && z == cell.z ) || x >= map.sizeX || z >= map.sizeZ ) {
+				continue;
+			}
+			bool isDiagonal = x != cell.x && z != cell.z;
+			if ( ( movement == ASTAR_FORBID_DIAGONALS && isDiagonal ) || !map.IsTileAStarNavigable( Cell( x, z ) ) ) {
+				continue;
+			}
+			callback( Cell( x, z ), isDiagonal ? 14u : 10u );
+		}
+	}
+}
+
+void FlowField::Build( const CpntBuilding &             building,
+                       const Map &                      map,
+                       const ng::DynamicArray< Cell > & cellsToReach,
+                       u32                              minCost ) {
+	ZoneScoped;
+
+	struct OpenStep {
+		u32  cost;
+		Cell cell;
+		bool operator>( const OpenStep & rhs ) const { return cost > rhs.cost; }
+	};
+	std::priority_queue< OpenStep, std::vector< OpenStep >, std::greater< OpenStep > > openSet;
+
+	costs.clear();
+	chunks.Clear();
+	tileVersion = map.tileVersion;
+	roadVersion = map.roadVersion;
+	maxCost = 0;
+	isComplete = false;
+
+	// A cell is read along with its neighbors, which can be in the next chunk
+	std::vector< bool > isChunkRead( map.GetNumChunksX() * map.GetNumChunksZ(), false );
+
+	auto readAround = [ & ]( Cell cell ) {
+		for ( int dx = -1; dx <= 1; dx += 2 ) {
+			for ( int dz = -1; dz <= 1; dz += 2 ) {
+				Cell corner( std::clamp< int64 >( ( int64 )cell.x + dx, 0, map.sizeX - 1 ),
+				             std::clamp< int64 >( ( int64 )cell.z + dz, 0, map.sizeZ - 1 ) );
+				u32  chunkIndex = map.GetChunkIndex( corner );
+				if ( !isChunkRead[ chunkIndex ] ) {
+					isChunkRead[ chunkIndex ] = true;
+					chunks.PushBack( chunkIndex );
+				}
+			}
+		}
+	};
+
+	// Flood backward from the cells around the building, costs are the same in both directions
+	bool onRoads = movement == ROAD_NETWORK || movement == ROAD_NETWORK_AND_ROAD_BLOCK;
+	for ( Cell cell : building.AdjacentCells( map ) ) {
+		readAround( cell );
+		bool isEntrance = onRoads ? map.GetTile( cell ) == MapTile::ROAD : map.IsTileAStarNavigable( cell );
+		if ( isEntrance && costs.emplace( cell, 0 ).second ) {
+			openSet.push( OpenStep{ 0, cell } );
+		}
+	}
+
+	std::unordered_set< Cell, CellHash > toReach( cellsToReach.begin(), cellsToReach.end() );
+	while ( !openSet.empty() ) {
+		OpenStep current = openSet.top();
+		if ( current.cost > costs[ current.cell ] ) {
+			openSet.pop();
+			continue;
+		}
+		// Steps come out by increasing cost, once we are past what was asked every cell left is further
+		if ( toReach.empty() && current.cost > minCost && current.cost > maxCost ) {
+			break;
+		}
+		openSet.pop();
+		maxCost = current.cost;
+		toReach.erase( current.cell );
+		readAround( current.cell );
+		ForEachFlowFieldNeighbor( current.cell, movement, map, [ & ]( Cell neighbor, u32 stepCost ) {
+			u32  cost = current.cost + stepCost;
+			auto [ it, inserted ] = costs.emplace( neighbor, cost );
+			if ( inserted || cost < it->second ) {
+				it->second = cost;
+				openSet.push( OpenStep{ cost, neighbor } );
+			}
+		} );
+	}
+	isComplete = openSet.empty();
+	// Cells of the border were never expanded, their cost is not final
+	std::erase_if( costs, [ this ]( const auto & entry ) { return entry.second > maxCost; } );
+}
+
+bool FlowField::NeedsRebuild( const Map & map ) const {
+	if ( movement == ROAD_NETWORK || movement == ROAD_NETWORK_AND_ROAD_BLOCK ) {
+		return !IsUpToDate( map );
+	}
+	if ( map.tileVersion == tileVersion ) {
+		return false;
+	}
+	for ( u32 chunkIndex : chunks ) {
+		if ( chunkIndex >= map.GetNumChunksX() * map.GetNumChunksZ() ||
+		     map.GetChunk( chunkIndex ).closedVersion > tileVersion ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FlowField::IsUpToDate( const Map & map ) const {
+	bool onRoads = movement == ROAD_NETWORK || movement == ROAD_NETWORK_AND_ROAD_BLOCK;
+	if ( map.tileVersion == tileVersion || ( onRoads && map.roadVersion == roadVersion ) ) {
+		return true;
+	}
+	for ( u32 chunkIndex : chunks ) {
+		if ( chunkIndex >= map.GetNumChunksX() * map.GetNumChunksZ() ||
+		     map.GetChunk( chunkIndex ).version > tileVersion ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FlowField::IsDestination( Cell cell ) const {
+	auto it = costs.find( cell );
+	return it != costs.end() && it->second == 0;
+}
+
+bool FlowField::GetNextCell( Cell from, const Map & map, Cell & outNext ) const {
+	auto it = costs.find( from );
+	if ( it == costs.end() ) {
+		return false;
+	}
+	u32 bestCost = it->second;
+	outNext = INVALID_CELL;
+	ForEachFlowFieldNeighbor( from, movement, map, [ & ]( Cell neighbor, u32 stepCost ) {
+		auto neighborIt = costs.find( neighbor );
+		if ( neighborIt != costs.end() && neighborIt->second < bestCost ) {
+			bestCost = neighborIt->second;
+			outNext = neighbor;
+		}
+	} );
+	return outNext != INVALID_CELL;
+}
+
+static constexpr u32 REGION_CHUNK_SIZE = TileChunk::SIZE;
+
+// Corner of the chunk with the smallest coordinates
+static Cell GetChunkCorner( u32 chunkIndex, const Map & map ) {
+	return Cell( chunkIndex / map.GetNumChunksZ() * REGION_CHUNK_SIZE,
+	             chunkIndex % map.GetNumChunksZ() * REGION_CHUNK_SIZE );
+}
+
+static u32 IndexInRegionChunk( Cell cell ) {
+	return ( cell.x % REGION_CHUNK_SIZE ) * REGION_CHUNK_SIZE + cell.z % REGION_CHUNK_SIZE;
+}
+
+void NavigableRegions::LabelChunk( u32 chunkIndex, const Map & map ) {
+	const MapChunk & mapChunk = map.GetChunk( chunkIndex );
+	ChunkRegions &   chunk = chunks[ chunkIndex ];
+	chunk.version = mapChunk.version;
+	numChunksLabeled++;
+	if ( mapChunk.tiles == nullptr ) {
+		// Nothing but EMPTY tiles
+		chunk.labels.reset();
+		chunk.numRegions = 1;
+		return;
+	}
+	if ( chunk.labels == nullptr ) {
+		chunk.labels = std::make_unique< u16[] >( REGION_CHUNK_SIZE * REGION_CHUNK_SIZE );
+	}
+	std::fill_n( chunk.labels.get(), REGION_CHUNK_SIZE * REGION_CHUNK_SIZE, NO_LOCAL_REGION );
+	chunk.numRegions = 0;
+
+	Cell corner = GetChunkCorner( chunkIndex, map );
+	u32  endX = MIN( corner.x + REGION_CHUNK_SIZE, map.sizeX );
+	u32  endZ = MIN( corner.z + REGION_CHUNK_SIZE, map.sizeZ );
+	thread_local ng::DynamicArray< Cell > stack;
+	for ( u32 x = corner.x; x < endX; x++ ) {
+		for ( u32 z = corner.z; z < endZ; z++ ) {
+			Cell cell( x, z );
+			if ( chunk.labels[ IndexInRegionChunk( cell ) ] != NO_LOCAL_REGION || !map.IsTileAStarNavigable( cell ) ) {
+				continue;
+			}
+			u16 region = chunk.numRegions++;
+			chunk.labels[ IndexInRegionChunk( cell ) ] = region;
+			stack.PushBack( cell );
+			while ( !stack.Empty() ) {
+				Cell current = stack.Last();
+				stack.PopBack();
+				ForEachFlowFieldNeighbor( current, ASTAR_ALLOW_DIAGONALS, map, [ & ]( Cell neighbor, u32 ) {
+					if ( map.GetChunkIndex( neighbor ) != chunkIndex ) {
+						return;
+					}
+					u16 & label = chunk.labels[ IndexInRegionChunk( neighbor ) ];
+					if ( label == NO_LOCAL_REGION ) {
+						label = region;
+						stack.PushBack( neighbor );
+					}
+				} );
+			}
+		}
+	}
+}
+
+void NavigableRegions::LinkChunk( u32 chunkIndex, const Map & map ) {
+	ChunkRegions & chunk = chunks[ chunkIndex ];
+	chunk.links.Clear();
+	Cell corner = GetChunkCorner( chunkIndex, map );
+	u32  lastX = MIN( corner.x + REGION_CHUNK_SIZE, map.sizeX ) - 1;
+	u32  lastZ = MIN( corner.z + REGION_CHUNK_SIZE, map.sizeZ ) - 1;
+	// Two chunks full of EMPTY tiles touch everywhere
+	bool isEmpty = chunk.labels == nullptr;
+	auto linkTo = [ & ]( u32 otherChunk ) {
+		if ( isEmpty && chunks[ otherChunk ].labels == nullptr ) {
+			chunk.links.PushBack( Link{ 0, otherChunk, 0 } );
+			return false;
+		}
+		return true;
+	};
+	auto linkCell = [ & ]( Cell cell ) {
+		u16 region = GetLocalRegion( cell, map );
+		if ( region == NO_LOCAL_REGION ) {
+			return;
+		}
+		ForEachFlowFieldNeighbor( cell, ASTAR_ALLOW_DIAGONALS, map, [ & ]( Cell neighbor, u32 ) {
+			u32 otherChunk = map.GetChunkIndex( neighbor );
+			if ( otherChunk == chunkIndex ) {
+				return;
+			}
+			Link link{ region, otherChunk, GetLocalRegion( neighbor, map ) };
+			// Cells along a border mostly repeat the previous link
+			if ( chunk.links.Empty() || chunk.links.Last().region != link.region ||
+			     chunk.links.Last().otherChunk != link.otherChunk ||
+			     chunk.links.Last().otherRegion != link.otherRegion ) {
+				chunk.links.PushBack( link );
+			}
+		} );
+	};
+
+	u32  numChunksZ = map.GetNumChunksZ();
+	bool hasNextX = lastX + 1 < map.sizeX;
+	bool hasNextZ = lastZ + 1 < map.sizeZ;
+	bool hasPreviousZ = corner.z > 0;
+	bool scanX = hasNextX && linkTo( chunkIndex + numChunksZ );
+	bool scanZ = hasNextZ && linkTo( chunkIndex + 1 );
+	bool scanCornerAfter = hasNextX && hasNextZ && linkTo( chunkIndex + numChunksZ + 1 );
+	bool scanCornerBefore = hasNextX && hasPreviousZ && linkTo( chunkIndex + numChunksZ - 1 );
+	if ( scanX || scanCornerAfter || scanCornerBefore ) {
+		for ( u32 z = corner.z; z <= lastZ; z++ ) {
+			linkCell( Cell( lastX, z ) );
+		}
+	}
+	if ( scanZ ) {
+		for ( u32 x = corner.x; x <= lastX; x++ ) {
+			linkCell( Cell( x, lastZ ) );
+		}
+	}
+}
+
+u16 NavigableRegions::GetLocalRegion( Cell cell, const Map & map ) const {
+	const ChunkRegions & chunk = chunks[ map.GetChunkIndex( cell ) ];
+	return chunk.labels != nullptr ? chunk.labels[ IndexInRegionChunk( cell ) ] : 0;
+}
+
+u32 NavigableRegions::FindRoot( u32 region ) {
+	while ( parents[ region ] != region ) {
+		parents[ region ] = parents[ parents[ region ] ];
+		region = parents[ region ];
+	}
+	return region;
+}
+
+void NavigableRegions::Update( const Map & map ) {
+	u32 numChunks = map.GetNumChunksX() * map.GetNumChunksZ();
+	if ( sizeX != map.sizeX || sizeZ != map.sizeZ || chunks.size() != numChunks ) {
+		sizeX = map.sizeX;
+		sizeZ = map.sizeZ;
+		chunks.clear();
+		chunks.resize( numChunks );
+	} else if ( tileVersion == map.tileVersion ) {
+		return;
+	}
+	tileVersion = map.tileVersion;
+
+	thread_local ng::DynamicArray< u32 > labeled;
+	labeled.Clear();
+	for ( u32 i = 0; i < numChunks; i++ ) {
+		if ( chunks[ i ].version != map.GetChunk( i ).version ) {
+			LabelChunk( i, map );
+			labeled.PushBack( i );
+		}
+	}
+	if ( labeled.Empty() ) {
+		return;
+	}
+	// The links of a chunk go to the chunks after it, so the chunks before a labeled one have to look again too
+	thread_local ng::DynamicArray< u32 > toLink;
+	toLink.Clear();
+	u32 numChunksZ = map.GetNumChunksZ();
+	for ( u32 chunkIndex : labeled ) {
+		u32 cx = chunkIndex / numChunksZ;
+		u32 cz = chunkIndex % numChunksZ;
+		toLink.PushBack( chunkIndex );
+		if ( cz > 0 ) {
+			toLink.PushBack( chunkIndex - 1 );
+		}
+		if ( cx > 0 ) {
+			toLink.PushBack( chunkIndex - numChunksZ );
+			if ( cz > 0 ) {
+				toLink.PushBack( chunkIndex - numChunksZ - 1 );
+			}
+			if ( cz + 1 < numChunksZ ) {
+				toLink.PushBack( chunkIndex - numChunksZ + 1 );
+			}
+		}
+	}
+	std::sort( toLink.begin(), toLink.end() );
+	u32 * end = std::unique( toLink.begin(), toLink.end() );
+	for ( u32 * it = toLink.begin(); it != end; it++ ) {
+		LinkChunk( *it, map );
+	}
+
+	// Joining goes over the links only, no cell is read again
+	u32 numRegions = 0;
+	for ( ChunkRegions & chunk : chunks ) {
+		chunk.firstRegion = numRegions;
+		numRegions += chunk.numRegions;
+	}
+	parents.resize( numRegions );
+	for ( u32 i = 0; i < numRegions; i++ ) {
+		parents[ i ] = i;
+	}
+	for ( const ChunkRegions & chunk : chunks ) {
+		for ( const Link & link : chunk.links ) {
+			u32 a = FindRoot( chunk.firstRegion + link.region );
+			u32 b = FindRoot( chunks[ link.otherChunk ].firstRegion + link.otherRegion );
+			parents[ MAX( a, b ) ] = MIN( a, b );
+		}
+	}
+}
+
+u32 NavigableRegions::GetRegion( Cell cell, const Map & map ) {
+	Update( map );
+	if ( cell.x >= sizeX || cell.z >= sizeZ ) {
+		return NO_REGION;
+	}
+	u16 region = GetLocalRegion( cell, map );
+	if ( region == NO_LOCAL_REGION ) {
+		return NO_REGION;
+	}
+	return FindRoot( chunks[ map.GetChunkIndex( cell ) ].firstRegion + region );
+}
+
+bool NavigableRegions::AreConnected( Cell a, Cell b, const Map & map ) {
+	u32 region = GetRegion( a, map );
+	return region != NO_REGION && region == GetRegion( b, map );
+}
+
+FlowFieldCache::Entry & FlowFieldCache::Get( Entity destination, MovementAllowed movement ) {
+	Entry * entry = nullptr;
+	for ( Entry & candidate : entries ) {
+		if ( candidate.destination == destination && candidate.movement == movement ) {
+			entry = &candidate;
+			break;
+		}
+	}
+	if ( entry == nullptr ) {
+		if ( entries.size() < MAX_FIELDS ) {
+			entry = &entries.emplace_back();
+		} else {
+			// Recycle the field that was used the longest time ago
+			entry = &entries[ 0 ];
+			for ( Entry & candidate : entries ) {
+				if ( candidate.lastUsed < entry->lastUsed ) {
+					entry = &candidate;
+				}
+			}
+			*entry = Entry{};
+		}
+		entry->destination = destination;
+		entry->movement = movement;
+	}
+	entry->lastUsed = useCounter++;
+	return *entry;
+}
+
+void FlowFieldCache::Entry::QueueCell( Cell cell ) {
+	if ( queuedCells.insert( cell ).second ) {
+		cellsToReach.PushBack( cell );
+	}
+}
+
+void FlowFieldCache::Store( std::shared_ptr< const FlowField > field ) {
+	for ( Entry & entry : entries ) {
+		if ( entry.destination == field->destination && entry.movement == field->movement ) {
+			entry.field = std::move( field );
+			entry.isBuilding = false;
+			return;
+		}
+	}
+}
+
+bool FlowFieldCache::IsWaitingForBuilds() const {
+	for ( const Entry & entry : entries ) {
+		if ( entry.isBuilding ) {
+			return true;
+		}
+	}
+	return false;
+}
+
 RoadNetwork::Node * RoadNetwork::FindNodeWithPosition( Cell cell ) {
-	for ( Node & node : nodes ) {
+	return const_cast< Node * >( static_cast< const RoadNetwork * >( this )->FindNodeWithPosition( cell ) );
+}
+
+const RoadNetwork::Node * RoadNetwork::FindNodeWithPosition( Cell cell ) const {
+	for ( const Node & node : nodes ) {
 		if ( node.position == cell ) {
 			return &node;
 		}
@@ -333,6 +1062,11 @@ RoadNetwork::Node * RoadNetwork::ResolveConnection( Connection * connection ) {
 	return FindNodeWithPosition( connection->connectedTo );
 }
 
+const RoadNetwork::Node * RoadNetwork::ResolveConnection( const Connection * connection ) const {
+	ng_assert( connection->IsValid() );
+	return FindNodeWithPosition( connection->connectedTo );
+}
+
 bool RoadNetwork::RemoveNodeByPosition( Cell cell ) {
 	for ( u64 i = 0; i < nodes.size(); i++ ) {
 		if ( nodes[ i ].position == cell ) {
@@ -349,8 +1083,11 @@ RoadNetwork::Node SplitRoad( RoadNetwork & network, const Map & map, Cell cell )
 	network.FindNearestRoadNodes( cell, map, searchA, searchB );
 	ng_assert( searchA.found == true && searchB.found == true );
 
-	RoadNetwork::Connection & connectionFromA = searchA.node->connections[ searchA.directionFromEnd ];
-	RoadNetwork::Connection & connectionFromB = searchB.node->connections[ searchB.directionFromEnd ];
+	// The search only hands out const nodes, we are the one editing them here
+	RoadNetwork::Node *       nodeA = network.FindNodeWithPosition( searchA.node->position );
+	RoadNetwork::Node *       nodeB = network.FindNodeWithPosition( searchB.node->position );
+	RoadNetwork::Connection & connectionFromA = nodeA->connections[ searchA.directionFromEnd ];
+	RoadNetwork::Connection & connectionFromB = nodeB->connections[ searchB.directionFromEnd ];
 	ng_assert( connectionFromA.IsValid() && connectionFromB.IsValid() );
 
 	connectionFromA.connectedTo = cell;
@@ -370,6 +1107,8 @@ RoadNetwork::Node SplitRoad( RoadNetwork & network, const Map & map, Cell cell )
 }
 
 void RoadNetwork::AddRoadCellToNetwork( Cell cellToAdd, const Map & map ) {
+	AddCellToComponents( cellToAdd, map );
+
 	ng::StaticArray< Cell, 4 > roadNeighbors;
 	GetWalkableNeighborsOfCell( cellToAdd, map, roadNeighbors );
 
@@ -408,6 +1147,8 @@ void RoadNetwork::AddRoadCellToNetwork( Cell cellToAdd, const Map & map ) {
 }
 
 void RoadNetwork::RemoveRoadCellFromNetwork( Cell cellToRemove, const Map & map ) {
+	RemoveCellFromComponents( cellToRemove, map );
+
 	if ( FindNodeWithPosition( cellToRemove ) == nullptr ) {
 		Node split = SplitRoad( *this, map, cellToRemove );
 		nodes.push_back( split );
@@ -439,6 +1180,193 @@ void RoadNetwork::RemoveRoadCellFromNetwork( Cell cellToRemove, const Map & map
 	RemoveNodeByPosition( cellToRemove );
 }
 
+// Changed cells and their neighbors, that's every cell whose connections can be affected by the edit
+static void GatherCellsAroundEdit( const ng::DynamicArray< Cell > & changedCells,
+                                   const Map &                      map,
+                                   ng::DynamicArray< Cell > &       outCells ) {
+	std::unordered_set< Cell, CellHash > gathered;
+	for ( const Cell & cell : changedCells ) {
+		if ( gathered.insert( cell ).second ) {
+			outCells.PushBack( cell );
+		}
+		ng::StaticArray< Cell, 4 > neighbors;
+		GetNeighborsOfCell( cell, map, neighbors );
+		for ( const Cell & neighbor : neighbors ) {
+			if ( gathered.insert( neighbor ).second ) {
+				outCells.PushBack( neighbor );
+			}
+		}
+	}
+}
+
+// Where a walk along a road stopped
+struct RoadWalk {
+	Cell              end = INVALID_CELL;
+	CardinalDirection directionFromEnd; // the connection of the end node that leads back to the start
+	u32               distance = 0;
+};
+
+// Walks a road made of cells with two neighbors until it reaches a node, or comes back to where it started
+template < typename IsNode, typename OnCell >
+static RoadWalk WalkRoad( Cell start, Cell first, const Map & map, IsNode isNode, OnCell onCell ) {
+	RoadWalk walk;
+	Cell     previous = start;
+	Cell     current = first;
+	walk.distance = 1;
+	while ( current != start && !isNode( current ) ) {
+		onCell( current );
+		ng::StaticArray< Cell, 4 > roadNeighbors;
+		GetWalkableNeighborsOfCell( current, map, roadNeighbors );
+		ng_assert( roadNeighbors.Size() == 2 );
+		Cell next = roadNeighbors[ 0 ] == previous ? roadNeighbors[ 1 ] : roadNeighbors[ 0 ];
+		previous = current;
+		current = next;
+		walk.distance++;
+	}
+	walk.end = current;
+	walk.directionFromEnd = GetDirectionFromCellTo( current, previous );
+	return walk;
+}
+
+static std::unordered_map< Cell, u32, CellHash > IndexNodes( const std::vector< RoadNetwork::Node > & nodes ) {
+	std::unordered_map< Cell, u32, CellHash > index;
+	index.reserve( nodes.size() );
+	for ( u32 i = 0; i < nodes.size(); i++ ) {
+		index[ nodes[ i ].position ] = i;
+	}
+	return index;
+}
+
+void RoadNetwork::DetachRoadsAroundCells( const ng::DynamicArray< Cell > & changedCells, const Map & map ) {
+	ZoneScoped;
+	ng::DynamicArray< Cell > cells;
+	GatherCellsAroundEdit( changedCells, map, cells );
+
+	auto                                 index = IndexNodes( nodes );
+	auto                                 isNode = [ & ]( Cell cell ) { return index.contains( cell ); };
+	std::unordered_set< Cell, CellHash > walked;
+	std::unordered_set< Cell, CellHash > detachedNodes;
+	for ( const Cell & cell : cells ) {
+		if ( !map.IsTileWalkable( cell ) || walked.contains( cell ) ) {
+			continue;
+		}
+		auto it = index.find( cell );
+		if ( it != index.end() ) {
+			// The node goes away, and every connection leading to it
+			for ( const Connection & connection : nodes[ it->second ].connections ) {
+				if ( connection.IsValid() && isNode( connection.connectedTo ) ) {
+					for ( Connection & connectionBack : nodes[ index[ connection.connectedTo ] ].connections ) {
+						if ( connectionBack.connectedTo == cell ) {
+							connectionBack.Invalidate();
+						}
+					}
+				}
+			}
+			detachedNodes.insert( cell );
+			continue;
+		}
+
+		// The cell is in the middle of a road, cut it at both ends
+		walked.insert( cell );
+		ng::StaticArray< Cell, 4 > roadNeighbors;
+		GetWalkableNeighborsOfCell( cell, map, roadNeighbors );
+		ng_assert( roadNeighbors.Size() == 2 );
+		for ( const Cell & neighbor : roadNeighbors ) {
+			RoadWalk walk =
+			    WalkRoad( cell, neighbor, map, isNode, [ & ]( Cell walkedCell ) { walked.insert( walkedCell ); } );
+			nodes[ index[ walk.end ] ].connections[ walk.directionFromEnd ].Invalidate();
+		}
+	}
+
+	std::erase_if( nodes, [ & ]( const Node & node ) { return detachedNodes.contains( node.position ); } );
+}
+
+void RoadNetwork::ApplyCellEdits( const ng::DynamicArray< Cell > & removedCells,
+                                  const ng::DynamicArray< Cell > & addedCells,
+                                  const Map &                      map ) {
+	ZoneScoped;
+	RemoveCellsFromComponents( removedCells, map );
+	for ( const Cell & cell : addedCells ) {
+		AddCellToComponents( cell, map );
+	}
+
+	ng::DynamicArray< Cell > cells;
+	GatherCellsAroundEdit( addedCells, map, cells );
+	GatherCellsAroundEdit( removedCells, map, cells );
+
+	// Dead ends and crossroads around the edit are nodes, everything else is in the middle of a road
+	for ( const Cell & cell : cells ) {
+		ng::StaticArray< Cell, 4 > roadNeighbors;
+		GetWalkableNeighborsOfCell( cell, map, roadNeighbors );
+		if ( map.IsTileWalkable( cell ) && roadNeighbors.Size() != 2 ) {
+			Node newNode;
+			newNode.position = cell;
+			nodes.push_back( newNode );
+		}
+	}
+
+	auto                                 index = IndexNodes( nodes );
+	auto                                 isNode = [ & ]( Cell cell ) { return index.contains( cell ); };
+	std::unordered_set< Cell, CellHash > walked;
+	// Nodes from before the edit that got reconnected, they might be simple corners now
+	ng::DynamicArray< Cell > touchedNodes;
+	auto                     connect = [ & ]( Cell from, CardinalDirection direction, Cell to, u32 distance ) {
+		nodes[ index[ from ] ].connections[ direction ] = Connection( to, distance );
+		touchedNodes.PushBack( from );
+	};
+
+	for ( const Cell & cell : cells ) {
+		if ( !map.IsTileWalkable( cell ) || walked.contains( cell ) ) {
+			continue;
+		}
+		walked.insert( cell );
+		auto                       markWalked = [ & ]( Cell walkedCell ) { walked.insert( walkedCell ); };
+		ng::StaticArray< Cell, 4 > roadNeighbors;
+		GetWalkableNeighborsOfCell( cell, map, roadNeighbors );
+		if ( isNode( cell ) ) {
+			for ( const Cell & neighbor : roadNeighbors ) {
+				RoadWalk walk = WalkRoad( cell, neighbor, map, isNode, markWalked );
+				connect( cell, GetDirectionFromCellTo( cell, neighbor ), walk.end, walk.distance );
+				connect( walk.end, walk.directionFromEnd, cell, walk.distance );
+			}
+			continue;
+		}
+
+		RoadWalk walkA = WalkRoad( cell, roadNeighbors[ 0 ], map, isNode, markWalked );
+		if ( walkA.end == cell ) {
+			// A loop without any crossroad, one of its cells has to be a node connected to itself
+			Node newNode;
+			newNode.position = cell;
+			newNode.connections[ GetDirectionFromCellTo( cell, roadNeighbors[ 0 ] ) ] =
+			    Connection( cell, walkA.distance );
+			newNode.connections[ walkA.directionFromEnd ] = Connection( cell, walkA.distance );
+			nodes.push_back( newNode );
+			index[ cell ] = ( u32 )nodes.size() - 1;
+			continue;
+		}
+		RoadWalk walkB = WalkRoad( cell, roadNeighbors[ 1 ], map, isNode, markWalked );
+		connect( walkA.end, walkA.directionFromEnd, walkB.end, walkA.distance + walkB.distance );
+		connect( walkB.end, walkB.directionFromEnd, walkA.end, walkA.distance + walkB.distance );
+	}
+
+	// Dissolving doesn't change how many connections the other nodes have, so we can pick them all first
+	// Two of them on the same loop can still end up connected to themselves, so they are checked again
+	ng::DynamicArray< Cell > nodesToDissolve;
+	for ( const Cell & position : touchedNodes ) {
+		const Node & node = nodes[ index[ position ] ];
+		if ( node.NumSetConnections() == 2 && node.IsConnectedToItself() == false &&
+		     nodesToDissolve.FindIndexByValue( position ) == -1 ) {
+			nodesToDissolve.PushBack( position );
+		}
+	}
+	for ( const Cell & position : nodesToDissolve ) {
+		Node * node = FindNodeWithPosition( position );
+		if ( node->IsConnectedToItself() == false ) {
+			DissolveNode( *node );
+		}
+	}
+}
+
 void RoadNetwork::DissolveNode( Node & nodeToDissolve ) {
 	ng_assert( nodeToDissolve.NumSetConnections() == 2 );
 	Node * nodeA = FindNodeWithPosition( nodeToDissolve.GetValidConnectionWithOffset( 0 )->connectedTo );
@@ -475,17 +1403,196 @@ void RoadNetwork::DissolveNode( Node & nodeToDissolve ) {
 	RemoveNodeByPosition( nodeToDissolve.position );
 }
 
+u32 RoadNetwork::GetComponent( Cell cell ) const {
+	auto it = cellComponents.find( cell );
+	if ( it == cellComponents.end() ) {
+		return INVALID_COMPONENT;
+	}
+	return FindComponentRoot( it->second );
+}
+
+bool RoadNetwork::AreCellsConnected( Cell a, Cell b ) const {
+	u32 componentA = GetComponent( a );
+	return componentA != INVALID_COMPONENT && componentA == GetComponent( b );
+}
+
+u32 RoadNetwork::CreateComponent() {
+	u32 component = ( u32 )componentParents.size();
+	componentParents.push_back( component );
+	componentRanks.push_back( 0 );
+	return component;
+}
+
+u32 RoadNetwork::FindComponentRoot( u32 component ) const {
+	// No path compression here, this is called from the pathfinding thread. Union by rank keeps the trees shallow
+	while ( componentParents[ component ] != component ) {
+		component = componentParents[ component ];
+	}
+	return component;
+}
+
+u32 RoadNetwork::MergeComponents( u32 a, u32 b ) {
+	a = FindComponentRoot( a );
+	b = FindComponentRoot( b );
+	if ( a == b ) {
+		return a;
+	}
+	if ( componentRanks[ a ] < componentRanks[ b ] ) {
+		std::swap( a, b );
+	}
+	componentParents[ b ] = a;
+	if ( componentRanks[ a ] == componentRanks[ b ] ) {
+		componentRanks[ a ]++;
+	}
+	return a;
+}
+
+void RoadNetwork::AddCellToComponents( Cell cellToAdd, const Map & map ) {
+	ng::StaticArray< Cell, 4 > roadNeighbors;
+	GetWalkableNeighborsOfCell( cellToAdd, map, roadNeighbors );
+
+	u32 component = INVALID_COMPONENT;
+	for ( const Cell & neighbor : roadNeighbors ) {
+		u32 neighborComponent = GetComponent( neighbor );
+		if ( neighborComponent == INVALID_COMPONENT ) {
+			continue;
+		}
+		component = component == INVALID_COMPONENT ? neighborComponent : MergeComponents( component, neighborComponent );
+	}
+	if ( component == INVALID_COMPONENT ) {
+		component = CreateComponent();
+	}
+	cellComponents[ cellToAdd ] = component;
+}
+
+void RoadNetwork::RemoveCellFromComponents( Cell cellToRemove, const Map & map ) {
+	ng::DynamicArray< Cell > cellsToRemove( 1 );
+	cellsToRemove.PushBack( cellToRemove );
+	RemoveCellsFromComponents( cellsToRemove, map );
+}
+
+void RoadNetwork::RemoveCellsFromComponents( const ng::DynamicArray< Cell > & cellsToRemove, const Map & map ) {
+	ZoneScoped;
+
+	std::unordered_set< Cell, CellHash > removed;
+	for ( const Cell & cell : cellsToRemove ) {
+		cellComponents.erase( cell );
+		removed.insert( cell );
+	}
+
+	// The cells can still be walkable on the map when they are removed one by one, skip them explicitly
+	std::unordered_set< Cell, CellHash > seeds;
+	for ( const Cell & cell : cellsToRemove ) {
+		ng::StaticArray< Cell, 4 > roadNeighbors;
+		GetWalkableNeighborsOfCell( cell, map, roadNeighbors );
+		for ( const Cell & neighbor : roadNeighbors ) {
+			if ( !removed.contains( neighbor ) ) {
+				seeds.insert( neighbor );
+			}
+		}
+	}
+	if ( seeds.size() <= 1 ) {
+		// Removing a dead end can't split anything
+		return;
+	}
+
+	// Flood from every neighbor one cell at a time. When two floods meet they belong to the same side
+	// The first side that runs out of cells is isolated, it gets a new component and the others keep the old one
+	// This way we only ever walk about as many cells as there are in the smallest side
+	struct Flood {
+		ng::DynamicArray< Cell > cells;
+		u32                      cursor = 0;
+		u32                      side = 0;
+		bool                     relabeled = false;
+	};
+	std::vector< Flood >                      floods( seeds.size() );
+	std::unordered_map< Cell, u32, CellHash > visitedBy;
+	u32                                       numFloods = ( u32 )seeds.size();
+
+	auto findSide = [ & ]( u32 flood ) {
+		while ( floods[ flood ].side != flood ) {
+			flood = floods[ flood ].side;
+		}
+		return flood;
+	};
+
+	u32 seedIndex = 0;
+	for ( const Cell & seed : seeds ) {
+		floods[ seedIndex ].side = seedIndex;
+		floods[ seedIndex ].cells.PushBack( seed );
+		visitedBy[ seed ] = seedIndex;
+		seedIndex++;
+	}
+
+	std::vector< bool > isolatedSides( numFloods );
+	while ( true ) {
+		for ( u32 i = 0; i < numFloods; i++ ) {
+			Flood & flood = floods[ i ];
+			if ( flood.relabeled || flood.cursor == flood.cells.Size() ) {
+				continue;
+			}
+			Cell                       current = flood.cells[ flood.cursor++ ];
+			ng::StaticArray< Cell, 4 > neighbors;
+			GetWalkableNeighborsOfCell( current, map, neighbors );
+			for ( const Cell & neighbor : neighbors ) {
+				if ( removed.contains( neighbor ) ) {
+					continue;
+				}
+				auto [ it, inserted ] = visitedBy.emplace( neighbor, i );
+				if ( inserted ) {
+					flood.cells.PushBack( neighbor );
+				} else if ( findSide( it->second ) != findSide( i ) ) {
+					floods[ findSide( it->second ) ].side = findSide( i );
+				}
+			}
+		}
+
+		// A side is isolated when none of its floods has cells left to walk
+		u32 numSidesLeft = 0;
+		for ( u32 i = 0; i < numFloods; i++ ) {
+			isolatedSides[ i ] = !floods[ i ].relabeled && findSide( i ) == i;
+			numSidesLeft += isolatedSides[ i ] ? 1 : 0;
+		}
+		for ( u32 j = 0; j < numFloods; j++ ) {
+			if ( !floods[ j ].relabeled && floods[ j ].cursor < floods[ j ].cells.Size() ) {
+				isolatedSides[ findSide( j ) ] = false;
+			}
+		}
+
+		for ( u32 side = 0; side < numFloods && numSidesLeft > 1; side++ ) {
+			if ( !isolatedSides[ side ] ) {
+				continue;
+			}
+			u32 newComponent = CreateComponent();
+			for ( u32 j = 0; j < numFloods; j++ ) {
+				if ( findSide( j ) != side ) {
+					continue;
+				}
+				for ( const Cell & cell : floods[ j ].cells ) {
+					cellComponents[ cell ] = newComponent;
+				}
+				floods[ j ].relabeled = true;
+			}
+			numSidesLeft--;
+		}
+
+		if ( numSidesLeft <= 1 ) {
+			break;
+		}
+	}
+}
+
 void RoadNetwork::FindNearestRoadNodes( Cell               cell,
                                         const Map &        map,
                                         NodeSearchResult & first,
-                                        NodeSearchResult & second ) {
+                                        NodeSearchResult & second ) const {
 
 	ng_assert( map.IsTileWalkable( cell ) );
 	if ( !map.IsTileWalkable( cell ) ) {
 		return;
 	}
 
-	Node * node = FindNodeWithPosition( cell );
+	const Node * node = FindNodeWithPosition( cell );
 	if ( node != nullptr ) {
 		first.found = true;
 		first.node = node;
@@ -506,7 +1613,7 @@ void RoadNetwork::FindNearestRoadNodes( Cell               cell,
 
 	for ( int i = 0; i < 2; i++ ) {
 		while ( true ) {
-			Node * node = FindNodeWithPosition( roadNeighbors[ i ] );
+			const Node * node = FindNodeWithPosition( roadNeighbors[ i ] );
 			if ( node != nullptr ) {
 				NodeSearchResult result{};
 				result.found = true;
@@ -605,13 +1712,13 @@ bool BuildPathInsideNodes( Cell                       start,
 	return false;
 }
 
-bool BuildPathBetweenNodes( RoadNetwork::Node &        start,
-                            RoadNetwork::Node &        goal,
+bool BuildPathBetweenNodes( const RoadNetwork::Node &  start,
+                            const RoadNetwork::Node &  goal,
                             const Map &                map,
                             ng::DynamicArray< Cell > & outPath,
                             u32 &                      outTotalDistance ) {
-	RoadNetwork::Connection * connection = start.FindShortestConnectionWith( goal.position );
-	CardinalDirection         direction = start.GetDirectionOfConnection( connection );
+	const RoadNetwork::Connection * connection = start.FindShortestConnectionWith( goal.position );
+	CardinalDirection               direction = start.GetDirectionOfConnection( connection );
 
 	Cell              currentCell = GetCellAfterMovement( start.position, direction );
 	Cell              previousCell = start.position;
@@ -645,16 +1752,16 @@ bool BuildPathBetweenNodes( RoadNetwork::Node &        start,
 	return false;
 }
 
-bool BuildPathFromNodeToCell( RoadNetwork::Node &        start,
+bool BuildPathFromNodeToCell( const RoadNetwork::Node &  start,
                               const Cell &               goal,
                               const Map &                map,
                               ng::DynamicArray< Cell > & outPath,
                               u32 &                      outTotalDistance,
                               bool                       insertReverse = false ) {
 	for ( u32 i = 0; i < start.NumSetConnections(); i++ ) {
-		ng::DynamicArray< Cell >  path( 16 );
-		RoadNetwork::Connection * connection = start.GetValidConnectionWithOffset( i );
-		CardinalDirection         direction = start.GetDirectionOfConnection( connection );
+		ng::DynamicArray< Cell >        path( 16 );
+		const RoadNetwork::Connection * connection = start.GetValidConnectionWithOffset( i );
+		CardinalDirection               direction = start.GetDirectionOfConnection( connection );
 
 		Cell              currentCell = GetCellAfterMovement( start.position, direction );
 		Cell              previousCell = start.position;
@@ -700,8 +1807,11 @@ bool BuildPathFromNodeToCell( RoadNetwork::Node &        start,
 	return false;
 }
 
-bool CreateWandererRoutine(
-    const Cell & start, Map & map, RoadNetwork & roadNetwork, ng::DynamicArray< Cell > & outPath, u32 maxDistance ) {
+bool CreateWandererRoutine( const Cell &               start,
+                            const Map &                map,
+                            const RoadNetwork &        roadNetwork,
+                            ng::DynamicArray< Cell > & outPath,
+                            u32                        maxDistance ) {
 	// From the start cell and then at every intersection, we look for tiles around clockwise
 	// If it's accessible, we go there.
 	// If we reached maximum distance, we take the shortest path to home
@@ -747,7 +1857,7 @@ bool RoadNetwork::FindPath( Cell                       start,
                             const Map &                map,
                             ng::DynamicArray< Cell > & outPath,
                             u32 *                      outTotalDistance /*= nullptr*/,
-                            u32                        maxDistance /*= ULONG_MAX */ ) {
+                            u32                        maxDistance /*= ULONG_MAX */ ) const {
 	ZoneScoped;
 
 	thread_local ng::DynamicArray< AStarStep * > findPathOpenSet( 64 );
@@ -764,12 +1874,15 @@ bool RoadNetwork::FindPath( Cell                       start,
 	if ( !map.IsTileWalkable( start ) || !map.IsTileWalkable( goal ) ) {
 		return false;
 	}
+	if ( !AreCellsConnected( start, goal ) ) {
+		return false;
+	}
 
-	auto pushOrUpdateStep = [ & ]( const Cell & position, Node * node, int totalCost, AStarStep * parent ) {
+	auto pushOrUpdateStep = [ & ]( const Cell & position, const Node * node, int totalCost, AStarStep * parent ) {
 		ZoneScopedN( "pushOrUpdateStep" );
 		AStarStep * step = FindNodeInSet( findPathOpenSet, position );
 		if ( step == nullptr ) {
-			step = aStarStepPool.Pop();
+			step = PopAStarStep();
 			step->coord = position;
 			step->node = node;
 			step->parent = parent;
@@ -805,7 +1918,7 @@ bool RoadNetwork::FindPath( Cell                       start,
 		}
 		return true;
 	}
-	if ( Node * startNode = FindNodeWithPosition( start );
+	if ( const Node * startNode = FindNodeWithPosition( start );
 	     startNode != nullptr && ( searchGoalA.node == startNode || searchGoalB.node == startNode ) ) {
 		BuildPathFromNodeToCell( *startNode, goal, map, outPath, totalDistance, true );
 		outPath.PushBack( start );
@@ -814,7 +1927,7 @@ bool RoadNetwork::FindPath( Cell                       start,
 		}
 		return true;
 	}
-	if ( Node * goalNode = FindNodeWithPosition( goal );
+	if ( const Node * goalNode = FindNodeWithPosition( goal );
 	     goalNode != nullptr && ( searchStartA.node == goalNode || searchStartB.node == goalNode ) ) {
 		outPath.PushBack( goal );
 		BuildPathFromNodeToCell( *goalNode, start, map, outPath, totalDistance );
@@ -849,10 +1962,11 @@ bool RoadNetwork::FindPath( Cell                       start,
 			break;
 		}
 
+		pathfindingCounters.nodesExpanded++;
 		AStarStep * parent = findPathClosedSet.PushBack( current );
 		findPathOpenSet.DeleteIndexFast( bestCandidateIndex );
 
-		Node * node = current->node;
+		const Node * node = current->node;
 		ng_assert( node != nullptr );
 		if ( current->coord == searchGoalA.node->position ) {
 			int totalCost = current->g + searchGoalA.distance;
@@ -862,8 +1976,8 @@ bool RoadNetwork::FindPath( Cell                       start,
 			pushOrUpdateStep( goal, nullptr, totalCost, parent );
 		} else {
 			for ( u32 i = 0; i < node->NumSetConnections(); i++ ) {
-				Connection * connection = node->GetValidConnectionWithOffset( i );
-				int          totalCost = current->g + connection->distance;
+				const Connection * connection = node->GetValidConnectionWithOffset( i );
+				int                totalCost = current->g + connection->distance;
 				if ( ( u32 )totalCost < maxDistance &&
 				     FindNodeInSet( findPathClosedSet, connection->connectedTo ) == nullptr ) {
 					pushOrUpdateStep( connection->connectedTo, ResolveConnection( connection ), totalCost, parent );
@@ -933,8 +2047,8 @@ Cell GetAnyRoadConnectedToBuilding( const CpntBuilding & building, const Map & m
 
 bool FindPathBetweenBuildings( const CpntBuilding &       start,
                                const CpntBuilding &       goal,
-                               Map &                      map,
-                               RoadNetwork &              roadNetwork,
+                               const Map &                map,
+                               const RoadNetwork &        roadNetwork,
                                ng::DynamicArray< Cell > & outPath,
                                u32                        maxDistance /*= ULONG_MAX*/,
                                u32 *                      outDistance /*= nullptr */ ) {
@@ -989,6 +2103,9 @@ bool FindPathBetweenBuildings( const CpntBuilding &       start,
 	ng::DynamicArray< Cell > path( 32 );
 	for ( u32 i = 0; i < startingCells.Size(); i++ ) {
 		for ( u32 j = 0; j < goalCells.Size(); j++ ) {
+			if ( !roadNetwork.AreCellsConnected( startingCells[ i ], goalCells[ j ] ) ) {
+				continue;
+			}
 			path.Clear();
 			u32  distance = 0;
 			bool subPathFound =
@@ -1008,8 +2125,8 @@ bool FindPathBetweenBuildings( const CpntBuilding &       start,
 
 bool FindPathFromCellToBuilding( Cell                       start,
                                  const CpntBuilding &       goal,
-                                 Map &                      map,
-                                 RoadNetwork &              roadNetwork,
+                                 const Map &                map,
+                                 const RoadNetwork &        roadNetwork,
                                  ng::DynamicArray< Cell > & outPath,
                                  u32                        maxDistance /*= ULONG_MAX*/,
                                  u32 *                      outDistance /*= nullptr */ ) {
@@ -1054,6 +2171,9 @@ bool FindPathFromCellToBuilding( Cell                       start,
 	bool pathFound = false;
 	u32  shortestDistance = maxDistance;
 	for ( u32 i = 0; i < goalCells.Size(); i++ ) {
+		if ( !roadNetwork.AreCellsConnected( start, goalCells[ i ] ) ) {
+			continue;
+		}
 		ng::DynamicArray< Cell > path;
 		u32                      distance = 0;
 		bool subPathFound = roadNetwork.FindPath( start, goalCells[ i ], map, path, &distance, shortestDistance );
@@ -1069,6 +2189,127 @@ bool FindPathFromCellToBuilding( Cell                       start,
 	return pathFound;
 }
 
+void GetRoadCellsAroundBuilding( const CpntBuilding & building, const Map & map, ng::DynamicArray< Cell > & outCells ) {
+	for ( Cell cell : building.AdjacentCells( map ) ) {
+		if ( map.GetTile( cell ) == MapTile::ROAD ) {
+			outCells.PushBack( cell );
+		}
+	}
+}
+
+bool FindPathToClosestBuilding( const ng::DynamicArray< Cell > &         startCells,
+                                const ng::DynamicArray< CpntBuilding > & goals,
+                                const Map &                              map,
+                                const RoadNetwork &                      roadNetwork,
+                                ng::DynamicArray< Cell > &               outPath,
+                                u32 &                                    outGoalIndex,
+                                u32                                      maxDistance /*= ULONG_MAX*/,
+                                u32 *                                    outDistance /*= nullptr */,
+                                const GatherGoals &                      gatherGoals /*= nullptr*/ ) {
+	ZoneScoped;
+
+	// Every road cell touching a goal points back to that goal
+	thread_local std::unordered_map< Cell, u32, CellHash > goalOfCell;
+	// Visited cells and where we came from, to rebuild the path
+	thread_local std::unordered_map< Cell, Cell, CellHash > cameFrom;
+	thread_local ng::DynamicArray< Cell >                   frontier( 64 );
+	thread_local ng::DynamicArray< CpntBuilding >           gatheredGoals;
+
+	goalOfCell.clear();
+	cameFrom.clear();
+	frontier.Clear();
+
+	for ( const Cell & start : startCells ) {
+		if ( map.IsTileWalkable( start ) && cameFrom.emplace( start, INVALID_CELL ).second ) {
+			frontier.PushBack( start );
+		}
+	}
+
+	// Don't bother walking the whole road if none of the goals are on it
+	u32  numStarts = frontier.Size();
+	u32  numGoals = 0;
+	bool anyGoalReachable = false;
+	auto addGoal = [ & ]( const CpntBuilding & goal ) {
+		for ( Cell cell : goal.AdjacentCells( map ) ) {
+			if ( map.GetTile( cell ) != MapTile::ROAD || !goalOfCell.emplace( cell, numGoals ).second ||
+			     anyGoalReachable ) {
+				continue;
+			}
+			for ( u32 i = 0; i < numStarts && !anyGoalReachable; i++ ) {
+				anyGoalReachable = roadNetwork.AreCellsConnected( frontier[ i ], cell );
+			}
+		}
+		numGoals++;
+	};
+	for ( const CpntBuilding & goal : goals ) {
+		addGoal( goal );
+	}
+	bool hasMoreGoals = gatherGoals != nullptr;
+	auto gather = [ & ]( u32 distance ) {
+		gatheredGoals.Clear();
+		hasMoreGoals = gatherGoals( distance, gatheredGoals );
+		for ( const CpntBuilding & goal : gatheredGoals ) {
+			addGoal( goal );
+		}
+	};
+
+	// All roads have the same cost, so a breadth first search visits cells in the same order as Dijkstra would
+	Cell reachedCell = INVALID_CELL;
+	u32  distance = 0;
+	u32  cursor = 0;
+	while ( cursor < frontier.Size() && distance < maxDistance && reachedCell == INVALID_CELL ) {
+		// Goals that could be this far are all in before the layer is visited
+		if ( hasMoreGoals ) {
+			gather( distance );
+		}
+		if ( !anyGoalReachable && !hasMoreGoals ) {
+			return false;
+		}
+		u32 layerEnd = frontier.Size();
+		for ( ; cursor < layerEnd; cursor++ ) {
+			Cell current = frontier[ cursor ];
+			if ( goalOfCell.contains( current ) ) {
+				reachedCell = current;
+				break;
+			}
+			ng::StaticArray< Cell, 4 > neighbors;
+			GetWalkableNeighborsOfCell( current, map, neighbors );
+			for ( const Cell & neighbor : neighbors ) {
+				if ( cameFrom.emplace( neighbor, current ).second ) {
+					frontier.PushBack( neighbor );
+				}
+			}
+		}
+		if ( reachedCell == INVALID_CELL ) {
+			distance++;
+		}
+	}
+	if ( reachedCell == INVALID_CELL ) {
+		return false;
+	}
+
+	// Same layout as RoadNetwork::FindPath: goal first, start last, and only the cells where we turn in between
+	outPath.Clear();
+	outPath.PushBack( reachedCell );
+	Cell previous = reachedCell;
+	Cell current = cameFrom[ reachedCell ];
+	while ( current != INVALID_CELL ) {
+		Cell next = cameFrom[ current ];
+		if ( next == INVALID_CELL ||
+		     GetDirectionFromCellTo( previous, current ) != GetDirectionFromCellTo( current, next ) ) {
+			outPath.PushBack( current );
+		}
+		previous = current;
+		current = next;
+	}
+
+	outGoalIndex = goalOfCell[ reachedCell ];
+	if ( outDistance != nullptr ) {
+		*outDistance = distance;
+	}
+	return true;
+}
+
 bool RoadNetwork::CheckNetworkIntegrity() {
 	// This is just a debug utility to find weird data inside road network
 	bool ok = true;
@@ -1105,6 +2346,10 @@ bool RoadNetwork::CheckNetworkIntegrity() {
 }
 
 RoadNetwork::Connection * RoadNetwork::Node::GetValidConnectionWithOffset( u32 offset ) {
+	return const_cast< Connection * >( static_cast< const Node * >( this )->GetValidConnectionWithOffset( offset ) );
+}
+
+const RoadNetwork::Connection * RoadNetwork::Node::GetValidConnectionWithOffset( u32 offset ) const {
 	ng_assert( offset < NumSetConnections() );
 	for ( size_t i = 0; i < 4; i++ ) {
 		if ( connections[ i ].IsValid() ) {
@@ -1139,8 +2384,8 @@ RoadNetwork::Connection * RoadNetwork::Node::FindConnectionWith( const Cell & ce
 	return nullptr;
 }
 
-RoadNetwork::Connection * RoadNetwork::Node::FindShortestConnectionWith( const Cell & cell ) {
-	Connection * res = nullptr;
+const RoadNetwork::Connection * RoadNetwork::Node::FindShortestConnectionWith( const Cell & cell ) const {
+	const Connection * res = nullptr;
 	for ( size_t i = 0; i < 4; i++ ) {
 		if ( connections[ i ].connectedTo == cell ) {
 			if ( res == nullptr ) {
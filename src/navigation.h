@@ -4,6 +4,11 @@
 #include "map.h"
 #include "ngLib/ngcontainers.h"
 #include "system.h"
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 struct CpntBuilding;
 
@@ -41,9 +46,10 @@ struct RoadNetwork {
 		Connection connections[ NUM_CARDINAL_DIRECTIONS ];
 
 		u32               NumSetConnections() const;
-		Connection *      GetValidConnectionWithOffset( u32 offset );
-		Connection *      FindConnectionWith( const Cell & cell );
-		Connection *      FindShortestConnectionWith( const Cell & cell );
+		Connection *       GetValidConnectionWithOffset( u32 offset );
+		const Connection * GetValidConnectionWithOffset( u32 offset ) const;
+		Connection *       FindConnectionWith( const Cell & cell );
+		const Connection * FindShortestConnectionWith( const Cell & cell ) const;
 		bool              HasMultipleConnectionsWith( const Cell & cell );
 		bool              IsConnectedToItself() const;
 		CardinalDirection GetDirectionOfConnection( const Connection * connection ) const;
@@ -51,64 +57,331 @@ struct RoadNetwork {
 
 	std::vector< Node > nodes;
 
-	Node * FindNodeWithPosition( Cell cell );
-	Node * ResolveConnection( Connection * connection );
-	bool   RemoveNodeByPosition( Cell cell );
-	void   AddRoadCellToNetwork( Cell cellToAdd, const Map & map );
-	void   RemoveRoadCellFromNetwork( Cell cellToRemove, const Map & map );
-	void   DissolveNode( Node & nodeToDissolve );
+	Node *       FindNodeWithPosition( Cell cell );
+	const Node * FindNodeWithPosition( Cell cell ) const;
+	Node *       ResolveConnection( Connection * connection );
+	const Node * ResolveConnection( const Connection * connection ) const;
+	bool         RemoveNodeByPosition( Cell cell );
+	void         AddRoadCellToNetwork( Cell cellToAdd, const Map & map );
+	void         RemoveRoadCellFromNetwork( Cell cellToRemove, const Map & map );
+	void         DissolveNode( Node & nodeToDissolve );
+
+	// Bulk edits, see Map::BeginEdit
+	// DetachRoadsAroundCells is called with the tiles from before the edit, it cuts every road going through the
+	// edited cells or their neighbors. ApplyCellEdits then walks those roads again with the new tiles
+	void DetachRoadsAroundCells( const ng::DynamicArray< Cell > & changedCells, const Map & map );
+	void ApplyCellEdits( const ng::DynamicArray< Cell > & removedCells,
+	                     const ng::DynamicArray< Cell > & addedCells,
+	                     const Map &                      map );
 
 	struct NodeSearchResult {
 		bool              found = false;
-		Node *            node = nullptr;
+		const Node *      node = nullptr;
 		CardinalDirection directionFromStart;
 		CardinalDirection directionFromEnd;
 		u32               distance;
 	};
-	void FindNearestRoadNodes( Cell cell, const Map & map, NodeSearchResult & first, NodeSearchResult & second );
+	void FindNearestRoadNodes( Cell cell, const Map & map, NodeSearchResult & first, NodeSearchResult & second ) const;
 
 	bool FindPath( Cell                       start,
 	               Cell                       goal,
 	               const Map &                map,
 	               ng::DynamicArray< Cell > & outPath,
 	               u32 *                      outTotalDistance = nullptr,
-	               u32                        maxDistance = ULONG_MAX );
+	               u32                        maxDistance = ULONG_MAX ) const;
 
 	bool CheckNetworkIntegrity();
+
+	// Connected components of the walkable cells, so we can tell in O(1) if two cells can reach each other
+	// Components are merged with a union-find when a cell is added. When a cell is removed, we flood from its
+	// neighbors at the same pace and give a new component to every side that gets isolated
+	static constexpr u32 INVALID_COMPONENT = ( u32 )-1;
+
+	std::unordered_map< Cell, u32, CellHash > cellComponents;
+	std::vector< u32 >                        componentParents;
+	std::vector< u8 >                         componentRanks;
+
+	u32  GetComponent( Cell cell ) const;
+	bool AreCellsConnected( Cell a, Cell b ) const;
+	u32  CreateComponent();
+	u32  FindComponentRoot( u32 component ) const;
+	u32  MergeComponents( u32 a, u32 b );
+	void AddCellToComponents( Cell cellToAdd, const Map & map );
+	void RemoveCellFromComponents( Cell cellToRemove, const Map & map );
+	void RemoveCellsFromComponents( const ng::DynamicArray< Cell > & cellsToRemove, const Map & map );
+};
+
+// Cells that can reach each other with AStar, diagonals included, share a region
+// Cells are labeled chunk by chunk and a query only labels again the chunks edited since the previous one. The regions
+// of each chunk are then joined to the ones they touch in the neighbor chunks. Chunks the map did not allocate are a
+// single region and store no label
+struct NavigableRegions {
+	static constexpr u32 NO_REGION = ( u32 )-1;
+
+	// NO_REGION on cells that can't be walked on
+	u32  GetRegion( Cell cell, const Map & map );
+	bool AreConnected( Cell a, Cell b, const Map & map );
+
+	u64 numChunksLabeled = 0;
+
+  private:
+	static constexpr u16 NO_LOCAL_REGION = ( u16 )-1;
+
+	// A region of a chunk touching a region of a neighbor chunk
+	struct Link {
+		u16 region;
+		u32 otherChunk;
+		u16 otherRegion;
+	};
+
+	struct ChunkRegions {
+		// Cell (lx, lz) is lx * 64 + lz, nullptr when the map chunk is not allocated
+		std::unique_ptr< u16[] > labels;
+		u16                      numRegions = 0;
+		u32                      firstRegion = 0;     // where the regions of the chunk start in parents
+		u64                      version = ( u64 )-1; // MapChunk::version it was labeled at
+		// To the chunks after this one along x or z
+		ng::DynamicArray< Link > links;
+	};
+
+	void Update( const Map & map );
+	void LabelChunk( u32 chunkIndex, const Map & map );
+	void LinkChunk( u32 chunkIndex, const Map & map );
+	u16  GetLocalRegion( Cell cell, const Map & map ) const;
+	u32  FindRoot( u32 region );
+
+	std::vector< ChunkRegions > chunks;
+	std::vector< u32 >          parents;
+	u64                         tileVersion = 0;
+	u32                         sizeX = 0;
+	u32                         sizeZ = 0;
+};
+
+// Cost to reach a building from the cells around it, shared by every agent walking to that building
+// Fields are built by the pathfinding workers on a snapshot of the map. The flood stops once it reached the cells it
+// was asked for, so a field only covers the area where agents actually walk
+struct FlowField {
+	Entity          destination = INVALID_ENTITY;
+	MovementAllowed movement = ROAD_NETWORK_AND_ROAD_BLOCK;
+	// Versions of the map the field was built on
+	u64 tileVersion = 0;
+	u64 roadVersion = 0;
+	// Highest cost in the field, every cell closer than that to the building is in it
+	u32 maxCost = 0;
+	// The flood ran out of cells, what is not in the field can't reach the building
+	bool                                      isComplete = false;
+	ng::DynamicArray< u32 >                   chunks; // map chunks the flood looked at
+	std::unordered_map< Cell, u32, CellHash > costs;
+
+	// Floods until every cell of cellsToReach is in the field and at least up to minCost
+	void Build( const CpntBuilding &             building,
+	            const Map &                      map,
+	            const ng::DynamicArray< Cell > & cellsToReach,
+	            u32                              minCost );
+	// Edits of the map outside of the chunks the flood looked at don't change the field
+	bool IsUpToDate( const Map & map ) const;
+	// Fields on roads are rebuilt on any change. A* fields are kept while cells only open up, a tree cut down next to
+	// the way does not make it any longer
+	bool NeedsRebuild( const Map & map ) const;
+	bool Reaches( Cell cell ) const { return costs.contains( cell ); }
+	bool IsDestination( Cell cell ) const;
+	bool GetNextCell( Cell from, const Map & map, Cell & outNext ) const;
+};
+
+struct FlowFieldCache {
+	static constexpr u32 MAX_FIELDS = 32;
+
+	struct Entry {
+		Entity                             destination = INVALID_ENTITY;
+		MovementAllowed                    movement = ROAD_NETWORK_AND_ROAD_BLOCK;
+		std::shared_ptr< const FlowField > field; // nullptr until the first build is done
+		u64                                lastUsed = 0;
+		bool                               isBuilding = false;
+		// Where the agents waiting for the next build stand, each cell once
+		ng::DynamicArray< Cell >             cellsToReach;
+		std::unordered_set< Cell, CellHash > queuedCells;
+
+		void QueueCell( Cell cell );
+	};
+	std::vector< Entry > entries;
+	u64                  useCounter = 0;
+
+	// Recycles the entry used the longest time ago when the cache is full
+	Entry & Get( Entity destination, MovementAllowed movement );
+	// Fields that come back after their entry was recycled are dropped
+	void Store( std::shared_ptr< const FlowField > field );
+	bool IsWaitingForBuilds() const;
 };
 
 struct CpntNavAgent {
 	CpntNavAgent() = default;
 	CpntNavAgent( const ng::DynamicArray< Cell > & steps ) : pathfindingNextSteps( steps ) {}
 
+	// Only the cells where the agent turns, it walks in a straight line between two of them
 	ng::DynamicArray< Cell > pathfindingNextSteps;
 	// speed is in cells per ticks
 	float movementSpeed = ConvertPerSecondToPerTick( 5.0f );
 	bool  deleteAtDestination = false;
+
+	// When set, the agent walks down the flow field of this building instead of following pathfindingNextSteps
+	Entity          flowFieldDestination = INVALID_ENTITY;
+	MovementAllowed flowFieldMovement = ROAD_NETWORK_AND_ROAD_BLOCK;
+	Cell            flowFieldNextCell = INVALID_CELL;
+};
+
+// Agents walking a path are packed here so they can be moved a chunk at a time
+// It is flushed every time it gets full, so it stays small enough to live in the cache
+struct NavAgentBatch {
+	static constexpr u32 MAX_AGENTS = 256;
+
+	Entity          entities[ MAX_AGENTS ];
+	CpntNavAgent *  agents[ MAX_AGENTS ];
+	CpntTransform * transforms[ MAX_AGENTS ];
+	float           posX[ MAX_AGENTS ];
+	float           posZ[ MAX_AGENTS ];
+	float           targetX[ MAX_AGENTS ];
+	float           targetZ[ MAX_AGENTS ];
+	// Distance left to walk this tick
+	float step[ MAX_AGENTS ];
+	u32   count = 0;
+
+	bool IsFull() const { return count == MAX_AGENTS; }
+	void Add( Entity e, CpntNavAgent & agent, CpntTransform & transform, float distance );
+	void MoveLane( u32 from, u32 to );
 };
 
 struct SystemNavAgent : public System< CpntNavAgent > {
 	virtual void Update( Registery & reg, Duration ticks ) override;
+	virtual void DebugDraw() override;
+
+	// Returns false if the destination is gone
+	// Agents stand still until the field reaches them, and are deleted if it turns out it never will
+	bool FollowFlowField( Registery & reg, Entity e, Entity destination, MovementAllowed movement );
+	void MoveBatch();
+	void MoveAlongFlowField( Registery & reg, Entity e, CpntNavAgent & agent, CpntTransform & transform, Duration ticks );
+	// Hands the fields agents are waiting for to the pathfinding workers
+	void RequestFlowFields( Registery & reg );
+
+	FlowFieldCache             flowFields;
+	NavAgentBatch              batch;
+	ng::DynamicArray< Entity > arrivedAgents;
 };
 
+// Moves every agent toward its target on the XZ plane by at most step
+// step is then decreased by the distance to the target: when it is positive or zero, the agent stands on its target
+// and what is left is how much it can still walk this tick
+void MoveAgentsTowardTargets(
+    float * posX, float * posZ, const float * targetX, const float * targetZ, float * step, u32 count );
+
 bool FindPathBetweenBuildings( const CpntBuilding &       start,
                                const CpntBuilding &       goal,
-                               Map &                      map,
-                               RoadNetwork &              roadNetwork,
+                               const Map &                map,
+                               const RoadNetwork &        roadNetwork,
                                ng::DynamicArray< Cell > & outPath,
                                u32                        maxDistance = ULONG_MAX,
                                u32 *                      outDistance = nullptr );
 bool FindPathFromCellToBuilding( Cell                       start,
                                  const CpntBuilding &       goal,
-                                 Map &                      map,
-                                 RoadNetwork &              roadNetwork,
+                                 const Map &                map,
+                                 const RoadNetwork &        roadNetwork,
                                  ng::DynamicArray< Cell > & outPath,
                                  u32                        maxDistance = ULONG_MAX,
                                  u32 *                      outDistance = nullptr );
-bool CreateWandererRoutine(
-    const Cell & start, Map & map, RoadNetwork & roadNetwork, ng::DynamicArray< Cell > & outPath, u32 maxDistance );
+// Hands more goals to a search that got as far as distance, goals further than that can be kept for later
+// Returns false once there is nothing left to give
+using GatherGoals = std::function< bool( u32 distance, ng::DynamicArray< CpntBuilding > & outGoals ) >;
+// Single breadth-first search over the road network starting from every start cell at once
+// It stops on the first road adjacent to one of the goals, outGoalIndex tells which one was reached. Goals handed by
+// gatherGoals come after the ones of goals, in the order they were handed
+bool FindPathToClosestBuilding( const ng::DynamicArray< Cell > &         startCells,
+                                const ng::DynamicArray< CpntBuilding > & goals,
+                                const Map &                              map,
+                                const RoadNetwork &                      roadNetwork,
+                                ng::DynamicArray< Cell > &               outPath,
+                                u32 &                                    outGoalIndex,
+                                u32                                      maxDistance = ULONG_MAX,
+                                u32 *                                    outDistance = nullptr,
+                                const GatherGoals &                      gatherGoals = nullptr );
+bool CreateWandererRoutine( const Cell &               start,
+                            const Map &                map,
+                            const RoadNetwork &        roadNetwork,
+                            ng::DynamicArray< Cell > & outPath,
+                            u32                        maxDistance );
+
+// One node of the A* searches, on the map grid or on the road network
+struct AStarStep {
+	Cell                      coord;
+	const RoadNetwork::Node * node = nullptr;
+	AStarStep *               parent = nullptr;
+	int                       f, g, h;
+
+	bool operator==( const AStarStep & rhs ) const { return coord == rhs.coord; }
+	bool operator<( const AStarStep & rhs ) const { return coord < rhs.coord; }
+
+	bool operator==( const Cell & rhs ) const { return coord == rhs; }
+	bool operator<( const Cell & rhs ) const { return coord < rhs; }
+	bool operator>( const Cell & rhs ) const { return !( coord < rhs || coord == rhs ); }
+};
+
+// Searches that can run a few expansions at a time and be picked up later, from any thread
+// The pathfinding workers share a budget of expansions per tick and park the searches that go over it
+struct ResumableSearch {
+	enum class Status {
+		RUNNING,
+		FOUND,
+		NOT_FOUND,
+	};
+	virtual ~ResumableSearch() = default;
+
+	// Expands at most maxExpansions nodes
+	virtual Status Step( const Map & map, u32 maxExpansions ) = 0;
+	// Once FOUND, same layout as AStar: every cell, from the goal to the start
+	virtual void BuildPath( ng::DynamicArray< Cell > & outPath ) const = 0;
+	// While RUNNING, path to the explored cell that looks the closest to the goal
+	// Returns false when the search has no idea of where its goal is
+	virtual bool BuildBestPartialPath( ng::DynamicArray< Cell > & /*outPath*/ ) const { return false; }
+
+	Status status = Status::RUNNING;
+	u64    numExpansions = 0;
+};
+
+struct AStarSearch : public ResumableSearch {
+	void           Start( Cell start, Cell goal, MovementAllowed movement, const Map & map );
+	virtual Status Step( const Map & map, u32 maxExpansions ) override;
+	virtual void   BuildPath( ng::DynamicArray< Cell > & outPath ) const override;
+	virtual bool   BuildBestPartialPath( ng::DynamicArray< Cell > & outPath ) const override;
+
+  private:
+	AStarStep * AllocateStep();
+
+	Cell            goal = INVALID_CELL;
+	MovementAllowed movement = ASTAR_FORBID_DIAGONALS;
+	// Both sorted by cell
+	std::vector< AStarStep * > openSet;
+	std::vector< AStarStep * > closedSet;
+	AStarStep *                current = nullptr;
+	AStarStep *                closest = nullptr; // expanded step with the lowest heuristic
+	// Steps belong to the search so that it can move between threads, blocks are kept when it is started again
+	static constexpr u32                          STEPS_PER_BLOCK = 256;
+	std::vector< std::unique_ptr< AStarStep[] > > stepBlocks;
+	u32                                           numSteps = 0;
+};
+
+// Work done by the searches of the current thread, the benchmarks read them
+struct PathfindingCounters {
+	u64 nodesExpanded = 0;
+	u64 bytesUsed = 0; // search steps taken from the pools, given back when the search is over
+};
+extern thread_local PathfindingCounters pathfindingCounters;
 
 bool      AStar( Cell start, Cell goal, MovementAllowed movement, const Map & map, ng::DynamicArray< Cell > & outPath );
+// Removes the cells in the middle of straight lines (diagonals included) and trims the buffer
+void      CompressPath( ng::DynamicArray< Cell > & path );
+// nextSteps is what is left of partialPath for an agent that started walking it. The agent walks back the waypoints it
+// went through until one of them is on finalPath, and follows finalPath from there
+void      SwapInFinalPath( const ng::DynamicArray< Cell > & partialPath,
+                           const ng::DynamicArray< Cell > & finalPath,
+                           ng::DynamicArray< Cell > &       nextSteps );
 void      GetNeighborsOfCell( Cell base, const Map & map, ng::StaticArray< Cell, 4 > & neighbors );
 glm::vec3 GetPointInMiddleOfCell( Cell cell );
 glm::vec3 GetPointInCornerOfCell( Cell cell );
@@ -117,5 +390,6 @@ Cell      GetCellForTransform( const CpntTransform & transform );
 Cell      GetCellAfterMovement( Cell start, int movementX, int movementZ );
 Cell      GetCellAfterMovement( Cell start, CardinalDirection direction );
 Cell      GetAnyRoadConnectedToBuilding( const CpntBuilding & building, const Map & map );
+void      GetRoadCellsAroundBuilding( const CpntBuilding & building, const Map & map, ng::DynamicArray< Cell > & outCells );
 CardinalDirection GetDirectionFromCellTo( Cell from, Cell to );
 CardinalDirection OppositeDirection( CardinalDirection direction );
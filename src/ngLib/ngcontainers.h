@@ -3,6 +3,7 @@
 #include "ngLib/types.h"
 #include "nglib.h"
 #include <bitset>
+#include <utility>
 
 namespace ng {
 template < typename T > struct DynamicArray {
@@ -46,6 +47,22 @@ template < typename T > struct DynamicArray {
 		return *this;
 	}
 
+	// Moving hands over the buffer, src is left empty
+	DynamicArray( DynamicArray< T > && src ) noexcept { *this = std::move( src ); }
+
+	DynamicArray< T > & operator=( DynamicArray< T > && rhs ) noexcept {
+		if ( this != &rhs ) {
+			delete[] data;
+			data = rhs.data;
+			capacity = rhs.capacity;
+			count = rhs.count;
+			rhs.data = nullptr;
+			rhs.capacity = 0;
+			rhs.count = 0;
+		}
+		return *this;
+	}
+
 	~DynamicArray() { delete[] data; }
 
 	void Grow() {
@@ -79,8 +96,11 @@ template < typename T > struct DynamicArray {
 	}
 
 	void Shrink() {
-		capacity = this->size;
-		T * temp = new T[ capacity ];
+		if ( count == capacity ) {
+			return;
+		}
+		capacity = count;
+		T * temp = capacity > 0 ? new T[ capacity ] : nullptr;
 
 		for ( u32 i = 0; i < count; i++ ) {
 			temp[ i ] = data[ i ];
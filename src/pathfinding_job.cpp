@@ -1,218 +1,626 @@
 #include "pathfinding_job.h"
 #include "game.h"
+#include <algorithm>
+#include <cfloat>
 
 constexpr bool movementIsAStar( MovementAllowed movement ) {
 	return ( movement == ASTAR_ALLOW_DIAGONALS || movement == ASTAR_FORBID_DIAGONALS );
 }
 
-Entity SystemPathfinding::CopyPath( pathfindingID id, ng::DynamicArray< Cell > & out ) {
-	Entity targetEntity = INVALID_ENTITY;
-	entriesMutex.lock();
-	for ( const Entry & entry : entries ) {
-		if ( entry.id == id ) {
-			out.Append( entry.path );
-			targetEntity = entry.targetEntity;
+size_t PathCache::KeyHash::operator()( const Key & key ) const {
+	u64 hash = 14695981039346656037ull;
+	auto mix = [ &hash ]( u64 value ) { hash = ( hash ^ value ) * 1099511628211ull; };
+	mix( ( u64 )key.type );
+	mix( ( u64 )key.movement );
+	mix( ( ( u64 )key.start.x << 32 ) | key.start.z );
+	mix( ( ( u64 )key.goal.x << 32 ) | key.goal.z );
+	mix( ( ( u64 )key.startSizeX << 32 ) | key.startSizeZ );
+	mix( ( ( u64 )key.goalSizeX << 32 ) | key.goalSizeZ );
+	return hash;
+}
+
+bool PathCache::MakeKey( const PathfindingTask & task, Key & outKey ) {
+	outKey = Key{ task.type, task.movementAllowed, INVALID_CELL, INVALID_CELL };
+	switch ( task.type ) {
+	case PathfindingTask::Type::FROM_CELL_TO_CELL:
+		outKey.start = task.start.cell;
+		outKey.goal = task.goal.cell;
+		return true;
+	case PathfindingTask::Type::FROM_CELL_TO_BUILDING:
+		outKey.start = task.start.cell;
+		outKey.goal = task.goal.building.cell;
+		outKey.goalSizeX = task.goal.building.tileSizeX;
+		outKey.goalSizeZ = task.goal.building.tileSizeZ;
+		return true;
+	default:
+		// Storage lookups depend on what is in the inventories, not only on the map
+		return false;
+	}
+}
+
+u64 PathCache::MapVersionFor( MovementAllowed movement, const Map & map ) {
+	return movementIsAStar( movement ) ? map.tileVersion : map.roadVersion;
+}
+
+bool PathCache::IsUpToDate( const CachedPath & entry, const Map & map ) {
+	if ( entry.chunks.Empty() ) {
+		return entry.mapVersion == MapVersionFor( entry.key.movement, map );
+	}
+	u32 numChunks = map.GetNumChunksX() * map.GetNumChunksZ();
+	for ( u32 chunkIndex : entry.chunks ) {
+		if ( chunkIndex >= numChunks || map.GetChunk( chunkIndex ).closedVersion > entry.mapVersion ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void PathCache::ListCrossedChunks( const ng::DynamicArray< Cell > & path,
+                                   const Map &                      map,
+                                   ng::DynamicArray< u32 > &        out ) {
+	for ( u32 i = 0; i < path.Size(); i++ ) {
+		Cell cell = path[ i ];
+		out.PushBack( map.GetChunkIndex( cell ) );
+		if ( i + 1 == path.Size() ) {
 			break;
 		}
+		// Waypoints are joined by straight lines of single steps
+		Cell  next = path[ i + 1 ];
+		int64 stepX = ( next.x > cell.x ) - ( next.x < cell.x );
+		int64 stepZ = ( next.z > cell.z ) - ( next.z < cell.z );
+		while ( cell != next ) {
+			if ( stepX != 0 && stepZ != 0 ) {
+				out.PushBack( map.GetChunkIndex( Cell( cell.x + stepX, cell.z ) ) );
+				out.PushBack( map.GetChunkIndex( Cell( cell.x, cell.z + stepZ ) ) );
+			}
+			cell = Cell( cell.x + stepX, cell.z + stepZ );
+			out.PushBack( map.GetChunkIndex( cell ) );
+		}
 	}
-	entriesMutex.unlock();
-	return targetEntity;
+	std::sort( out.begin(), out.end() );
+	u32 * end = std::unique( out.begin(), out.end() );
+	while ( out.end() != end ) {
+		out.PopBack();
+	}
+	out.Shrink();
 }
 
-Entity SystemPathfinding::CopyAndDeletePath( pathfindingID id, ng::DynamicArray< Cell > & out ) {
-	Entity targetEntity = CopyPath( id, out );
-	deleteQueue.enqueue( id );
+const PathCache::CachedPath * PathCache::Find( const Key & key, const Map & map ) {
+	auto it = lookup.find( key );
+	if ( it == lookup.end() ) {
+		misses++;
+		return nullptr;
+	}
+	if ( !IsUpToDate( *it->second, map ) ) {
+		// The map changed since, this entry is of no use anymore
+		Remove( it->second );
+		misses++;
+		return nullptr;
+	}
+	lru.splice( lru.begin(), lru, it->second );
+	hits++;
+	return &lru.front();
+}
+
+void PathCache::Store( const Key & key, const Map & map, bool found, const ng::DynamicArray< Cell > & path ) {
+	auto existing = lookup.find( key );
+	if ( existing != lookup.end() ) {
+		Remove( existing->second );
+	}
+	if ( lru.size() >= MAX_ENTRIES ) {
+		Remove( std::prev( lru.end() ) );
+	}
+	lru.push_front( CachedPath{ key, MapVersionFor( key.movement, map ), found } );
+	CachedPath & entry = lru.front();
+	entry.path.Append( path );
+	if ( found && movementIsAStar( key.movement ) ) {
+		ListCrossedChunks( path, map, entry.chunks );
+	}
+	lookup[ key ] = lru.begin();
+	numEntries++;
+	memoryUsage += sizeof( CachedPath ) + entry.path.Capacity() * sizeof( Cell ) +
+	               entry.chunks.Capacity() * sizeof( u32 );
+}
+
+void PathCache::Remove( std::list< CachedPath >::iterator it ) {
+	numEntries--;
+	memoryUsage -= sizeof( CachedPath ) + it->path.Capacity() * sizeof( Cell ) + it->chunks.Capacity() * sizeof( u32 );
+	lookup.erase( it->key );
+	lru.erase( it );
+}
+
+SystemPathfinding::ResultSlot * SystemPathfinding::FindReadySlot( pathfindingID id ) {
+	if ( id == INVALID_PATHFINDING_ID ) {
+		return nullptr;
+	}
+	ResultSlot & slot = slots[ id & SLOT_INDEX_MASK ];
+	if ( slot.generation.load( std::memory_order_relaxed ) != id >> SLOT_INDEX_BITS ||
+	     !slot.isReady.load( std::memory_order_acquire ) ) {
+		return nullptr;
+	}
+	return &slot;
+}
+
+pathfindingID SystemPathfinding::PublishSlot( u32 index, Entity requester ) {
+	ResultSlot & slot = slots[ index ];
+	slot.requester = requester;
+	slot.isReady.store( true, std::memory_order_release );
+	return ( slot.generation.load( std::memory_order_relaxed ) << SLOT_INDEX_BITS ) | index;
+}
+
+void SystemPathfinding::ReleaseSlot( u32 index ) {
+	ResultSlot & slot = slots[ index ];
+	slot.isReady.store( false, std::memory_order_relaxed );
+	slot.generation.store( ( slot.generation.load( std::memory_order_relaxed ) + 1 ) % MAX_GENERATION,
+	                       std::memory_order_relaxed );
+	slot.path.Clear();
+	slot.targetEntity = INVALID_ENTITY;
+	slot.requester = INVALID_ENTITY;
+	slot.readySince = -1;
+	freeSlots.enqueue( index );
+}
+
+Entity SystemPathfinding::TakePath( pathfindingID id, ng::DynamicArray< Cell > & out ) {
+	ResultSlot * slot = FindReadySlot( id );
+	ng_assert_msg( slot != nullptr, "path %u was already taken or deleted\n", id );
+	if ( slot == nullptr ) {
+		return INVALID_ENTITY;
+	}
+	out = std::move( slot->path );
+	Entity targetEntity = slot->targetEntity;
+	ReleaseSlot( id & SLOT_INDEX_MASK );
 	return targetEntity;
 }
 
-static bool FindPathToCellType(
-    Cell start, MapTile type, MovementAllowed movementAllowed, const Map & map, ng::DynamicArray< Cell > & path ) {
-	ng_assert( movementIsAStar( movementAllowed ) );
-	// This is the only case where we will not be looking for the shortest path, but the closest destination
+void SystemPathfinding::DeletePath( pathfindingID id ) {
+	if ( FindReadySlot( id ) != nullptr ) {
+		ReleaseSlot( id & SLOT_INDEX_MASK );
+	}
+}
+
+void SystemPathfinding::ReclaimUnclaimedSlots( TimePoint clock ) {
+	ZoneScoped;
+
+	for ( u32 index = 0; index < NUM_RESULT_SLOTS; index++ ) {
+		ResultSlot & slot = slots[ index ];
+		if ( !slot.isReady.load( std::memory_order_acquire ) ) {
+			continue;
+		}
+		if ( slot.readySince < 0 ) {
+			slot.readySince = clock;
+		}
+		if ( deletedRequesters.contains( slot.requester ) || clock - slot.readySince > UNCLAIMED_SLOT_TIMEOUT ) {
+			ReleaseSlot( index );
+			numReclaimedSlots++;
+		}
+	}
+	deletedRequesters.clear();
+}
+
+void SystemPathfinding::PublishSnapshot( const LogisticsIndex & logistics,
+                                         const Map &            map,
+                                         const RoadNetwork &    roadNetwork,
+                                         TimePoint              clock ) {
+	ZoneScoped;
+
+	std::shared_ptr< const WorldSnapshot > previous = GetSnapshot();
+	auto                                   next = std::make_shared< WorldSnapshot >();
+	next->clock = clock;
+	bool sameSize = previous != nullptr && previous->map->sizeX == map.sizeX && previous->map->sizeZ == map.sizeZ;
+	if ( sameSize && previous->map->tileVersion == map.tileVersion ) {
+		next->map = previous->map;
+	} else {
+		next->map = std::make_shared< const Map >( map );
+		numMapCopies++;
+	}
+	if ( sameSize && previous->roadVersion == map.roadVersion ) {
+		next->roadNetwork = previous->roadNetwork;
+	} else {
+		next->roadNetwork = std::make_shared< const RoadNetwork >( roadNetwork );
+		numRoadNetworkCopies++;
+	}
+	next->roadVersion = map.roadVersion;
+	if ( previous != nullptr && previous->logisticsVersion == logistics.version ) {
+		next->storages = previous->storages;
+	} else {
+		auto storages = std::make_shared< ng::DynamicArray< WorldSnapshot::Storage > >();
+		for ( const auto & [ e, storage ] : logistics.storages ) {
+			storages->PushBack( WorldSnapshot::Storage{ e, storage.building, storage.inventory } );
+		}
+		next->storages = std::move( storages );
+		numStorageCopies++;
+	}
+	next->logisticsVersion = logistics.version;
+	// Workers still holding the previous snapshot keep it alive until they are done with it
+	snapshot.store( std::move( next ) );
+}
+
+void SystemPathfinding::Update( Registery & reg, Duration ticks ) {
+	PublishSnapshot( theGame->logistics, theGame->map, theGame->roadNetwork, theGame->clock );
+	ReclaimUnclaimedSlots( theGame->clock );
+	expansionBudget.store( EXPANSION_BUDGET_PER_TICK );
+}
+
+u32 SystemPathfinding::GetNumWorkers() {
+	// Leave some room for the main thread and the renderer
+	u32 numThreads = std::thread::hardware_concurrency();
+	return std::clamp( numThreads > 2 ? numThreads - 2 : 1u, 1u, 4u );
+}
+
+u32 SystemPathfinding::GetHistogramBucket( std::chrono::steady_clock::duration duration ) {
+	u64 us = ( u64 )std::chrono::duration_cast< std::chrono::microseconds >( duration ).count();
+	u32 bucket = 0;
+	while ( us > 1 && bucket < NUM_HISTOGRAM_BUCKETS - 1 ) {
+		us >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+PathfindingTask::Priority SystemPathfinding::GetDefaultPriority( const PathfindingTask & task ) {
+	switch ( task.type ) {
+	case PathfindingTask::Type::FROM_CELL_TO_CELL:
+	case PathfindingTask::Type::FROM_CELL_TO_BUILDING:
+	case PathfindingTask::Type::FROM_BUILDING_TO_BUILDING:
+	case PathfindingTask::Type::FROM_BUILDING_TO_CELL:
+		return movementIsAStar( task.movementAllowed ) ? PathfindingTask::Priority::NORMAL
+		                                               : PathfindingTask::Priority::HIGH;
+	default:
+		return PathfindingTask::Priority::NORMAL;
+	}
+}
+
+bool SystemPathfinding::DequeueMostUrgentTask( QueuedTask & outTask, SuspendedSearch * outSearch /*= nullptr*/ ) {
+	for ( u32 priority = ( u32 )PathfindingTask::Priority::HIGH; priority < ( u32 )PathfindingTask::Priority::COUNT;
+	      priority++ ) {
+		if ( outSearch != nullptr && suspendedSearches[ priority ].try_dequeue( *outSearch ) ) {
+			return true;
+		}
+		if ( taskQueues[ priority ].try_dequeue( outTask ) ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SystemPathfinding::IsTaskCancelled( Entity requester ) {
+	std::lock_guard< std::mutex > lock( pendingMutex );
+	auto                          it = pendingTasks.find( requester );
+	return it != pendingTasks.end() && it->second.cancelled;
+}
+
+bool SystemPathfinding::ReleasePendingTask( Entity requester ) {
+	std::lock_guard< std::mutex > lock( pendingMutex );
+	auto                          it = pendingTasks.find( requester );
+	if ( it == pendingTasks.end() ) {
+		return false;
+	}
+	bool cancelled = it->second.cancelled;
+	if ( --it->second.count == 0 ) {
+		pendingTasks.erase( it );
+	}
+	return cancelled;
+}
+
+bool SystemPathfinding::SolveTask( const PathfindingTask & task, const WorldSnapshot & world, ResultSlot & result ) {
+	const Map &         map = *world.map;
+	const RoadNetwork & roadNetwork = *world.roadNetwork;
+
 	bool pathFound = false;
-	u32  maxDistance = std::max( {
-        start.x,
-        map.sizeX - start.x,
-        start.z,
-        map.sizeZ - start.z,
-    } );
-	for ( int64 r = 1; r <= maxDistance && !pathFound; r++ ) {
-		int64 x = start.x;
-		int64 y = start.z;
-		for ( int64 j = y - r; j <= y + r; j++ ) {
-			for ( int64 i = x; ( ( i - x ) * ( i - x ) + ( j - y ) * ( j - y ) ) <= ( r * r ); i-- ) {
-				if ( ABS( y - j ) + ABS( x - i ) == r ) {
-					// in the circle
-					if ( map.IsValidTile( i, j ) && map.GetTile( i, j ) == type ) {
-						if ( map.IsTileAStarNavigable( type ) ) {
-							// If the tile type we look for is accessible, we try to go exactly there
-							path.Clear();
-							pathFound = AStar( start, Cell( i, j ), movementAllowed, theGame->map, path );
-							if ( pathFound )
-								goto FIND_PATH_TO_CELL_TYPE_DONE;
-						} else {
-							// Otherwise, we try to reach a neighbor
-							ng::StaticArray< Cell, 4 > neighbors;
-							GetNeighborsOfCell( Cell( i, j ), map, neighbors );
-							for ( Cell & neighbor : neighbors ) {
-								path.Clear();
-								pathFound = AStar( start, neighbor, movementAllowed, theGame->map, path );
-								if ( pathFound )
-									goto FIND_PATH_TO_CELL_TYPE_DONE;
-							}
-						}
-					}
+	if ( task.type == PathfindingTask::Type::FROM_CELL_TO_CELL ) {
+		pathFound = roadNetwork.FindPath( task.start.cell, task.goal.cell, map, result.path );
+	} else if ( task.type == PathfindingTask::Type::FROM_CELL_TO_BUILDING ) {
+		if ( movementIsAStar( task.movementAllowed ) ) {
+			for ( Cell cell : task.goal.building.AdjacentCells( map ) ) {
+				result.path.Clear();
+				pathFound = AStar( task.start.cell, cell, task.movementAllowed, map, result.path );
+				if ( pathFound ) {
+					break;
 				}
 			}
-			for ( int64 i = x + 1; ( i - x ) * ( i - x ) + ( j - y ) * ( j - y ) <= r * r; i++ ) {
-				if ( ABS( y - j ) + ABS( x - i ) == r ) {
-					// in the circle
-					if ( map.IsValidTile( i, j ) && map.GetTile( i, j ) == type ) {
-						if ( map.IsTileAStarNavigable( type ) ) {
-							// If the tile type we look for is accessible, we try to go exactly there
-							path.Clear();
-							pathFound = AStar( start, Cell( i, j ), movementAllowed, theGame->map, path );
-							if ( pathFound )
-								goto FIND_PATH_TO_CELL_TYPE_DONE;
-						} else {
-							// Otherwise, we try to reach a neighbor
-							ng::StaticArray< Cell, 4 > neighbors;
-							GetNeighborsOfCell( Cell( i, j ), map, neighbors );
-							for ( Cell & neighbor : neighbors ) {
-								path.Clear();
-								pathFound = AStar( start, neighbor, movementAllowed, theGame->map, path );
-								if ( pathFound )
-									goto FIND_PATH_TO_CELL_TYPE_DONE;
-							}
-						}
-					}
-				}
+		} else {
+			pathFound =
+			    FindPathFromCellToBuilding( task.start.cell, task.goal.building, map, roadNetwork, result.path );
+		}
+	} else if ( task.type == PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_CAPACITY ||
+	            task.type == PathfindingTask::Type::FROM_BUILDING_TO_RESOURCE_STORAGE_WITH_CAPACITY ||
+	            task.type == PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_STOCK ||
+	            task.type == PathfindingTask::Type::FROM_BUILDING_TO_RESOURCE_STORAGE_WITH_STOCK ) {
+		ng_assert_msg( task.movementAllowed == ROAD_NETWORK_AND_ROAD_BLOCK, "other methods are not handled yet" );
+
+		bool lookForCapacity = task.type == PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_CAPACITY ||
+		                       task.type == PathfindingTask::Type::FROM_BUILDING_TO_RESOURCE_STORAGE_WITH_CAPACITY;
+		ng::DynamicArray< Cell > startCells;
+		if ( task.type == PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_CAPACITY ||
+		     task.type == PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_STOCK ) {
+			startCells.PushBack( task.start.cell );
+		} else {
+			GetRoadCellsAroundBuilding( task.start.building, map, startCells );
+		}
+
+		ng::DynamicArray< CpntBuilding > goals;
+		ng::DynamicArray< Entity >       goalEntities;
+		for ( const WorldSnapshot::Storage & candidate : *world.storages ) {
+			bool isValid = lookForCapacity ? candidate.inventory.GetResourceCapacity( task.goal.resourceType ) > 0
+			                               : candidate.inventory.GetResourceAmount( task.goal.resourceType ) > 0;
+			if ( isValid ) {
+				goals.PushBack( candidate.building );
+				goalEntities.PushBack( candidate.entity );
 			}
 		}
+		u32 goalIndex = 0;
+		if ( FindPathToClosestBuilding( startCells, goals, map, roadNetwork, result.path, goalIndex ) ) {
+			result.targetEntity = goalEntities[ goalIndex ];
+		}
+		pathFound = result.targetEntity != INVALID_ENTITY;
+	} else {
+		ng_assert( false );
 	}
-FIND_PATH_TO_CELL_TYPE_DONE:
+	if ( pathFound ) {
+		CompressPath( result.path );
+	}
+	StorePath( task, map, pathFound, result.path );
 	return pathFound;
 }
 
-void SystemPathfinding::ParallelJob() {
-	pathfindingID pathToDelete;
-	while ( deleteQueue.try_dequeue( pathToDelete ) ) {
-		entriesMutex.lock();
-		for ( auto node = entries.head; node != nullptr; node = node->next ) {
-			if ( node->data.id == pathToDelete ) {
-				entries.DeleteNode( node );
-				break;
-			}
+bool SystemPathfinding::FindCachedPath( const PathfindingTask & task,
+                                        const Map &             map,
+                                        ResultSlot &            result,
+                                        bool &                  outPathFound ) {
+	PathCache::Key cacheKey;
+	if ( !PathCache::MakeKey( task, cacheKey ) ) {
+		return false;
+	}
+	std::lock_guard< std::mutex > lock( cacheMutex );
+	const PathCache::CachedPath * cached = cache.Find( cacheKey, map );
+	if ( cached == nullptr ) {
+		return false;
+	}
+	result.path.Append( cached->path );
+	outPathFound = cached->found;
+	return true;
+}
+
+void SystemPathfinding::StorePath( const PathfindingTask &          task,
+                                   const Map &                      map,
+                                   bool                             pathFound,
+                                   const ng::DynamicArray< Cell > & path ) {
+	PathCache::Key cacheKey;
+	if ( PathCache::MakeKey( task, cacheKey ) ) {
+		std::lock_guard< std::mutex > lock( cacheMutex );
+		cache.Store( cacheKey, map, pathFound, path );
+	}
+}
+
+std::unique_ptr< ResumableSearch > SystemPathfinding::StartSearch( const PathfindingTask & task, const Map & map ) {
+	if ( task.type == PathfindingTask::Type::FROM_CELL_TO_CELL && movementIsAStar( task.movementAllowed ) ) {
+		auto search = std::make_unique< AStarSearch >();
+		search->Start( task.start.cell, task.goal.cell, task.movementAllowed, map );
+		return search;
+	}
+	return nullptr;
+}
+
+bool SystemPathfinding::RunSearchSlice( SuspendedSearch & suspended ) {
+	const PathfindingTask & task = suspended.queued.task;
+	u32                     priority = ( u32 )task.priority;
+	if ( expansionBudget.fetch_sub( SEARCH_SLICE ) <= 0 ) {
+		expansionBudget += SEARCH_SLICE;
+		suspendedSearches[ priority ].enqueue( std::move( suspended ) );
+		return false;
+	}
+
+	const Map &             map = *suspended.world->map;
+	u64                     expansionsBefore = suspended.search->numExpansions;
+	auto                    startTime = std::chrono::steady_clock::now();
+	ResumableSearch::Status status = suspended.search->Step( map, SEARCH_SLICE );
+	suspended.solveTime += std::chrono::steady_clock::now() - startTime;
+	// Give back what the slice did not use
+	expansionBudget += SEARCH_SLICE - ( int64 )( suspended.search->numExpansions - expansionsBefore );
+	numSlicesRun++;
+
+	ResultSlot & result = slots[ suspended.slotIndex ];
+	if ( status != ResumableSearch::Status::RUNNING ) {
+		bool pathFound = status == ResumableSearch::Status::FOUND;
+		if ( pathFound ) {
+			suspended.search->BuildPath( result.path );
+			CompressPath( result.path );
 		}
-		entriesMutex.unlock();
+		StorePath( task, map, pathFound, result.path );
+		FinishTask( task, suspended.slotIndex, pathFound, suspended.solveTime );
+		return true;
 	}
 
-	static pathfindingID nextID = 0;
-	PathfindingTask      task;
-	while ( taskQueue.try_dequeue( task ) ) {
-		entriesMutex.lock();
-		Entry & entry = entries.Alloc();
-		entry.id = nextID++;
-		entriesMutex.unlock();
-		bool pathFound = false;
-		if ( task.type == PathfindingTask::Type::FROM_CELL_TO_CELL ) {
-			if ( movementIsAStar( task.movementAllowed ) ) {
-				pathFound = AStar( task.start.cell, task.goal.cell, task.movementAllowed, theGame->map, entry.path );
-			} else {
-				pathFound = theGame->roadNetwork.FindPath( task.start.cell, task.goal.cell, theGame->map, entry.path );
-			}
-		} else if ( task.type == PathfindingTask::Type::FROM_CELL_TO_BUILDING ) {
-			if ( movementIsAStar( task.movementAllowed ) ) {
-				for ( Cell cell : task.goal.building.AdjacentCells( theGame->map ) ) {
-					entry.path.Clear();
-					pathFound = AStar( task.start.cell, cell, task.movementAllowed, theGame->map, entry.path );
-					if ( pathFound ) {
-						break;
-					}
-				}
+	if ( IsTaskCancelled( task.requester ) ) {
+		ReleasePendingTask( task.requester );
+		ReleaseSlot( suspended.slotIndex );
+		numCancelledTasks++;
+		return true;
+	}
+	if ( task.acceptPartialPath && !suspended.partialPathSent ) {
+		suspended.partialPathSent = true;
+		u32 partialSlotIndex = 0;
+		if ( freeSlots.try_dequeue( partialSlotIndex ) ) {
+			ResultSlot & partial = slots[ partialSlotIndex ];
+			if ( suspended.search->BuildBestPartialPath( partial.path ) ) {
+				CompressPath( partial.path );
+				PathfindingTaskResponse response{ true, PublishSlot( partialSlotIndex, task.requester ), true };
+				PostMsg< PathfindingTaskResponse >( MESSAGE_PATHFINDING_RESPONSE, response, task.requester,
+				                                    INVALID_ENTITY );
 			} else {
-				pathFound = FindPathFromCellToBuilding( task.start.cell, task.goal.building, theGame->map,
-				                                        theGame->roadNetwork, entry.path );
-			}
-		} else if ( task.type == PathfindingTask::Type::FROM_CELL_TO_TILE_TYPE ) {
-			pathFound = FindPathToCellType( task.start.cell, task.goal.tileType, task.movementAllowed, theGame->map,
-			                                entry.path );
-		} else if ( task.type == PathfindingTask::Type::FROM_BUILDING_TO_TILE_TYPE ) {
-			for ( Cell cell : task.start.building.AdjacentCells( theGame->map ) ) {
-				pathFound =
-				    FindPathToCellType( cell, task.goal.tileType, task.movementAllowed, theGame->map, entry.path );
-				if ( pathFound ) {
-					break;
-				}
+				ReleaseSlot( partialSlotIndex );
 			}
-		} else if ( task.type == PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_CAPACITY ||
-		            task.type == PathfindingTask::Type::FROM_BUILDING_TO_RESOURCE_STORAGE_WITH_CAPACITY ||
-		            task.type == PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_STOCK ||
-		            task.type == PathfindingTask::Type::FROM_BUILDING_TO_RESOURCE_STORAGE_WITH_STOCK ) {
-			ng_assert_msg( task.movementAllowed == ROAD_NETWORK_AND_ROAD_BLOCK, "other methods are not handled yet" );
-
-			// TODO: This is not thread safe at all ! CpntBuildings might get created or deleted or changed during
-			// iteration
-			Entity closestStorage = INVALID_ENTITY;
-			u32    closestStorageDistance = UINT32_MAX;
-
-			for ( auto [ e, building ] : theGame->registery->IterateOver< CpntBuilding >() ) {
-				if ( building.kind != BuildingKind::STORAGE_HOUSE ) {
-					continue;
-				}
-				const CpntResourceInventory & inventory =
-				    theGame->registery->GetComponent< CpntResourceInventory >( e );
-				if ( ( ( task.type == PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_CAPACITY ||
-				         task.type == PathfindingTask::Type::FROM_BUILDING_TO_RESOURCE_STORAGE_WITH_CAPACITY ) &&
-				       inventory.GetResourceCapacity( task.goal.resourceType ) > 0 ) ||
-				     ( ( task.type == PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_STOCK ||
-				         task.type == PathfindingTask::Type::FROM_BUILDING_TO_RESOURCE_STORAGE_WITH_STOCK ) &&
-				       inventory.GetResourceAmount( task.goal.resourceType ) > 0 ) ) {
-					u32 distance = 0;
-
-					bool subPathFound = false;
-					if ( task.type == PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_CAPACITY ||
-					     task.type == PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_STOCK ) {
-						subPathFound =
-						    FindPathFromCellToBuilding( task.start.cell, building, theGame->map, theGame->roadNetwork,
-						                                entry.path, closestStorageDistance, &distance );
-					} else {
-						subPathFound =
-						    FindPathBetweenBuildings( task.start.building, building, theGame->map, theGame->roadNetwork,
-						                              entry.path, closestStorageDistance, &distance );
-					}
-					if ( subPathFound && distance < closestStorageDistance ) {
-						closestStorage = e;
-						closestStorageDistance = distance;
-						pathFound = true;
-						entry.targetEntity = closestStorage;
-					}
-				}
-			}
-		} else {
-			ng_assert( false );
 		}
-		if ( !pathFound ) {
-			deleteQueue.enqueue( entry.id );
+	}
+	suspendedSearches[ priority ].enqueue( std::move( suspended ) );
+	return true;
+}
+
+void SystemPathfinding::FinishTask( const PathfindingTask &             task,
+                                    u32                                 slotIndex,
+                                    bool                                pathFound,
+                                    std::chrono::steady_clock::duration solveTime ) {
+	solveTimeHistogram[ GetHistogramBucket( solveTime ) ]++;
+	if ( ReleasePendingTask( task.requester ) ) {
+		// The requester died while we were searching
+		ReleaseSlot( slotIndex );
+		numCancelledTasks++;
+		return;
+	}
+	pathfindingID id = INVALID_PATHFINDING_ID;
+	if ( pathFound ) {
+		id = PublishSlot( slotIndex, task.requester );
+	} else {
+		ReleaseSlot( slotIndex );
+	}
+	PostMsg< PathfindingTaskResponse >( MESSAGE_PATHFINDING_RESPONSE, PathfindingTaskResponse{ pathFound, id },
+	                                    task.requester, INVALID_ENTITY );
+}
+
+void SystemPathfinding::ParallelJob() {
+	QueuedTask      queued;
+	SuspendedSearch suspended;
+	FlowFieldTask   flowFieldTask;
+	// Once the budget is spent, parked searches wait for the next tick but the other tasks are still solved
+	bool isOutOfBudget = false;
+	while ( true ) {
+		std::shared_ptr< const WorldSnapshot > world = GetSnapshot();
+		suspended.search = nullptr;
+		if ( world == nullptr ) {
+			// When nothing was published yet, tasks wait for the first tick
+			break;
 		}
-		PostMsg< PathfindingTaskResponse >( MESSAGE_PATHFINDING_RESPONSE,
-		                                    PathfindingTaskResponse{ pathFound, entry.id }, task.requester,
-		                                    INVALID_ENTITY );
+		if ( flowFieldTasks.try_dequeue( flowFieldTask ) ) {
+			auto field = std::make_shared< FlowField >();
+			field->destination = flowFieldTask.destination;
+			field->movement = flowFieldTask.movement;
+			field->Build( flowFieldTask.building, *world->map, flowFieldTask.cellsToReach, flowFieldTask.minCost );
+			builtFlowFields.enqueue( std::move( field ) );
+			numFlowFieldsBuilt++;
+			continue;
+		}
+		if ( !DequeueMostUrgentTask( queued, isOutOfBudget ? nullptr : &suspended ) ) {
+			break;
+		}
+		if ( suspended.search != nullptr ) {
+			isOutOfBudget = !RunSearchSlice( suspended );
+			continue;
+		}
+
+		const PathfindingTask & task = queued.task;
+		auto                    startTime = std::chrono::steady_clock::now();
+		queueWaitHistogram[ GetHistogramBucket( startTime - queued.queuedAt ) ]++;
+
+		if ( IsTaskCancelled( task.requester ) ) {
+			// Nobody is waiting for this path anymore
+			ReleasePendingTask( task.requester );
+			numCancelledTasks++;
+			continue;
+		}
+		if ( task.deadline != 0 && world->clock > task.deadline ) {
+			ReleasePendingTask( task.requester );
+			numExpiredTasks++;
+			PostMsg< PathfindingTaskResponse >( MESSAGE_PATHFINDING_RESPONSE,
+			                                    PathfindingTaskResponse{ false, INVALID_PATHFINDING_ID },
+			                                    task.requester, INVALID_ENTITY );
+			continue;
+		}
+
+		u32 slotIndex = 0;
+		if ( !freeSlots.try_dequeue( slotIndex ) ) {
+			ng::Errorf( "Every pathfinding result slot is in use, are paths being leaked?\n" );
+			ReleasePendingTask( task.requester );
+			PostMsg< PathfindingTaskResponse >( MESSAGE_PATHFINDING_RESPONSE,
+			                                    PathfindingTaskResponse{ false, INVALID_PATHFINDING_ID },
+			                                    task.requester, INVALID_ENTITY );
+			continue;
+		}
+		const Map & map = *world->map;
+		bool        pathFound = false;
+		if ( FindCachedPath( task, map, slots[ slotIndex ], pathFound ) ) {
+			FinishTask( task, slotIndex, pathFound, std::chrono::steady_clock::now() - startTime );
+			continue;
+		}
+		if ( std::unique_ptr< ResumableSearch > search = StartSearch( task, map ); search != nullptr ) {
+			suspended.queued = queued;
+			suspended.world = world;
+			suspended.search = std::move( search );
+			suspended.slotIndex = slotIndex;
+			suspended.partialPathSent = false;
+			suspended.solveTime = std::chrono::steady_clock::now() - startTime;
+			isOutOfBudget = !RunSearchSlice( suspended );
+			continue;
+		}
+		pathFound = SolveTask( task, *world, slots[ slotIndex ] );
+		FinishTask( task, slotIndex, pathFound, std::chrono::steady_clock::now() - startTime );
+	}
+}
+
+void SystemPathfinding::DebugDraw() {
+	u64   hits = cache.hits;
+	u64   requests = hits + cache.misses;
+	float hitRate = requests > 0 ? 100.0f * hits / requests : 0.0f;
+	ImGui::Text( "Path cache: %llu entries, %.1f%% hit rate over %llu requests", ( u64 )cache.numEntries, hitRate,
+	             requests );
+	ImGui::Text( "Path cache memory: %.1f KB", cache.memoryUsage / 1024.0f );
+
+	ImGui::Text( "%llu / %u result slots in use, %llu reclaimed", NUM_RESULT_SLOTS - ( u64 )freeSlots.size_approx(),
+	             NUM_RESULT_SLOTS, ( u64 )numReclaimedSlots );
+	ImGui::Text( "%u workers, %llu tasks cancelled, %llu past their deadline", GetNumWorkers(),
+	             ( u64 )numCancelledTasks, ( u64 )numExpiredTasks );
+	ImGui::Text( "%llu search slices run, %lld expansions left this tick", ( u64 )numSlicesRun,
+	             ( int64 )expansionBudget );
+	ImGui::Text( "%llu flow fields built, %llu waiting", ( u64 )numFlowFieldsBuilt,
+	             ( u64 )flowFieldTasks.size_approx() );
+	if ( std::shared_ptr< const WorldSnapshot > world = GetSnapshot(); world != nullptr ) {
+		ImGui::Text( "Snapshot of tick %lld, %u storages, %llu map copies, %llu road network copies", world->clock,
+		             world->storages->Size(), ( u64 )numMapCopies, ( u64 )numRoadNetworkCopies );
+		ImGui::Text( "%llu storage copies", ( u64 )numStorageCopies );
+	}
+	for ( u32 priority = ( u32 )PathfindingTask::Priority::HIGH; priority < ( u32 )PathfindingTask::Priority::COUNT;
+	      priority++ ) {
+		ImGui::Text( "Queue %u: %llu tasks waiting, %llu searches parked", priority,
+		             ( u64 )taskQueues[ priority ].size_approx(), ( u64 )suspendedSearches[ priority ].size_approx() );
+	}
+	float queueWait[ NUM_HISTOGRAM_BUCKETS ];
+	float solveTime[ NUM_HISTOGRAM_BUCKETS ];
+	for ( u32 i = 0; i < NUM_HISTOGRAM_BUCKETS; i++ ) {
+		queueWait[ i ] = ( float )queueWaitHistogram[ i ];
+		solveTime[ i ] = ( float )solveTimeHistogram[ i ];
 	}
+	ImGui::PlotHistogram( "Queue wait (log2 us)", queueWait, NUM_HISTOGRAM_BUCKETS, 0, nullptr, 0.0f, FLT_MAX,
+	                      ImVec2( 0, 60 ) );
+	ImGui::PlotHistogram( "Solve time (log2 us)", solveTime, NUM_HISTOGRAM_BUCKETS, 0, nullptr, 0.0f, FLT_MAX,
+	                      ImVec2( 0, 60 ) );
 }
 
 void SystemPathfinding::HandleMessage( Registery & reg, const Message & msg ) {
 	switch ( msg.type ) {
 	case MESSAGE_PATHFINDING_REQUEST: {
 		PathfindingTask task = CastPayloadAs< PathfindingTask >( msg.payload );
-		bool            ok = taskQueue.enqueue( task );
+		if ( task.priority == PathfindingTask::Priority::DEFAULT ) {
+			task.priority = GetDefaultPriority( task );
+		}
+		if ( task.requester != INVALID_ENTITY ) {
+			std::lock_guard< std::mutex > lock( pendingMutex );
+			pendingTasks[ task.requester ].count++;
+		}
+		bool ok = taskQueues[ ( u32 )task.priority ].enqueue( QueuedTask{ task, std::chrono::steady_clock::now() } );
 		ng_assert( ok );
 		break;
 	}
+	case MESSAGE_ENTITY_DELETED: {
+		// Paths already published for it are reclaimed on the next update
+		deletedRequesters.insert( msg.recipient );
+		std::lock_guard< std::mutex > lock( pendingMutex );
+		auto                          it = pendingTasks.find( msg.recipient );
+		if ( it != pendingTasks.end() ) {
+			it->second.cancelled = true;
+		}
+		break;
+	}
 	case MESSAGE_PATHFINDING_DELETE_ENTRY: {
-		pathfindingID id = CastPayloadAs< pathfindingID >( msg.payload );
-		bool          ok = deleteQueue.enqueue( id );
-		ng_assert( ok );
+		DeletePath( CastPayloadAs< pathfindingID >( msg.payload ) );
 		break;
 	}
 	default:
@@ -1,22 +1,28 @@
 #pragma once
 #include "buildings/building.h"
+#include "buildings/logistics.h"
 #include "entity.h"
 #include "navigation.h"
 #include "ngLib/ngcontainers.h"
 #include "system.h"
+#include <atomic>
+#include <chrono>
 #include <concurrentqueue.h>
+#include <list>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
 using pathfindingID = u32;
+constexpr pathfindingID INVALID_PATHFINDING_ID = ( pathfindingID )-1;
 
 struct PathfindingTask {
 	enum class Type {
 		FROM_CELL_TO_CELL,
 		FROM_CELL_TO_BUILDING,
-		FROM_CELL_TO_TILE_TYPE,
 		FROM_BUILDING_TO_BUILDING,
 		FROM_BUILDING_TO_CELL,
-		FROM_BUILDING_TO_TILE_TYPE,
 		FROM_CELL_TO_RESOURCE_STORAGE_WITH_CAPACITY,
 		FROM_BUILDING_TO_RESOURCE_STORAGE_WITH_CAPACITY,
 		FROM_CELL_TO_RESOURCE_STORAGE_WITH_STOCK,
@@ -25,19 +31,109 @@ struct PathfindingTask {
 	union Coordinate {
 		Cell         cell;
 		CpntBuilding building;
-		MapTile      tileType;
 		GameResource resourceType;
 	};
+	// Workers always pick the most urgent task first
+	// DEFAULT lets the system decide: short road lookups are HIGH, A* searches NORMAL, LOW is only set by requesters
+	enum class Priority {
+		DEFAULT,
+		HIGH,
+		NORMAL,
+		LOW,
+		COUNT, // keep me at the end
+	};
 	Entity          requester;
 	Type            type;
 	Coordinate      start{ INVALID_CELL };
 	Coordinate      goal{ INVALID_CELL };
 	MovementAllowed movementAllowed;
+	Priority        priority = Priority::DEFAULT;
+	// If the task is still waiting in the queue after this point in time, it fails. 0 means no deadline
+	TimePoint deadline = 0;
+	// A* cell to cell only. When the search takes more than one slice, a first response with isPartial set carries the
+	// path to the most promising cell found so far, the requester can start walking while the real one is computed
+	bool acceptPartialPath = false;
 };
 
 struct PathfindingTaskResponse {
 	bool          ok;
 	pathfindingID id;
+	bool          isPartial = false;
+};
+
+// Copy of everything the pathfinding workers read, published by the main thread once per tick
+// Workers grab the latest one at the start of a task and never see it change under them
+struct WorldSnapshot {
+	struct Storage {
+		Entity                entity;
+		CpntBuilding          building;
+		CpntResourceInventory inventory;
+	};
+
+	TimePoint clock = 0;
+	// Copying the map is expensive, so consecutive snapshots share it until a tile changes
+	std::shared_ptr< const Map > map;
+	// Same for the road network, that only changes with the roads
+	std::shared_ptr< const RoadNetwork > roadNetwork;
+	u64                                  roadVersion = 0;
+	// Only the storages are needed, taken from the logistics index and shared until it changes
+	std::shared_ptr< const ng::DynamicArray< Storage > > storages;
+	u64                                                  logisticsVersion = 0;
+};
+
+// Results of the last requests, so that agents asking for the same route over and over don't pay for a new search
+// Entries are tagged with the map version they were computed on and are dropped when the map changed since
+// A path found by A* only needs the chunks it goes through to not lose any cell, opening cells can't break it
+// Shared by all the pathfinding workers, Find and Store are called under SystemPathfinding::cacheMutex
+// The stats are atomics so the debug window can read them without taking the lock
+struct PathCache {
+	static constexpr u32 MAX_ENTRIES = 256;
+
+	struct Key {
+		PathfindingTask::Type type;
+		MovementAllowed       movement;
+		Cell                  start;
+		Cell                  goal;
+		// Size of the buildings if start or goal are buildings
+		u32 startSizeX = 0;
+		u32 startSizeZ = 0;
+		u32 goalSizeX = 0;
+		u32 goalSizeZ = 0;
+
+		bool operator==( const Key & rhs ) const = default;
+	};
+	struct KeyHash {
+		size_t operator()( const Key & key ) const;
+	};
+	struct CachedPath {
+		Key                      key;
+		u64                      mapVersion;
+		bool                     found;
+		ng::DynamicArray< Cell > path;
+		// Chunks crossed by a found A* path, empty when any edit of the map drops the entry
+		ng::DynamicArray< u32 > chunks;
+	};
+
+	std::list< CachedPath >                                                 lru; // most recently used first
+	std::unordered_map< Key, std::list< CachedPath >::iterator, KeyHash > lookup;
+
+	std::atomic< u64 > hits = 0;
+	std::atomic< u64 > misses = 0;
+	std::atomic< u64 > numEntries = 0;
+	std::atomic< u64 > memoryUsage = 0;
+
+	// Returns false if the task result can't be cached (it depends on more than the map)
+	static bool MakeKey( const PathfindingTask & task, Key & outKey );
+	static u64  MapVersionFor( MovementAllowed movement, const Map & map );
+	static bool IsUpToDate( const CachedPath & entry, const Map & map );
+	// Chunks of the cells of the compressed path, and of the corners its diagonal steps go around
+	static void ListCrossedChunks( const ng::DynamicArray< Cell > & path,
+	                               const Map &                      map,
+	                               ng::DynamicArray< u32 > &        out );
+
+	const CachedPath * Find( const Key & key, const Map & map );
+	void               Store( const Key & key, const Map & map, bool found, const ng::DynamicArray< Cell > & path );
+	void               Remove( std::list< CachedPath >::iterator it );
 };
 
 struct CpntPathfinding {};
@@ -46,25 +142,145 @@ struct SystemPathfinding : public System< CpntPathfinding > {
 	SystemPathfinding() {
 		ListenToGlobal( MESSAGE_PATHFINDING_REQUEST );
 		ListenToGlobal( MESSAGE_PATHFINDING_DELETE_ENTRY );
+		ListenToGlobal( MESSAGE_ENTITY_DELETED );
+		for ( u32 i = 0; i < NUM_RESULT_SLOTS; i++ ) {
+			freeSlots.enqueue( i );
+		}
 	}
-	struct Entry {
-		pathfindingID            id;
+
+	// Results live in a fixed array of slots, a pathfindingID is the index of the slot and its generation
+	// A slot is written by the worker that popped it from freeSlots, then taken once by the main thread
+	// The generation is bumped every time a slot is released, so a stale id can't read someone else's path
+	static constexpr u32 NUM_RESULT_SLOTS = 4096;
+	static constexpr u32 SLOT_INDEX_BITS = 12;
+	static constexpr u32 SLOT_INDEX_MASK = NUM_RESULT_SLOTS - 1;
+	// Generations never reach all ones, that way no id is equal to INVALID_PATHFINDING_ID
+	static constexpr u32 MAX_GENERATION = ( 1u << ( 32 - SLOT_INDEX_BITS ) ) - 1;
+	static_assert( ( 1u << SLOT_INDEX_BITS ) == NUM_RESULT_SLOTS );
+
+	struct ResultSlot {
+		std::atomic< u32 >       generation = 0;
+		std::atomic< bool >      isReady = false;
 		ng::DynamicArray< Cell > path;
 		// targetEntity will only be filled on certain tasks
 		// I don't know if it's a good idea, but it avoid a lot of recomputation when looking for a path to a storage
 		// house
 		Entity targetEntity = INVALID_ENTITY;
+		// Written by the worker before the slot is published
+		Entity requester = INVALID_ENTITY;
+		// Main thread only, first tick the slot was seen ready, -1 until then
+		TimePoint readySince = -1;
+	};
+	std::unique_ptr< ResultSlot[] >    slots = std::make_unique< ResultSlot[] >( NUM_RESULT_SLOTS );
+	moodycamel::ConcurrentQueue< u32 > freeSlots;
+
+	// Moves the path into out, the id can't be used anymore afterward
+	// Returns the target entity (reminder: will be INVALID_ENTITY most of the time)
+	Entity TakePath( pathfindingID id, ng::DynamicArray< Cell > & out );
+	void   DeletePath( pathfindingID id );
+
+	ResultSlot *  FindReadySlot( pathfindingID id );
+	pathfindingID PublishSlot( u32 index, Entity requester );
+	void          ReleaseSlot( u32 index );
+
+	// Published paths are only freed when taken, a requester that dies before reading its response or that ignores it
+	// would hold its slot forever. Those are given back to the free list on the next tick
+	static constexpr Duration                UNCLAIMED_SLOT_TIMEOUT = DurationFromSeconds( 2 );
+	std::unordered_set< Entity, EntityHash > deletedRequesters;
+	std::atomic< u64 >                       numReclaimedSlots = 0;
+
+	void ReclaimUnclaimedSlots( TimePoint clock );
+
+	struct QueuedTask {
+		PathfindingTask                       task;
+		std::chrono::steady_clock::time_point queuedAt;
+	};
+	moodycamel::ConcurrentQueue< QueuedTask > taskQueues[ ( u32 )PathfindingTask::Priority::COUNT ];
+
+	// A* searches run by slices of SEARCH_SLICE expansions, taken from a budget refilled every tick
+	// Between two slices the search is parked with its result slot, so urgent tasks can go first. When the budget is
+	// spent, the parked searches wait for the next tick and the workers only solve the other tasks
+	static constexpr u32   SEARCH_SLICE = 1024;
+	static constexpr int64 EXPANSION_BUDGET_PER_TICK = 16 * SEARCH_SLICE;
+	std::atomic< int64 >   expansionBudget = EXPANSION_BUDGET_PER_TICK;
+
+	struct SuspendedSearch {
+		QueuedTask                             queued;
+		std::shared_ptr< const WorldSnapshot > world; // the search keeps reading the snapshot it started on
+		std::unique_ptr< ResumableSearch >     search;
+		u32                                    slotIndex = 0;
+		bool                                   partialPathSent = false;
+		std::chrono::steady_clock::duration    solveTime{};
+	};
+	moodycamel::ConcurrentQueue< SuspendedSearch > suspendedSearches[ ( u32 )PathfindingTask::Priority::COUNT ];
+	std::atomic< u64 >                             numSlicesRun = 0;
+
+	// Flow fields are built here too, agents stand still until theirs is done so they go before the other tasks
+	struct FlowFieldTask {
+		Entity                   destination;
+		CpntBuilding             building;
+		MovementAllowed          movement;
+		ng::DynamicArray< Cell > cellsToReach;
+		u32                      minCost = 0;
 	};
-	std::mutex              entriesMutex;
-	ng::LinkedList< Entry > entries;
+	moodycamel::ConcurrentQueue< FlowFieldTask >                      flowFieldTasks;
+	moodycamel::ConcurrentQueue< std::shared_ptr< const FlowField > > builtFlowFields;
+	std::atomic< u64 >                                                numFlowFieldsBuilt = 0;
+
+	std::mutex cacheMutex;
+	PathCache  cache;
+
+	std::atomic< std::shared_ptr< const WorldSnapshot > > snapshot;
+	std::atomic< u64 >                                    numMapCopies = 0;
+	std::atomic< u64 >                                    numRoadNetworkCopies = 0;
+	std::atomic< u64 >                                    numStorageCopies = 0;
+
+	void PublishSnapshot( const LogisticsIndex & logistics,
+	                      const Map &            map,
+	                      const RoadNetwork &    roadNetwork,
+	                      TimePoint              clock );
+	std::shared_ptr< const WorldSnapshot > GetSnapshot() const { return snapshot.load(); }
+
+	// Number of tasks in flight for each requester, so that we can drop them when the requester gets deleted
+	struct PendingTasks {
+		u32  count = 0;
+		bool cancelled = false;
+	};
+	std::mutex                                                pendingMutex;
+	std::unordered_map< Entity, PendingTasks, EntityHash > pendingTasks;
+
+	// Time spent waiting in the queue and solving, bucket i counts durations in [2^i, 2^(i+1)[ microseconds
+	static constexpr u32 NUM_HISTOGRAM_BUCKETS = 24;
+	std::atomic< u64 >   queueWaitHistogram[ NUM_HISTOGRAM_BUCKETS ] = {};
+	std::atomic< u64 >   solveTimeHistogram[ NUM_HISTOGRAM_BUCKETS ] = {};
+	std::atomic< u64 >   numCancelledTasks = 0;
+	std::atomic< u64 >   numExpiredTasks = 0;
 
-	// CopyPath and CopyAndDeletePath returns the target entity (reminder: will be INVALID_ENTITY most of the time)
-	Entity CopyPath( pathfindingID id, ng::DynamicArray< Cell > & out );
-	Entity CopyAndDeletePath( pathfindingID id, ng::DynamicArray< Cell > & out );
+	static u32 GetNumWorkers();
+	static u32 GetHistogramBucket( std::chrono::steady_clock::duration duration );
+	static PathfindingTask::Priority GetDefaultPriority( const PathfindingTask & task );
 
-	moodycamel::ConcurrentQueue< PathfindingTask > taskQueue;
-	moodycamel::ConcurrentQueue< pathfindingID >   deleteQueue;
+	// When outSearch is given, parked searches go before new tasks of the same priority
+	// outSearch->search is only set when a parked search was picked
+	bool DequeueMostUrgentTask( QueuedTask & outTask, SuspendedSearch * outSearch = nullptr );
+	// Tasks StartSearch has no sliced search for, solved in one go
+	bool SolveTask( const PathfindingTask & task, const WorldSnapshot & world, ResultSlot & result );
+	bool FindCachedPath( const PathfindingTask & task, const Map & map, ResultSlot & result, bool & outPathFound );
+	void StorePath( const PathfindingTask & task, const Map & map, bool pathFound, const ng::DynamicArray< Cell > & path );
+	// Searches that can be sliced, nullptr for the tasks that are solved in one go
+	static std::unique_ptr< ResumableSearch > StartSearch( const PathfindingTask & task, const Map & map );
+	// Returns false when the budget was spent before the slice could run, the search is parked again
+	bool RunSearchSlice( SuspendedSearch & suspended );
+	void FinishTask( const PathfindingTask &             task,
+	                 u32                                 slotIndex,
+	                 bool                                pathFound,
+	                 std::chrono::steady_clock::duration solveTime );
+	bool IsTaskCancelled( Entity requester );
+	// Returns true if the requester was deleted while its task was queued or solved
+	bool ReleasePendingTask( Entity requester );
 
+	virtual void Update( Registery & reg, Duration ticks ) override;
 	virtual void ParallelJob() override;
+	virtual void DebugDraw() override;
 	virtual void HandleMessage( Registery & reg, const Message & msg ) override;
 };
@@ -1,4 +1,5 @@
 #include "renderer.h"
+#include "buildings/storage_house.h"
 #include "environment/trees.h"
 #include "game.h"
 #include "mesh.h"
@@ -162,6 +163,9 @@ void Renderer::GeometryPass( const Registery &     reg,
 	glEnable( GL_DEPTH_TEST );
 
 	theGame->systemManager.GetSystem< SystemTree >().instances.Render( g_shaderAtlas.instancedDeferredShader );
+	for ( InstancedModelBatch & batch : theGame->systemManager.GetSystem< SystemStorageHouse >().resourceBatches ) {
+		batch.Render( g_shaderAtlas.instancedDeferredShader );
+	}
 
 	g_shaderAtlas.deferredShader.Use();
 	for ( auto const & [ e, renderModel ] : reg.IterateOver< CpntRenderModel >() ) {
@@ -182,6 +186,9 @@ void Renderer::GeometryPass( const Registery &     reg,
 		}
 	}
 	theGame->systemManager.GetSystem< SystemTree >().instances.Render( g_shaderAtlas.shadowPassInstancedShader );
+	for ( InstancedModelBatch & batch : theGame->systemManager.GetSystem< SystemStorageHouse >().resourceBatches ) {
+		batch.Render( g_shaderAtlas.shadowPassInstancedShader );
+	}
 
 	g_shaderAtlas.deferredShader.Use();
 }
@@ -1 +1,45 @@
 #include "service.h"
+
+void ServiceCoverage::Init( u32 mapSizeX, u32 mapSizeZ ) {
+	sizeX = mapSizeX;
+	sizeZ = mapSizeZ;
+	numChunksZ = ( mapSizeZ + CHUNK_SIZE - 1 ) / CHUNK_SIZE;
+	u32 numChunksX = ( mapSizeX + CHUNK_SIZE - 1 ) / CHUNK_SIZE;
+	for ( auto & serviceChunks : chunks ) {
+		serviceChunks.clear();
+		serviceChunks.resize( ( u64 )numChunksX * numChunksZ );
+	}
+}
+
+void ServiceCoverage::Stamp( GameService service, Cell cell, TimePoint time ) {
+	if ( cell.x >= sizeX || cell.z >= sizeZ ) {
+		return;
+	}
+	std::unique_ptr< TimePoint[] > & chunk = chunks[ ( int )service ][ ChunkIndex( cell ) ];
+	if ( chunk == nullptr ) {
+		chunk = std::make_unique< TimePoint[] >( CHUNK_SIZE * CHUNK_SIZE ); // zeroed
+	}
+	chunk[ IndexInChunk( cell ) ] = time;
+}
+
+TimePoint ServiceCoverage::GetLastVisit( GameService service, Cell cell ) const {
+	if ( cell.x >= sizeX || cell.z >= sizeZ ) {
+		return 0;
+	}
+	const std::unique_ptr< TimePoint[] > & chunk = chunks[ ( int )service ][ ChunkIndex( cell ) ];
+	return chunk != nullptr ? chunk[ IndexInChunk( cell ) ] : 0;
+}
+
+TimePoint ServiceCoverage::GetLastVisitAround( GameService service, Cell corner, u32 areaSizeX, u32 areaSizeZ ) const {
+	TimePoint lastVisit = 0;
+	// Cells outside of the map wrap around to huge coordinates and are ignored by GetLastVisit
+	for ( u32 dx = 0; dx < areaSizeX + 2; dx++ ) {
+		for ( u32 dz = 0; dz < areaSizeZ + 2; dz++ ) {
+			bool isCorner = ( dx == 0 || dx == areaSizeX + 1 ) && ( dz == 0 || dz == areaSizeZ + 1 );
+			if ( !isCorner ) {
+				lastVisit = MAX( lastVisit, GetLastVisit( service, Cell( corner.x + dx - 1, corner.z + dz - 1 ) ) );
+			}
+		}
+	}
+	return lastVisit;
+}
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "game_time.h"
+#include "map.h"
+#include <memory>
+#include <vector>
 
 enum class GameService {
 	WATER,
@@ -10,3 +13,28 @@ enum class GameService {
 constexpr Duration servicesExpireAfter = DurationFromSeconds(20);
 
 inline bool IsServiceFulfilled( TimePoint lastAccess, TimePoint now ) { return (now - lastAccess) <= servicesExpireAfter; }
+
+// Last time a walker of each service went through each cell, houses look at the cells around them to know if they are
+// served. Cells are allocated by chunks, on the first visit of the chunk
+struct ServiceCoverage {
+	static constexpr u32 CHUNK_SIZE = 64;
+
+	void Init( u32 mapSizeX, u32 mapSizeZ );
+	bool IsSizedFor( const Map & map ) const { return sizeX == map.sizeX && sizeZ == map.sizeZ; }
+
+	void Stamp( GameService service, Cell cell, TimePoint time );
+	// 0 for the cells no walker went through yet
+	TimePoint GetLastVisit( GameService service, Cell cell ) const;
+	// Latest visit of the cells of the area and of the ones sharing a side with it
+	TimePoint GetLastVisitAround( GameService service, Cell corner, u32 areaSizeX, u32 areaSizeZ ) const;
+
+	u32 sizeX = 0;
+	u32 sizeZ = 0;
+
+  private:
+	u32        ChunkIndex( Cell cell ) const { return ( cell.x / CHUNK_SIZE ) * numChunksZ + cell.z / CHUNK_SIZE; }
+	static u32 IndexInChunk( Cell cell ) { return ( cell.x % CHUNK_SIZE ) * CHUNK_SIZE + cell.z % CHUNK_SIZE; }
+
+	u32                                           numChunksZ = 0;
+	std::vector< std::unique_ptr< TimePoint[] > > chunks[ ( int )GameService::NUM_SERVICES ];
+};
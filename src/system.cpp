@@ -51,6 +51,14 @@ void SystemManager::Update( Registery & reg, Duration ticks ) {
 		for ( auto [ type, system ] : systems ) {
 			messageQueuesAreEmpty &= system->messageQueue.size_approx() == 0;
 		}
+		if ( messageQueuesAreEmpty ) {
+			for ( auto [ type, system ] : systems ) {
+				system->OnMessagesFlushed( reg );
+			}
+			for ( auto [ type, system ] : systems ) {
+				messageQueuesAreEmpty &= system->messageQueue.size_approx() == 0;
+			}
+		}
 	}
 
 	// Flush delete queue
@@ -80,6 +88,8 @@ void SystemParallelTask( ISystem * system ) {
 }
 
 void SystemManager::StartJobs() {
-	std::thread * astarThread = new std::thread( SystemParallelTask, &( GetSystem< SystemPathfinding >() ) );
-	jobs.PushBack( astarThread );
+	for ( u32 i = 0; i < SystemPathfinding::GetNumWorkers(); i++ ) {
+		std::thread * astarThread = new std::thread( SystemParallelTask, &( GetSystem< SystemPathfinding >() ) );
+		jobs.PushBack( astarThread );
+	}
 }
@@ -30,6 +30,9 @@ struct ISystem {
 	virtual void Update( Registery & reg, Duration ticks ) {}
 	virtual void ParallelJob() {}
 	virtual void HandleMessage( Registery & reg, const Message & msg ) {}
+	// Called when every message queue is empty, systems that batch what their messages ask for resolve it here
+	// Messages posted from there are still dispatched in the same update
+	virtual void OnMessagesFlushed( Registery & reg ) {}
 	virtual void DebugDraw() {}
 
 	moodycamel::ConcurrentQueue< Message > messageQueue;
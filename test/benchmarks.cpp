@@ -1,16 +1,23 @@
+#include "buildings/placement.h"
+#include "game.h"
 #include "navigation.h"
 #include "ngLib/ngcontainers.h"
+#include "ngLib/sys.h"
+#include "registery.h"
+#include <algorithm>
 #include <benchmark/benchmark.h>
+#include <glm/gtc/noise.hpp>
 #include <list>
-
-struct Texture {
-	char data[ 400 ];
-	int  encoding[ 16 ];
-};
-
-static void BM_NetworkFindPath( benchmark::State & state ) {
-	Map         map;
-	RoadNetwork network;
+#include <memory>
+#include <queue>
+#include <random>
+#include <sstream>
+
+// Draws a road across a grid and deletes it, like dragging the mouse would
+static void DragRoadAcrossGrid( benchmark::State & state, bool useEdit ) {
+	Map & map = theGame->map;
+	map = Map();
+	theGame->roadNetwork = RoadNetwork();
 	map.AllocateGrid( 200, 200 );
 	for ( u32 x = 30; x <= 190; x++ ) {
 		for ( u32 z = 30; z <= 190; z++ ) {
@@ -19,32 +26,782 @@ static void BM_NetworkFindPath( benchmark::State & state ) {
 		}
 	}
 
-	ng::DynamicArray< Cell > out;
 	for ( auto _ : state ) {
-		network.FindPath(  Cell( 34, 30 ), Cell( 164, 90 ), map, out  );
+		if ( useEdit ) {
+			map.BeginEdit();
+		}
+		for ( u32 x = 30; x <= 190; x++ ) {
+			if ( map.GetTile( x, 35 ) == MapTile::EMPTY ) {
+				map.SetTile( x, 35, MapTile::ROAD );
+			}
+		}
+		if ( useEdit ) {
+			map.CommitEdit();
+			map.BeginEdit();
+		}
+		for ( u32 x = 31; x < 190; x++ ) {
+			if ( x % 10 != 0 ) {
+				map.SetTile( x, 35, MapTile::EMPTY );
+			}
+		}
+		if ( useEdit ) {
+			map.CommitEdit();
+		}
 	}
 }
 
-BENCHMARK( BM_NetworkFindPath );
+static void BM_DragRoadOneByOne( benchmark::State & state ) { DragRoadAcrossGrid( state, false ); }
+BENCHMARK( BM_DragRoadOneByOne );
+
+static void BM_DragRoadInOneEdit( benchmark::State & state ) { DragRoadAcrossGrid( state, true ); }
+BENCHMARK( BM_DragRoadInOneEdit );
+
+// Same forest as the one generated in main.cpp
+static void GenerateSimplexForest( Map & map ) {
+	std::uniform_real_distribution< float > randomFloats( 0.0, 1.0 );
+	std::default_random_engine              generator;
+	for ( u32 x = 0; x < map.sizeX; x++ ) {
+		for ( u32 z = 0; z < map.sizeZ; z++ ) {
+			constexpr float treeGenerationThreshold = 0.75f;
+			float           simplex = ( glm::simplex( glm::vec2( x / 64.0f, z / 64.0f ) ) + 1.0f ) / 2.0f;
+			if ( simplex > treeGenerationThreshold ) {
+				map.SetTile( x, z, MapTile::TREE );
+			}
+			z += roundf( randomFloats( generator ) * 3.0f );
+		}
+		x += roundf( randomFloats( generator ) * 3.0f );
+	}
+}
 
-static void BM_AStar( benchmark::State & state ) {
-	Map           map;
-	RoadNetwork network;
+// Placement preview tests every cell under the mouse, this checks them all at once
+static void BM_CanPlaceBuildingEverywhere( benchmark::State & state ) {
+	Map map;
 	map.AllocateGrid( 200, 200 );
-	for ( u32 x = 30; x <= 190; x++ ) {
-		for ( u32 z = 30; z <= 190; z++ ) {
-			if ( x % 10 == 0 || z % 10 == 0 )
+	GenerateSimplexForest( map );
+
+	for ( auto _ : state ) {
+		u32 count = 0;
+		for ( u32 x = 0; x < map.sizeX; x++ ) {
+			for ( u32 z = 0; z < map.sizeZ; z++ ) {
+				count += CanPlaceBuilding( Cell( x, z ), BuildingKind::FARM, map );
+			}
+		}
+		benchmark::DoNotOptimize( count );
+	}
+}
+
+BENCHMARK( BM_CanPlaceBuildingEverywhere );
+
+// Hovering a city of 2x2 houses, the mouse goes over every cell of the map
+static void BM_FindBuildingUnderMouse( benchmark::State & state ) {
+	Map map;
+	map.AllocateGrid( 256, 256 );
+	u32 numBuildings = 0;
+	for ( u32 x = 0; x + 2 <= map.sizeX; x += 3 ) {
+		for ( u32 z = 0; z + 2 <= map.sizeZ; z += 3 ) {
+			map.SetBuildingArea( Cell( x, z ), 2, 2, Entity{ numBuildings++, 0 } );
+		}
+	}
+
+	for ( auto _ : state ) {
+		u32 count = 0;
+		for ( u32 x = 0; x < map.sizeX; x++ ) {
+			for ( u32 z = 0; z < map.sizeZ; z++ ) {
+				count += FindBuildingByPosition( Cell( x, z ), map ) != INVALID_ENTITY;
+			}
+		}
+		benchmark::DoNotOptimize( count );
+	}
+	state.counters[ "buildings" ] = numBuildings;
+}
+
+BENCHMARK( BM_FindBuildingUnderMouse );
+
+// Houses of a grid city looking for the closest of a few hundred farms by road
+static void BM_LookForClosestFarmInCity( benchmark::State & state ) {
+	Game * previousGame = theGame;
+	theGame = new Game();
+	theGame->registery = new Registery( &theGame->systemManager );
+	theGame->systemManager.CreateSystem< SystemBuilding >();
+	Map &       map = theGame->map;
+	Registery & reg = *theGame->registery;
+	map.AllocateGrid( 256, 256 );
+	map.BeginEdit();
+	for ( u32 i = 0; i < 256; i++ ) {
+		for ( u32 j = 0; j < 256; j += 8 ) {
+			map.SetTile( i, j, MapTile::ROAD );
+			map.SetTile( j, i, MapTile::ROAD );
+		}
+	}
+	map.CommitEdit();
+
+	std::default_random_engine           generator;
+	std::uniform_int_distribution< u32 > randomBlock( 0, 31 );
+	for ( u32 i = 0; i < 300; i++ ) {
+		Entity         e = reg.CreateEntity();
+		CpntBuilding & farm = reg.AssignComponent< CpntBuilding >( e );
+		farm.kind = BuildingKind::FARM;
+		farm.cell = Cell( randomBlock( generator ) * 8 + 1, randomBlock( generator ) * 8 + 1 );
+		farm.tileSizeX = 3;
+		farm.tileSizeZ = 3;
+	}
+	reg.FlushCreationQueues();
+
+	ng::DynamicArray< CpntBuilding > houses;
+	for ( u32 i = 0; i < 64; i++ ) {
+		Cell cell( randomBlock( generator ) * 8 + 5, randomBlock( generator ) % 31 * 8 + 7 );
+		houses.PushBack( CpntBuilding{ BuildingKind::HOUSE, cell, 2, 1 } );
+	}
+
+	ng::DynamicArray< Cell > path;
+	for ( auto _ : state ) {
+		for ( const CpntBuilding & house : houses ) {
+			benchmark::DoNotOptimize( LookForClosestBuildingKind( reg, BuildingKind::FARM, house, ULONG_MAX, path ) );
+		}
+	}
+	state.SetItemsProcessed( state.iterations() * houses.Size() );
+
+	delete theGame;
+	theGame = previousGame;
+}
+
+BENCHMARK( BM_LookForClosestFarmInCity );
+
+static void BM_AllocateHugeMap( benchmark::State & state ) {
+	for ( auto _ : state ) {
+		Map map;
+		map.AllocateGrid( 16384, 16384 );
+		benchmark::DoNotOptimize( map.sizeX );
+	}
+}
+
+BENCHMARK( BM_AllocateHugeMap );
+
+// The pathfinding snapshot copies the map whenever a tile changed
+static void BM_CopyMapAfterEdit( benchmark::State & state ) {
+	Map map;
+	map.AllocateGrid( 1024, 1024 );
+	GenerateSimplexForest( map );
+
+	u32 x = 0;
+	for ( auto _ : state ) {
+		map.SetTile( x, 0, map.GetTile( x, 0 ) == MapTile::EMPTY ? MapTile::BLOCKED : MapTile::EMPTY );
+		x = ( x + 1 ) % map.sizeX;
+		Map copy = map;
+		benchmark::DoNotOptimize( copy.sizeX );
+	}
+}
+
+BENCHMARK( BM_CopyMapAfterEdit );
+
+// Pathfinding suite
+// Every map family is generated once and its queries are sampled with a fixed seed, so runs can be compared
+// Counters are per query: nodes expanded, bytes of search steps, share of the queries that found a path, and path
+// length over the shortest one found by a breadth first search (1 means optimal)
+
+static constexpr u32 PATH_SUITE_MAP_SIZE = 192;
+static constexpr u32 PATH_SUITE_NUM_QUERIES = 16;
+
+enum class PathSuiteFamily {
+	GRID_CITY,
+	ORGANIC_ROADS,
+	MAZE,
+	FOREST,
+	NUM_FAMILIES, // keep me at the end
+};
+
+struct PathQuery {
+	Cell start = INVALID_CELL;
+	Cell goal = INVALID_CELL;
+	u32  startBuilding = 0;
+	u32  goalBuilding = 0;
+	u32  shortestDistance = 0;
+};
+
+struct PathSuiteMap {
+	Map                              map;
+	RoadNetwork                      network;
+	ng::DynamicArray< CpntBuilding > buildings;
+
+	ng::DynamicArray< PathQuery > cellQueries;
+	ng::DynamicArray< PathQuery > roadQueries;
+	ng::DynamicArray< PathQuery > buildingQueries;
+	ng::DynamicArray< PathQuery > cellToBuildingQueries;
+};
+
+// Every step costs the same, so a breadth first search gives the same distances as Dijkstra
+static void ComputeWalkingDistances( const Map &                      map,
+                                     const ng::DynamicArray< Cell > & starts,
+                                     bool                             onRoads,
+                                     std::vector< u32 > &             distances ) {
+	distances.assign( ( u64 )map.sizeX * map.sizeZ, ( u32 )-1 );
+	std::queue< Cell > open;
+	for ( const Cell & start : starts ) {
+		distances[ ( u64 )start.x * map.sizeZ + start.z ] = 0;
+		open.push( start );
+	}
+	while ( !open.empty() ) {
+		Cell cell = open.front();
+		open.pop();
+		u32                        distance = distances[ ( u64 )cell.x * map.sizeZ + cell.z ];
+		ng::StaticArray< Cell, 4 > neighbors;
+		GetNeighborsOfCell( cell, map, neighbors );
+		for ( const Cell & neighbor : neighbors ) {
+			bool  passable = onRoads ? map.IsTileWalkable( neighbor ) : map.IsTileAStarNavigable( neighbor );
+			u32 & neighborDistance = distances[ ( u64 )neighbor.x * map.sizeZ + neighbor.z ];
+			if ( passable && neighborDistance == ( u32 )-1 ) {
+				neighborDistance = distance + 1;
+				open.push( neighbor );
+			}
+		}
+	}
+}
+
+static void SampleCellQueries( const Map & map, bool onRoads, ng::DynamicArray< PathQuery > & queries ) {
+	ng::DynamicArray< Cell > candidates;
+	for ( u32 x = 0; x < map.sizeX; x++ ) {
+		for ( u32 z = 0; z < map.sizeZ; z++ ) {
+			if ( onRoads ? map.IsTileWalkable( x, z ) : map.IsTileAStarNavigable( Cell( x, z ) ) ) {
+				candidates.PushBack( Cell( x, z ) );
+			}
+		}
+	}
+	if ( candidates.Size() < 2 ) {
+		return;
+	}
+
+	std::default_random_engine generator( 42 );
+	ng::DynamicArray< Cell >   start( 1 );
+	std::vector< u32 >         distances;
+	for ( u32 attempt = 0; attempt < PATH_SUITE_NUM_QUERIES * 4 && queries.Size() < PATH_SUITE_NUM_QUERIES;
+	      attempt++ ) {
+		start.Clear();
+		start.PushBack( candidates[ generator() % candidates.Size() ] );
+		ComputeWalkingDistances( map, start, onRoads, distances );
+		for ( u32 i = 0; i < 32; i++ ) {
+			Cell goal = candidates[ generator() % candidates.Size() ];
+			u32  distance = distances[ ( u64 )goal.x * map.sizeZ + goal.z ];
+			if ( distance != ( u32 )-1 && distance > 0 ) {
+				PathQuery query;
+				query.start = start[ 0 ];
+				query.goal = goal;
+				query.shortestDistance = distance;
+				queries.PushBack( query );
+				break;
+			}
+		}
+	}
+}
+
+static void SampleBuildingQueries( const PathSuiteMap &            suiteMap,
+                                   bool                            fromCell,
+                                   ng::DynamicArray< PathQuery > & queries ) {
+	const Map & map = suiteMap.map;
+	if ( suiteMap.buildings.Size() < 2 ) {
+		return;
+	}
+
+	std::default_random_engine generator( 42 );
+	ng::DynamicArray< Cell >   startCells;
+	ng::DynamicArray< Cell >   goalCells;
+	std::vector< u32 >         distances;
+	for ( u32 attempt = 0; attempt < PATH_SUITE_NUM_QUERIES * 4 && queries.Size() < PATH_SUITE_NUM_QUERIES;
+	      attempt++ ) {
+		PathQuery query;
+		query.startBuilding = generator() % suiteMap.buildings.Size();
+		query.goalBuilding = generator() % suiteMap.buildings.Size();
+		if ( query.startBuilding == query.goalBuilding ) {
+			continue;
+		}
+		startCells.Clear();
+		goalCells.Clear();
+		GetRoadCellsAroundBuilding( suiteMap.buildings[ query.startBuilding ], map, startCells );
+		GetRoadCellsAroundBuilding( suiteMap.buildings[ query.goalBuilding ], map, goalCells );
+		if ( fromCell ) {
+			query.start = startCells[ generator() % startCells.Size() ];
+			startCells.Clear();
+			startCells.PushBack( query.start );
+		}
+		ComputeWalkingDistances( map, startCells, true, distances );
+		query.shortestDistance = ( u32 )-1;
+		for ( const Cell & goal : goalCells ) {
+			query.shortestDistance = MIN( query.shortestDistance, distances[ ( u64 )goal.x * map.sizeZ + goal.z ] );
+		}
+		if ( query.shortestDistance != ( u32 )-1 && query.shortestDistance > 0 ) {
+			queries.PushBack( query );
+		}
+	}
+}
+
+// Houses are put on free lots along the roads, every few cells
+static void PlaceSuiteBuildings( PathSuiteMap & suiteMap ) {
+	Map & map = suiteMap.map;
+	for ( u32 x = 1; x + 3 < map.sizeX; x += 4 ) {
+		for ( u32 z = 1; z + 3 < map.sizeZ; z += 4 ) {
+			if ( !map.IsAreaEmpty( x, z, 2, 2 ) ) {
+				continue;
+			}
+			CpntBuilding building;
+			building.kind = BuildingKind::HOUSE;
+			building.cell = Cell( x, z );
+			building.tileSizeX = 2;
+			building.tileSizeZ = 2;
+			ng::DynamicArray< Cell > roads;
+			GetRoadCellsAroundBuilding( building, map, roads );
+			if ( roads.Empty() ) {
+				continue;
+			}
+			for ( u32 bx = x; bx < x + 2; bx++ ) {
+				for ( u32 bz = z; bz < z + 2; bz++ ) {
+					map.SetTile( bx, bz, MapTile::BLOCKED );
+				}
+			}
+			suiteMap.buildings.PushBack( building );
+		}
+	}
+}
+
+template < typename Generate > static std::unique_ptr< PathSuiteMap > BuildPathSuiteMap( Generate generate ) {
+	auto  suiteMap = std::make_unique< PathSuiteMap >();
+	Map & map = suiteMap->map;
+	map.AllocateGrid( PATH_SUITE_MAP_SIZE, PATH_SUITE_MAP_SIZE );
+	// Map edits patch theGame road network, it is moved to the suite map once everything is in place
+	theGame->roadNetwork = RoadNetwork();
+	map.BeginEdit();
+	generate( map );
+	PlaceSuiteBuildings( *suiteMap );
+	map.CommitEdit();
+	suiteMap->network = std::move( theGame->roadNetwork );
+	theGame->roadNetwork = RoadNetwork();
+
+	SampleCellQueries( map, false, suiteMap->cellQueries );
+	SampleCellQueries( map, true, suiteMap->roadQueries );
+	SampleBuildingQueries( *suiteMap, false, suiteMap->buildingQueries );
+	SampleBuildingQueries( *suiteMap, true, suiteMap->cellToBuildingQueries );
+	return suiteMap;
+}
+
+static void GenerateGridCity( Map & map ) {
+	for ( u32 x = 0; x < map.sizeX; x++ ) {
+		for ( u32 z = 0; z < map.sizeZ; z++ ) {
+			if ( x % 10 == 0 || z % 10 == 0 ) {
 				map.SetTile( x, z, MapTile::ROAD );
+			}
+		}
+	}
+}
+
+// Roads branch out of the ones already built and wander, turning from time to time
+static void GenerateOrganicRoads( Map & map ) {
+	constexpr int                           moves[ 4 ][ 2 ] = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 } };
+	std::default_random_engine              generator( 7 );
+	std::uniform_real_distribution< float > randomFloats( 0.0f, 1.0f );
+
+	ng::DynamicArray< Cell > roads;
+	roads.PushBack( Cell( map.sizeX / 2, map.sizeZ / 2 ) );
+	map.SetTile( roads[ 0 ], MapTile::ROAD );
+	for ( u32 i = 0; i < 150; i++ ) {
+		Cell cell = roads[ generator() % roads.Size() ];
+		u32  direction = generator() % 4;
+		for ( u32 step = 0; step < 40; step++ ) {
+			if ( randomFloats( generator ) < 0.15f ) {
+				direction = ( direction + ( generator() % 2 == 0 ? 1 : 3 ) ) % 4;
+			}
+			int64 x = ( int64 )cell.x + moves[ direction ][ 0 ];
+			int64 z = ( int64 )cell.z + moves[ direction ][ 1 ];
+			if ( !map.IsValidTile( x, z ) ) {
+				break;
+			}
+			cell = Cell( ( u32 )x, ( u32 )z );
+			if ( map.GetTile( cell ) != MapTile::ROAD ) {
+				map.SetTile( cell, MapTile::ROAD );
+				roads.PushBack( cell );
+			}
+		}
+	}
+}
+
+// Perfect maze carved with a depth first search, corridors are roads and walls are blocked
+static void GenerateMaze( Map & map ) {
+	constexpr int              moves[ 4 ][ 2 ] = { { 2, 0 }, { 0, 2 }, { -2, 0 }, { 0, -2 } };
+	std::default_random_engine generator( 3 );
+	for ( u32 x = 0; x < map.sizeX; x++ ) {
+		for ( u32 z = 0; z < map.sizeZ; z++ ) {
+			map.SetTile( x, z, MapTile::BLOCKED );
+		}
+	}
+
+	ng::DynamicArray< Cell > stack;
+	stack.PushBack( Cell( 0, 0 ) );
+	map.SetTile( Cell( 0, 0 ), MapTile::ROAD );
+	while ( !stack.Empty() ) {
+		Cell                       cell = stack.Last();
+		ng::StaticArray< Cell, 4 > unvisited;
+		for ( const auto & move : moves ) {
+			int64 x = ( int64 )cell.x + move[ 0 ];
+			int64 z = ( int64 )cell.z + move[ 1 ];
+			if ( map.IsValidTile( x, z ) && map.GetTile( ( u32 )x, ( u32 )z ) == MapTile::BLOCKED ) {
+				unvisited.PushBack( Cell( ( u32 )x, ( u32 )z ) );
+			}
+		}
+		if ( unvisited.Size() == 0 ) {
+			stack.PopBack();
+			continue;
 		}
+		Cell next = unvisited[ generator() % unvisited.Size() ];
+		map.SetTile( Cell( ( cell.x + next.x ) / 2, ( cell.z + next.z ) / 2 ), MapTile::ROAD );
+		map.SetTile( next, MapTile::ROAD );
+		stack.PushBack( next );
+	}
+}
+
+static PathSuiteMap & GetPathSuiteMap( PathSuiteFamily family ) {
+	static std::unique_ptr< PathSuiteMap > maps[ ( int )PathSuiteFamily::NUM_FAMILIES ];
+	std::unique_ptr< PathSuiteMap > &      suiteMap = maps[ ( int )family ];
+	if ( suiteMap == nullptr ) {
+		switch ( family ) {
+		case PathSuiteFamily::GRID_CITY:
+			suiteMap = BuildPathSuiteMap( GenerateGridCity );
+			break;
+		case PathSuiteFamily::ORGANIC_ROADS:
+			suiteMap = BuildPathSuiteMap( GenerateOrganicRoads );
+			break;
+		case PathSuiteFamily::MAZE:
+			suiteMap = BuildPathSuiteMap( GenerateMaze );
+			break;
+		case PathSuiteFamily::FOREST:
+			suiteMap = BuildPathSuiteMap( GenerateSimplexForest );
+			break;
+		default:
+			ng_assert( false );
+		}
+	}
+	return *suiteMap;
+}
+
+// runQuery returns true when a path was found and sets its length
+template < typename RunQuery >
+static void RunPathQueries( benchmark::State & state, const ng::DynamicArray< PathQuery > & queries, RunQuery runQuery ) {
+	if ( queries.Empty() ) {
+		state.SkipWithError( "no query could be sampled on this map" );
+		return;
+	}
+
+	u32    numFound = 0;
+	double lengthRatio = 0.0;
+	for ( const PathQuery & query : queries ) {
+		u32 length = 0;
+		if ( runQuery( query, length ) ) {
+			numFound++;
+			lengthRatio += ( double )length / query.shortestDistance;
+		}
+	}
+
+	pathfindingCounters = PathfindingCounters();
+	for ( auto _ : state ) {
+		for ( const PathQuery & query : queries ) {
+			u32 length = 0;
+			benchmark::DoNotOptimize( runQuery( query, length ) );
+		}
+	}
+
+	double numQueries = ( double )state.iterations() * queries.Size();
+	state.SetItemsProcessed( state.iterations() * queries.Size() );
+	state.counters[ "expanded" ] = pathfindingCounters.nodesExpanded / numQueries;
+	state.counters[ "bytes" ] = pathfindingCounters.bytesUsed / numQueries;
+	state.counters[ "found" ] = ( double )numFound / queries.Size();
+	state.counters[ "optimality" ] = numFound > 0 ? lengthRatio / numFound : 0.0;
+}
+
+static void RunAStarQueries( benchmark::State & state, const Map & map, const ng::DynamicArray< PathQuery > & queries ) {
+	ng::DynamicArray< Cell > path;
+	RunPathQueries( state, queries, [ & ]( const PathQuery & query, u32 & length ) {
+		bool found = AStar( query.start, query.goal, ASTAR_FORBID_DIAGONALS, map, path );
+		length = found ? path.Size() - 1 : 0;
+		return found;
+	} );
+}
+
+static void BM_PathSuiteAStar( benchmark::State & state, PathSuiteFamily family ) {
+	const PathSuiteMap & suiteMap = GetPathSuiteMap( family );
+	RunAStarQueries( state, suiteMap.map, suiteMap.cellQueries );
+}
+
+static void BM_PathSuiteRoadNetwork( benchmark::State & state, PathSuiteFamily family ) {
+	const PathSuiteMap &     suiteMap = GetPathSuiteMap( family );
+	ng::DynamicArray< Cell > path;
+	RunPathQueries( state, suiteMap.roadQueries, [ & ]( const PathQuery & query, u32 & length ) {
+		return suiteMap.network.FindPath( query.start, query.goal, suiteMap.map, path, &length );
+	} );
+}
+
+static void BM_PathSuiteBetweenBuildings( benchmark::State & state, PathSuiteFamily family ) {
+	const PathSuiteMap &     suiteMap = GetPathSuiteMap( family );
+	ng::DynamicArray< Cell > path;
+	RunPathQueries( state, suiteMap.buildingQueries, [ & ]( const PathQuery & query, u32 & length ) {
+		return FindPathBetweenBuildings( suiteMap.buildings[ query.startBuilding ],
+		                                 suiteMap.buildings[ query.goalBuilding ], suiteMap.map, suiteMap.network,
+		                                 path, ULONG_MAX, &length );
+	} );
+}
+
+static void BM_PathSuiteCellToBuilding( benchmark::State & state, PathSuiteFamily family ) {
+	const PathSuiteMap &     suiteMap = GetPathSuiteMap( family );
+	ng::DynamicArray< Cell > path;
+	RunPathQueries( state, suiteMap.cellToBuildingQueries, [ & ]( const PathQuery & query, u32 & length ) {
+		return FindPathFromCellToBuilding( query.start, suiteMap.buildings[ query.goalBuilding ], suiteMap.map,
+		                                   suiteMap.network, path, ULONG_MAX, &length );
+	} );
+}
+
+BENCHMARK_CAPTURE( BM_PathSuiteAStar, grid_city, PathSuiteFamily::GRID_CITY );
+BENCHMARK_CAPTURE( BM_PathSuiteAStar, organic_roads, PathSuiteFamily::ORGANIC_ROADS );
+BENCHMARK_CAPTURE( BM_PathSuiteAStar, maze, PathSuiteFamily::MAZE );
+BENCHMARK_CAPTURE( BM_PathSuiteAStar, forest, PathSuiteFamily::FOREST );
+BENCHMARK_CAPTURE( BM_PathSuiteRoadNetwork, grid_city, PathSuiteFamily::GRID_CITY );
+BENCHMARK_CAPTURE( BM_PathSuiteRoadNetwork, organic_roads, PathSuiteFamily::ORGANIC_ROADS );
+BENCHMARK_CAPTURE( BM_PathSuiteRoadNetwork, maze, PathSuiteFamily::MAZE );
+BENCHMARK_CAPTURE( BM_PathSuiteBetweenBuildings, grid_city, PathSuiteFamily::GRID_CITY );
+BENCHMARK_CAPTURE( BM_PathSuiteBetweenBuildings, organic_roads, PathSuiteFamily::ORGANIC_ROADS );
+BENCHMARK_CAPTURE( BM_PathSuiteCellToBuilding, grid_city, PathSuiteFamily::GRID_CITY );
+BENCHMARK_CAPTURE( BM_PathSuiteCellToBuilding, organic_roads, PathSuiteFamily::ORGANIC_ROADS );
+
+// Moving AI benchmark maps (https://movingai.com/benchmarks/grids.html) are not shipped with the game
+// Set VULCAIN_MOVINGAI_DIR to a folder of .map files to add them to the suite, the start and goal pairs are read from
+// the .map.scen file next to them when there is one. Trees stay trees, every other obstacle is blocked
+static bool LoadMovingAIMap( const std::string & path, PathSuiteMap & suiteMap ) {
+	ng::File file;
+	if ( !file.Open( path.c_str(), ng::File::MODE_READ ) ) {
+		return false;
+	}
+	std::string content( file.GetSize(), '\0' );
+	file.Read( content.data(), content.size() );
+	file.Close();
+
+	std::istringstream stream( content );
+	std::string        keyword;
+	u32                width = 0;
+	u32                height = 0;
+	while ( stream >> keyword && keyword != "map" ) {
+		if ( keyword == "width" ) {
+			stream >> width;
+		} else if ( keyword == "height" ) {
+			stream >> height;
+		} else if ( keyword == "type" ) {
+			stream >> keyword;
+		}
+	}
+	if ( width == 0 || height == 0 ) {
+		return false;
+	}
+
+	Map & map = suiteMap.map;
+	map.AllocateGrid( width, height );
+	map.BeginEdit();
+	std::string row;
+	for ( u32 z = 0; z < height && stream >> row; z++ ) {
+		for ( u32 x = 0; x < width && x < row.size(); x++ ) {
+			char terrain = row[ x ];
+			if ( terrain == 'T' ) {
+				map.SetTile( x, z, MapTile::TREE );
+			} else if ( terrain != '.' && terrain != 'G' && terrain != 'S' ) {
+				map.SetTile( x, z, MapTile::BLOCKED );
+			}
+		}
+	}
+	map.CommitEdit();
+
+	ng::File scenarioFile;
+	if ( scenarioFile.Open( ( path + ".scen" ).c_str(), ng::File::MODE_READ ) ) {
+		std::string scenario( scenarioFile.GetSize(), '\0' );
+		scenarioFile.Read( scenario.data(), scenario.size() );
+		scenarioFile.Close();
+
+		// Lines are "bucket map width height startX startY goalX goalY optimalLength", after a version line
+		ng::DynamicArray< PathQuery > candidates;
+		std::istringstream            lines( scenario );
+		std::string                   line;
+		std::getline( lines, line );
+		while ( std::getline( lines, line ) ) {
+			std::istringstream fields( line );
+			std::string        bucket, mapName;
+			u32                mapWidth, mapHeight, startX, startY, goalX, goalY;
+			if ( fields >> bucket >> mapName >> mapWidth >> mapHeight >> startX >> startY >> goalX >> goalY &&
+			     map.IsValidTile( startX, startY ) && map.IsValidTile( goalX, goalY ) ) {
+				PathQuery query;
+				query.start = Cell( startX, startY );
+				query.goal = Cell( goalX, goalY );
+				candidates.PushBack( query );
+			}
+		}
+		// Scenarios are sorted by length, take some all along. Their lengths allow diagonals, ours don't
+		ng::DynamicArray< Cell > start( 1 );
+		std::vector< u32 >       distances;
+		for ( u32 i = 0; i < PATH_SUITE_NUM_QUERIES && candidates.Size() > 0; i++ ) {
+			PathQuery query = candidates[ ( u64 )i * candidates.Size() / PATH_SUITE_NUM_QUERIES ];
+			start.Clear();
+			start.PushBack( query.start );
+			ComputeWalkingDistances( map, start, false, distances );
+			query.shortestDistance = distances[ ( u64 )query.goal.x * map.sizeZ + query.goal.z ];
+			if ( map.IsTileAStarNavigable( query.start ) && query.shortestDistance != ( u32 )-1 &&
+			     query.shortestDistance > 0 ) {
+				suiteMap.cellQueries.PushBack( query );
+			}
+		}
+	} else {
+		SampleCellQueries( map, false, suiteMap.cellQueries );
+	}
+	return true;
+}
+
+static void RegisterMovingAIBenchmarks() {
+	const char * directory = getenv( "VULCAIN_MOVINGAI_DIR" );
+	if ( directory == nullptr ) {
+		return;
+	}
+	std::vector< std::string > files;
+	if ( !ng::ListFilesInDirectory( directory, files ) ) {
+		ng::Errorf( "Could not list Moving AI maps in %s\n", directory );
+		return;
+	}
+	for ( const std::string & path : files ) {
+		if ( !path.ends_with( ".map" ) ) {
+			continue;
+		}
+		std::string name = "BM_PathSuiteAStar/movingai:" + path.substr( path.find_last_of( "/\\" ) + 1 );
+		benchmark::RegisterBenchmark( name.c_str(), [ path ]( benchmark::State & state ) {
+			static std::unordered_map< std::string, std::unique_ptr< PathSuiteMap > > maps;
+			std::unique_ptr< PathSuiteMap > &                                         suiteMap = maps[ path ];
+			if ( suiteMap == nullptr ) {
+				suiteMap = std::make_unique< PathSuiteMap >();
+				if ( !LoadMovingAIMap( path, *suiteMap ) ) {
+					state.SkipWithError( "could not read the map" );
+					return;
+				}
+			}
+			RunAStarQueries( state, suiteMap->map, suiteMap->cellQueries );
+		} );
+	}
+}
+
+static constexpr u32 numMovingAgents = 100000;
+
+// Agents all over the place, walking toward a corner far enough so nobody arrives during the benchmark
+static void SpreadAgents( ng::DynamicArray< CpntTransform > & transforms, ng::DynamicArray< CpntNavAgent > & agents ) {
+	std::uniform_int_distribution< u32 > randomCells( 0, 1000 );
+	std::default_random_engine           generator;
+	for ( u32 i = 0; i < numMovingAgents; i++ ) {
+		CpntTransform & transform = transforms.AllocateOne();
+		transform.SetTranslation( GetPointInMiddleOfCell( Cell( randomCells( generator ), randomCells( generator ) ) ) );
+		CpntNavAgent & agent = agents.AllocateOne();
+		agent.pathfindingNextSteps.PushBack( Cell( 100000, randomCells( generator ) ) );
+	}
+}
+
+// What SystemNavAgent used to do for every agent
+static void BM_MoveAgentsOneByOne( benchmark::State & state ) {
+	ng::DynamicArray< CpntTransform > transforms( numMovingAgents );
+	ng::DynamicArray< CpntNavAgent >  agents( numMovingAgents );
+	SpreadAgents( transforms, agents );
+
+	for ( auto _ : state ) {
+		for ( u32 i = 0; i < numMovingAgents; i++ ) {
+			CpntTransform & transform = transforms[ i ];
+			CpntNavAgent &  agent = agents[ i ];
+			glm::vec3       nextCoord = GetPointInMiddleOfCell( agent.pathfindingNextSteps.Last() );
+			float           distance = glm::distance( transform.GetTranslation(), nextCoord );
+			if ( distance > agent.movementSpeed ) {
+				glm::vec3 direction = glm::normalize( nextCoord - transform.GetTranslation() );
+				transform.Translate( direction * agent.movementSpeed );
+			} else {
+				transform.SetTranslation( nextCoord );
+			}
+		}
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed( state.iterations() * numMovingAgents );
+}
+
+BENCHMARK( BM_MoveAgentsOneByOne );
+
+// Same thing through the batches of SystemNavAgent
+static void BM_MoveAgentsBatched( benchmark::State & state ) {
+	ng::DynamicArray< CpntTransform > transforms( numMovingAgents );
+	ng::DynamicArray< CpntNavAgent >  agents( numMovingAgents );
+	SpreadAgents( transforms, agents );
+
+	SystemNavAgent system;
+	for ( auto _ : state ) {
+		for ( u32 i = 0; i < numMovingAgents; i++ ) {
+			system.batch.Add( INVALID_ENTITY, agents[ i ], transforms[ i ], agents[ i ].movementSpeed );
+			if ( system.batch.IsFull() ) {
+				system.MoveBatch();
+			}
+		}
+		system.MoveBatch();
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed( state.iterations() * numMovingAgents );
+}
+
+BENCHMARK( BM_MoveAgentsBatched );
+
+// Only the movement pass, agents already packed
+static void BM_MoveAgentsKernel( benchmark::State & state ) {
+	ng::DynamicArray< CpntTransform > transforms( numMovingAgents );
+	ng::DynamicArray< CpntNavAgent >  agents( numMovingAgents );
+	SpreadAgents( transforms, agents );
+
+	ng::DynamicArray< float > posX( numMovingAgents ), posZ( numMovingAgents ), targetX( numMovingAgents ),
+	    targetZ( numMovingAgents ), step( numMovingAgents );
+	for ( u32 i = 0; i < numMovingAgents; i++ ) {
+		glm::vec3 target = GetPointInMiddleOfCell( agents[ i ].pathfindingNextSteps.Last() );
+		posX.PushBack( transforms[ i ].GetTranslation().x );
+		posZ.PushBack( transforms[ i ].GetTranslation().z );
+		targetX.PushBack( target.x );
+		targetZ.PushBack( target.z );
+		step.PushBack( agents[ i ].movementSpeed );
+	}
+	for ( auto _ : state ) {
+		MoveAgentsTowardTargets( posX.data, posZ.data, targetX.data, targetZ.data, step.data, numMovingAgents );
+		state.PauseTiming();
+		for ( u32 i = 0; i < numMovingAgents; i++ ) {
+			step[ i ] = agents[ i ].movementSpeed;
+		}
+		state.ResumeTiming();
+	}
+	state.SetItemsProcessed( state.iterations() * numMovingAgents );
+}
+
+BENCHMARK( BM_MoveAgentsKernel );
+
+// The whole SystemNavAgent::Update, the registery can't hold more than INITIAL_ENTITY_ALLOC entities
+static void BM_SystemNavAgentUpdate( benchmark::State & state ) {
+	constexpr u32 numAgents = 4000;
+	SystemManager systemManager;
+	systemManager.CreateSystem< System< CpntTransform > >();
+	SystemNavAgent & system = systemManager.CreateSystem< SystemNavAgent >();
+	Registery        reg( &systemManager );
+
+	std::uniform_int_distribution< u32 > randomCells( 0, 1000 );
+	std::default_random_engine           generator;
+	for ( u32 i = 0; i < numAgents; i++ ) {
+		Entity         e = reg.CreateEntity();
+		CpntNavAgent & agent = reg.AssignComponent< CpntNavAgent >( e );
+		agent.pathfindingNextSteps.PushBack( Cell( 100000, 100000 ) );
+		agent.pathfindingNextSteps.PushBack( Cell( 100000, randomCells( generator ) ) );
+		reg.AssignComponent< CpntTransform >( e ).SetTranslation(
+		    GetPointInMiddleOfCell( Cell( randomCells( generator ), randomCells( generator ) ) ) );
 	}
+	reg.FlushCreationQueues();
 
-	ng::DynamicArray<Cell> out;
 	for ( auto _ : state ) {
-		AStar( Cell( 34, 30 ), Cell( 164, 90 ), ASTAR_FORBID_DIAGONALS, map, out );
+		system.Update( reg, 1 );
 	}
+	state.SetItemsProcessed( state.iterations() * numAgents );
 }
 
-BENCHMARK( BM_AStar );
+BENCHMARK( BM_SystemNavAgentUpdate );
 
 static void BM_ngBitfieldSet( benchmark::State & state ) {
 	ng::Bitfield64 field;
@@ -131,6 +888,11 @@ static void BM_objectPoolCreation( benchmark::State & state ) {
 BENCHMARK( BM_objectPoolCreation );
 
 static void BM_stlLinkedListInsertion( benchmark::State & state ) {
+	// Local so that it does not clash with the renderer's Texture
+	struct Texture {
+		char data[ 400 ];
+		int  encoding[ 16 ];
+	};
 	for ( auto _ : state ) {
 		std::list< Texture > list;
 		for ( int i = 0; i < 64 * 20; i++ ) {
@@ -222,6 +984,7 @@ BENCHMARK( BM_ngVectorInsertion );
 
 int RunBenchmarks( int argc, char ** argv ) {
 	::benchmark::Initialize( &argc, argv );
+	RegisterMovingAIBenchmarks();
 	if ( ::benchmark::ReportUnrecognizedArguments( argc, argv ) ) {
 		return 1;
 	}
@@ -41,3 +41,29 @@ TEST_CASE( "Linked list", "[linked lists]" ) {
 		REQUIRE( index == 3 );
 	}
 }
+
+TEST_CASE( "Dynamic array", "[dynamic array]" ) {
+	SECTION( "moving hands over the buffer" ) {
+		ng::DynamicArray< int > array;
+		array.PushBack( 1 );
+		array.PushBack( 2 );
+		int * buffer = array.data;
+
+		ng::DynamicArray< int > moved( std::move( array ) );
+		REQUIRE( moved.data == buffer );
+		REQUIRE( moved.Size() == 2 );
+		REQUIRE( array.data == nullptr );
+		REQUIRE( array.Empty() );
+
+		ng::DynamicArray< int > assigned;
+		assigned.PushBack( 3 );
+		assigned = std::move( moved );
+		REQUIRE( assigned.data == buffer );
+		REQUIRE( assigned[ 1 ] == 2 );
+		REQUIRE( moved.Capacity() == 0 );
+
+		// A moved from array can be used again
+		moved.PushBack( 4 );
+		REQUIRE( moved.Size() == 1 );
+	}
+}
@@ -1,4 +1,5 @@
 #include "../src/buildings/building.h"
+#include "../src/buildings/logistics.h"
 #include "../src/game.h"
 #include "../src/registery.h"
 #include <catch.hpp>
@@ -45,4 +46,260 @@ TEST_CASE( "Removed entities will be reallocated", "[bump entity version]" ) {
 		entitiesAlive.PushBack( a );
 		theGame->systemManager.Update( reg, 1 );
 	}
-}
\ No newline at end of file
+}
+TEST_CASE( "Labor market", "[workers]" ) {
+	theGame = new Game();
+	theGame->registery = new Registery( &theGame->systemManager );
+	SystemBuilding & system = theGame->systemManager.CreateSystem< SystemBuilding >();
+	theGame->map.AllocateGrid( 200, 200 );
+	Registery & reg = *theGame->registery;
+
+	Entity buildings[ 3 ];
+	u32    workersNeeded[ 3 ] = { 2, 1, 2 };
+	for ( u32 i = 0; i < 3; i++ ) {
+		buildings[ i ] = reg.CreateEntity();
+		reg.AssignComponent< CpntBuilding >( buildings[ i ] ).workersNeeded = workersNeeded[ i ];
+	}
+	theGame->systemManager.Update( reg, 1 );
+	REQUIRE( system.totalEmployeesNeeded == 5 );
+
+	for ( u32 i = 0; i < 4; i++ ) {
+		PostMsgGlobal( MESSAGE_WORKER_AVAILABLE );
+	}
+	theGame->systemManager.Update( reg, 1 );
+	// First fit in the order the buildings were created
+	REQUIRE( reg.GetComponent< CpntBuilding >( buildings[ 0 ] ).workersEmployed == 2 );
+	REQUIRE( reg.GetComponent< CpntBuilding >( buildings[ 1 ] ).workersEmployed == 1 );
+	REQUIRE( reg.GetComponent< CpntBuilding >( buildings[ 2 ] ).workersEmployed == 1 );
+	REQUIRE( system.totalEmployed == 4 );
+	REQUIRE( system.totalEmployeesNeeded == 1 );
+
+	// The worker of the removed building moves to the last vacancy
+	reg.MarkForDelete( buildings[ 1 ] );
+	theGame->systemManager.Update( reg, 1 );
+	theGame->systemManager.Update( reg, 1 );
+	REQUIRE( reg.GetComponent< CpntBuilding >( buildings[ 2 ] ).workersEmployed == 2 );
+	REQUIRE( system.totalUnemployed == 0 );
+	REQUIRE( system.totalEmployeesNeeded == 0 );
+
+	PostMsgGlobal( MESSAGE_WORKER_REMOVED );
+	PostMsgGlobal( MESSAGE_WORKER_AVAILABLE );
+	PostMsgGlobal( MESSAGE_WORKER_AVAILABLE );
+	theGame->systemManager.Update( reg, 1 );
+	REQUIRE( reg.GetComponent< CpntBuilding >( buildings[ 0 ] ).workersEmployed == 2 );
+	REQUIRE( system.totalEmployed == 4 );
+	REQUIRE( system.totalUnemployed == 1 );
+}
+
+TEST_CASE( "Logistics index", "[logistics]" ) {
+	Map map;
+	map.AllocateGrid( 256, 256 );
+	LogisticsIndex logistics;
+
+	auto makeStorage = []( Cell cell ) {
+		CpntBuilding building{ BuildingKind::STORAGE_HOUSE, cell, 2, 2 };
+		return building;
+	};
+	CpntResourceInventory inventory;
+	inventory.SetResourceMaxCapacity( GameResource::WHEAT, 8 );
+	inventory.SetResourceMaxCapacity( GameResource::WOOD, 8 );
+
+	Entity near{ 1, 0 };
+	Entity far{ 2, 0 };
+	Entity veryFar{ 3, 0 };
+	logistics.AddStorage( near, makeStorage( Cell( 20, 20 ) ), inventory, map );
+	logistics.AddStorage( far, makeStorage( Cell( 100, 20 ) ), inventory, map );
+	logistics.AddStorage( veryFar, makeStorage( Cell( 250, 250 ) ), inventory, map );
+	REQUIRE( logistics.GetTotalCapacity( GameResource::WHEAT ) == 24 );
+	REQUIRE( logistics.GetTotalStock( GameResource::WHEAT ) == 0 );
+
+	CpntBuilding origin{ BuildingKind::MARKET, Cell( 10, 10 ), 2, 2 };
+
+	SECTION( "storages are found nearest first" ) {
+		ng::DynamicArray< Entity > found;
+		logistics.FindStorages( GameResource::WHEAT, true, origin, ULONG_MAX, found );
+		REQUIRE( found.Size() == 3 );
+		REQUIRE( found[ 0 ] == near );
+		REQUIRE( found[ 1 ] == far );
+		REQUIRE( found[ 2 ] == veryFar );
+
+		found.Clear();
+		logistics.FindStorages( GameResource::WHEAT, true, origin, 64, found );
+		REQUIRE( found.Size() == 1 );
+		REQUIRE( found[ 0 ] == near );
+
+		found.Clear();
+		logistics.FindStorages( GameResource::WHEAT, false, origin, ULONG_MAX, found );
+		REQUIRE( found.Size() == 0 );
+	}
+
+	SECTION( "inventory changes move storages between lists" ) {
+		CpntResourceInventory farInventory = inventory;
+		farInventory.StoreRessource( GameResource::WOOD, 8 );
+		logistics.Refresh( far, farInventory );
+		REQUIRE( logistics.GetTotalStock( GameResource::WOOD ) == 8 );
+		REQUIRE( logistics.GetTotalCapacity( GameResource::WOOD ) == 16 );
+
+		ng::DynamicArray< Entity > found;
+		logistics.FindStorages( GameResource::WOOD, false, origin, ULONG_MAX, found );
+		REQUIRE( found.Size() == 1 );
+		REQUIRE( found[ 0 ] == far );
+		found.Clear();
+		logistics.FindStorages( GameResource::WOOD, true, origin, ULONG_MAX, found );
+		REQUIRE( found.Size() == 2 );
+
+		// Not a storage, nothing happens
+		logistics.Refresh( Entity{ 4, 0 }, farInventory );
+		REQUIRE( logistics.GetTotalStock( GameResource::WOOD ) == 8 );
+
+		logistics.RemoveStorage( far );
+		REQUIRE( logistics.GetTotalStock( GameResource::WOOD ) == 0 );
+		REQUIRE( logistics.GetTotalCapacity( GameResource::WOOD ) == 16 );
+		REQUIRE( !logistics.IsStorage( far ) );
+	}
+}
+
+TEST_CASE( "Storage house display", "[storage house]" ) {
+	SECTION( "keyed instances are found after others moved" ) {
+		InstancedModelBatch batch;
+		auto                translation = []( float x ) {
+			glm::mat4 transform( 1.0f );
+			transform[ 3 ][ 0 ] = x;
+			return transform;
+		};
+		batch.AddInstance( Entity{ 1, 0 }, translation( 0.0f ) );
+		batch.AddInstanceWithKey( 10, translation( 10.0f ) );
+		batch.AddInstanceWithKey( 11, translation( 11.0f ) );
+		batch.AddInstanceWithKey( 12, translation( 12.0f ) );
+		REQUIRE( batch.instances.Size() == 4 );
+
+		// Same key, the instance is moved
+		batch.AddInstanceWithKey( 11, translation( 21.0f ) );
+		REQUIRE( batch.instances.Size() == 4 );
+
+		// The last instance takes the place of the removed ones
+		REQUIRE( batch.RemoveInstance( Entity{ 1, 0 } ) );
+		REQUIRE( batch.RemoveInstanceWithKey( 10 ) );
+		REQUIRE( !batch.RemoveInstanceWithKey( 10 ) );
+		REQUIRE( batch.instances.Size() == 2 );
+		for ( auto [ key, index ] : batch.instanceOfKey ) {
+			REQUIRE( batch.instances[ index ].key == key );
+			REQUIRE( batch.instances[ index ].transform[ 3 ][ 0 ] == ( key == 11 ? 21.0f : 12.0f ) );
+		}
+		REQUIRE( batch.RemoveInstanceWithKey( 11 ) );
+		REQUIRE( batch.RemoveInstanceWithKey( 12 ) );
+		REQUIRE( batch.instances.Empty() );
+		REQUIRE( batch.instanceOfKey.empty() );
+	}
+
+	SECTION( "slots are filled in order" ) {
+		CpntResourceInventory inventory;
+		inventory.SetResourceMaxCapacity( GameResource::WHEAT, 16 );
+		inventory.SetResourceMaxCapacity( GameResource::WOOD, 16 );
+		inventory.StoreRessource( GameResource::WHEAT, 2 );
+		inventory.StoreRessource( GameResource::WOOD, 1 );
+
+		GameResource slots[ CpntStorageHouse::MAX_RESOURCES ];
+		SystemStorageHouse::ComputeDisplayedResources( inventory, slots );
+		REQUIRE( slots[ 0 ] == GameResource::WHEAT );
+		REQUIRE( slots[ 1 ] == GameResource::WHEAT );
+		REQUIRE( slots[ 2 ] == GameResource::WOOD );
+		REQUIRE( slots[ 3 ] == GameResource::NUM_RESOURCES );
+
+		inventory.StoreRessource( GameResource::WOOD, 15 );
+		SystemStorageHouse::ComputeDisplayedResources( inventory, slots );
+		REQUIRE( slots[ 2 ] == GameResource::WOOD );
+		REQUIRE( slots[ CpntStorageHouse::MAX_RESOURCES - 1 ] == GameResource::WOOD );
+	}
+}
+
+struct CpntInventoryWatcher {};
+struct SystemInventoryWatcher : public System< CpntInventoryWatcher > {
+	SystemInventoryWatcher() {
+		ListenToGlobal( MESSAGE_INVENTORY_UPDATE );
+		ListenToGlobal( MESSAGE_INVENTORY_TRANSACTION_COMPLETED );
+	}
+	virtual void HandleMessage( Registery & reg, const Message & msg ) override {
+		if ( msg.type == MESSAGE_INVENTORY_UPDATE ) {
+			updates.PushBack( msg.recipient );
+		} else {
+			completions.PushBack( msg.recipient );
+		}
+	}
+	u32 Count( const ng::DynamicArray< Entity > & messages, Entity e ) const {
+		u32 count = 0;
+		for ( Entity recipient : messages ) {
+			count += recipient == e;
+		}
+		return count;
+	}
+
+	ng::DynamicArray< Entity > updates;
+	ng::DynamicArray< Entity > completions;
+};
+
+TEST_CASE( "Inventory transactions", "[inventory]" ) {
+	theGame = new Game();
+	theGame->registery = new Registery( &theGame->systemManager );
+	theGame->systemManager.CreateSystem< SystemResourceInventory >();
+	SystemInventoryWatcher & watcher = theGame->systemManager.CreateSystem< SystemInventoryWatcher >();
+	Registery &              reg = *theGame->registery;
+
+	auto createInventory = [ & ]( u32 capacity, u32 wheat ) {
+		Entity e = reg.CreateEntity();
+		auto & inventory = reg.AssignComponent< CpntResourceInventory >( e );
+		inventory.SetResourceMaxCapacity( GameResource::WHEAT, capacity );
+		inventory.SetResourceMaxCapacity( GameResource::WOOD, capacity );
+		inventory.StoreRessource( GameResource::WHEAT, wheat );
+		return e;
+	};
+	Entity market = createInventory( 8, 5 );
+	Entity house = createInventory( 3, 0 );
+	Entity otherHouse = createInventory( 4, 0 );
+	theGame->systemManager.Update( reg, 1 );
+
+	SECTION( "a giver serves transactions in the order they were posted" ) {
+		PostTransactionMessage( GameResource::WHEAT, 3, true, house, market );
+		PostTransactionMessage( GameResource::WHEAT, 4, true, otherHouse, market );
+		PostTransactionMessage( GameResource::WHEAT, 4, true, otherHouse, market );
+		theGame->systemManager.Update( reg, 1 );
+		REQUIRE( reg.GetComponent< CpntResourceInventory >( market ).GetResourceAmount( GameResource::WHEAT ) == 0 );
+		REQUIRE( reg.GetComponent< CpntResourceInventory >( house ).GetResourceAmount( GameResource::WHEAT ) == 3 );
+		REQUIRE( reg.GetComponent< CpntResourceInventory >( otherHouse ).GetResourceAmount( GameResource::WHEAT ) ==
+		         2 );
+
+		// One message per inventory for the whole batch
+		REQUIRE( watcher.updates.Size() == 3 );
+		REQUIRE( watcher.Count( watcher.updates, market ) == 1 );
+		REQUIRE( watcher.Count( watcher.updates, house ) == 1 );
+		REQUIRE( watcher.Count( watcher.updates, otherHouse ) == 1 );
+		REQUIRE( watcher.completions.Size() == 1 );
+		REQUIRE( watcher.completions[ 0 ] == market );
+	}
+
+	SECTION( "what can't be stored goes back if the giver accepts it" ) {
+		PostTransactionMessage( GameResource::WHEAT, 5, true, house, market );
+		theGame->systemManager.Update( reg, 1 );
+		REQUIRE( reg.GetComponent< CpntResourceInventory >( market ).GetResourceAmount( GameResource::WHEAT ) == 2 );
+		PostTransactionMessage( GameResource::WHEAT, 2, false, house, market );
+		theGame->systemManager.Update( reg, 1 );
+		REQUIRE( reg.GetComponent< CpntResourceInventory >( market ).GetResourceAmount( GameResource::WHEAT ) == 0 );
+		REQUIRE( reg.GetComponent< CpntResourceInventory >( house ).GetResourceAmount( GameResource::WHEAT ) == 3 );
+	}
+
+	SECTION( "full transactions and missing inventories" ) {
+		Entity deliveryGuy = createInventory( 1, 1 );
+		reg.MarkForDelete( deliveryGuy );
+		theGame->systemManager.Update( reg, 1 );
+
+		reg.GetComponent< CpntResourceInventory >( house ).StoreRessource( GameResource::WOOD, 2 );
+		PostMsg( MESSAGE_FULL_INVENTORY_TRANSACTION, market, house );
+		PostMsg( MESSAGE_FULL_INVENTORY_TRANSACTION, market, deliveryGuy );
+		theGame->systemManager.Update( reg, 1 );
+		REQUIRE( reg.GetComponent< CpntResourceInventory >( market ).GetResourceAmount( GameResource::WOOD ) == 2 );
+		REQUIRE( reg.GetComponent< CpntResourceInventory >( house ).IsEmpty() );
+		REQUIRE( watcher.updates.Size() == 2 );
+		REQUIRE( watcher.completions.Size() == 1 );
+		REQUIRE( watcher.completions[ 0 ] == house );
+	}
+}
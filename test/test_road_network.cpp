@@ -1,6 +1,10 @@
 #include "../src/game.h"
+#include "environment/trees.h"
 #include "navigation.h"
+#include "pathfinding_job.h"
 #include <catch.hpp>
+#include <queue>
+#include <random>
 
 TEST_CASE( "Cardinal direction", "[cardinal direction]" ) {
 	REQUIRE( GetDirectionFromCellTo( Cell( 10, 10 ), Cell( 11, 10 ) ) == NORTH );
@@ -537,6 +541,747 @@ TEST_CASE( "Road network find path", "[FindPath]" ) {
 	}
 }
 
+TEST_CASE( "Road network components", "[road network components]" ) {
+	theGame = new Game();
+	SECTION( "two separate roads are not connected" ) {
+		Map           map;
+		RoadNetwork & network = theGame->roadNetwork;
+		theGame->roadNetwork.nodes.clear();
+		map.AllocateGrid( 100, 100 );
+		for ( u32 x = 0; x < 10; x++ ) {
+			map.SetTile( x, 10, MapTile::ROAD );
+		}
+		for ( u32 x = 15; x < 25; x++ ) {
+			map.SetTile( x, 10, MapTile::ROAD );
+		}
+		REQUIRE( network.AreCellsConnected( Cell( 0, 10 ), Cell( 9, 10 ) ) == true );
+		REQUIRE( network.AreCellsConnected( Cell( 1, 10 ), Cell( 20, 10 ) ) == false );
+		REQUIRE( network.AreCellsConnected( Cell( 1, 10 ), Cell( 50, 50 ) ) == false );
+
+		for ( u32 x = 10; x < 15; x++ ) {
+			map.SetTile( x, 10, MapTile::ROAD );
+		}
+		REQUIRE( network.AreCellsConnected( Cell( 1, 10 ), Cell( 20, 10 ) ) == true );
+	}
+
+	SECTION( "removing a cell splits the road" ) {
+		Map           map;
+		RoadNetwork & network = theGame->roadNetwork;
+		theGame->roadNetwork.nodes.clear();
+		map.AllocateGrid( 100, 100 );
+		for ( u32 x = 0; x < 30; x++ ) {
+			map.SetTile( x, 10, MapTile::ROAD );
+		}
+		for ( u32 z = 11; z < 20; z++ ) {
+			map.SetTile( 5, z, MapTile::ROAD );
+		}
+		map.SetTile( 20, 10, MapTile::EMPTY );
+		REQUIRE( network.AreCellsConnected( Cell( 0, 10 ), Cell( 19, 10 ) ) == true );
+		REQUIRE( network.AreCellsConnected( Cell( 5, 19 ), Cell( 19, 10 ) ) == true );
+		REQUIRE( network.AreCellsConnected( Cell( 0, 10 ), Cell( 21, 10 ) ) == false );
+		REQUIRE( network.AreCellsConnected( Cell( 20, 10 ), Cell( 21, 10 ) ) == false );
+
+		map.SetTile( 5, 10, MapTile::EMPTY );
+		REQUIRE( network.AreCellsConnected( Cell( 0, 10 ), Cell( 6, 10 ) ) == false );
+		REQUIRE( network.AreCellsConnected( Cell( 5, 19 ), Cell( 0, 10 ) ) == false );
+		REQUIRE( network.AreCellsConnected( Cell( 5, 19 ), Cell( 6, 10 ) ) == false );
+
+		ng::DynamicArray< Cell > out;
+		REQUIRE( network.FindPath( Cell( 0, 10 ), Cell( 25, 10 ), map, out ) == false );
+	}
+
+	SECTION( "removing a cell from a loop does not split it" ) {
+		Map           map;
+		RoadNetwork & network = theGame->roadNetwork;
+		theGame->roadNetwork.nodes.clear();
+		map.AllocateGrid( 100, 100 );
+		for ( u32 i = 10; i <= 20; i++ ) {
+			map.SetTile( i, 10, MapTile::ROAD );
+			map.SetTile( i, 20, MapTile::ROAD );
+			map.SetTile( 10, i, MapTile::ROAD );
+			map.SetTile( 20, i, MapTile::ROAD );
+		}
+		map.SetTile( 15, 10, MapTile::EMPTY );
+		REQUIRE( network.AreCellsConnected( Cell( 14, 10 ), Cell( 16, 10 ) ) == true );
+		map.SetTile( 15, 20, MapTile::EMPTY );
+		REQUIRE( network.AreCellsConnected( Cell( 14, 10 ), Cell( 16, 10 ) ) == false );
+		REQUIRE( network.AreCellsConnected( Cell( 14, 10 ), Cell( 14, 20 ) ) == true );
+		REQUIRE( network.AreCellsConnected( Cell( 16, 10 ), Cell( 16, 20 ) ) == true );
+	}
+}
+
+TEST_CASE( "Closest building", "[closest building]" ) {
+	theGame = new Game();
+	Map           map;
+	RoadNetwork & network = theGame->roadNetwork;
+	theGame->roadNetwork.nodes.clear();
+	map.AllocateGrid( 100, 100 );
+	for ( u32 x = 0; x <= 40; x++ ) {
+		map.SetTile( x, 10, MapTile::ROAD );
+	}
+	for ( u32 z = 11; z <= 20; z++ ) {
+		map.SetTile( 20, z, MapTile::ROAD );
+	}
+	for ( u32 x = 60; x <= 70; x++ ) {
+		map.SetTile( x, 10, MapTile::ROAD );
+	}
+
+	ng::DynamicArray< CpntBuilding > goals;
+	goals.PushBack( CpntBuilding{ BuildingKind::STORAGE_HOUSE, Cell( 5, 11 ), 2, 2 } );
+	goals.PushBack( CpntBuilding{ BuildingKind::STORAGE_HOUSE, Cell( 30, 11 ), 3, 3 } );
+	goals.PushBack( CpntBuilding{ BuildingKind::STORAGE_HOUSE, Cell( 64, 11 ), 2, 2 } );
+
+	SECTION( "finds the closest building reachable by road" ) {
+		ng::DynamicArray< Cell > start;
+		start.PushBack( Cell( 20, 20 ) );
+		ng::DynamicArray< Cell > path;
+		u32                      goalIndex = 0;
+		u32                      distance = 0;
+		bool found = FindPathToClosestBuilding( start, goals, map, network, path, goalIndex, ULONG_MAX, &distance );
+		REQUIRE( found == true );
+		REQUIRE( goalIndex == 1 );
+		REQUIRE( distance == 20 );
+		REQUIRE( path.Size() == 3 );
+		REQUIRE( path[ 0 ] == Cell( 30, 10 ) );
+		REQUIRE( path[ 1 ] == Cell( 20, 10 ) );
+		REQUIRE( path[ 2 ] == Cell( 20, 20 ) );
+	}
+
+	SECTION( "respects max distance" ) {
+		ng::DynamicArray< Cell > start;
+		start.PushBack( Cell( 20, 20 ) );
+		ng::DynamicArray< Cell > path;
+		u32                      goalIndex = 0;
+		REQUIRE( FindPathToClosestBuilding( start, goals, map, network, path, goalIndex, 20 ) == false );
+		REQUIRE( FindPathToClosestBuilding( start, goals, map, network, path, goalIndex, 21 ) == true );
+	}
+
+	SECTION( "ignores buildings on another road" ) {
+		ng::DynamicArray< Cell > start;
+		start.PushBack( Cell( 70, 10 ) );
+		ng::DynamicArray< Cell > path;
+		u32                      goalIndex = 0;
+		REQUIRE( FindPathToClosestBuilding( start, goals, map, network, path, goalIndex ) == true );
+		REQUIRE( goalIndex == 2 );
+
+		goals.PopBack();
+		REQUIRE( FindPathToClosestBuilding( start, goals, map, network, path, goalIndex ) == false );
+	}
+
+	SECTION( "takes goals on the way" ) {
+		ng::DynamicArray< Cell > start;
+		start.PushBack( Cell( 20, 20 ) );
+		ng::DynamicArray< Cell >         path;
+		ng::DynamicArray< CpntBuilding > firstGoals;
+		firstGoals.PushBack( goals[ 0 ] );
+		ng::DynamicArray< u32 >          distances;
+
+		// The closest one only comes once the search is 15 cells away, it still wins
+		auto gatherGoals = [ & ]( u32 distance, ng::DynamicArray< CpntBuilding > & outGoals ) {
+			distances.PushBack( distance );
+			if ( distance == 15 ) {
+				outGoals.PushBack( goals[ 1 ] );
+				return false;
+			}
+			return true;
+		};
+		u32 goalIndex = 0;
+		u32 distance = 0;
+		REQUIRE( FindPathToClosestBuilding( start, firstGoals, map, network, path, goalIndex, ULONG_MAX, &distance,
+		                                    gatherGoals ) );
+		REQUIRE( goalIndex == 1 );
+		REQUIRE( distance == 20 );
+		REQUIRE( distances.Size() == 16 );
+		REQUIRE( distances.Last() == 15 );
+	}
+}
+
+TEST_CASE( "Closest building of kind", "[closest building]" ) {
+	theGame = new Game();
+	theGame->registery = new Registery( &theGame->systemManager );
+	theGame->systemManager.CreateSystem< SystemBuilding >();
+	theGame->roadNetwork.nodes.clear();
+	Map &       map = theGame->map;
+	Registery & reg = *theGame->registery;
+	map.AllocateGrid( 200, 200 );
+
+	// Roads every 10 cells, farms in some of the blocks
+	map.BeginEdit();
+	for ( u32 i = 0; i < 200; i++ ) {
+		for ( u32 j = 0; j < 200; j += 10 ) {
+			map.SetTile( i, j, MapTile::ROAD );
+			map.SetTile( j, i, MapTile::ROAD );
+		}
+	}
+	map.CommitEdit();
+	ng::DynamicArray< Entity > farms;
+	std::mt19937               rng( 47 );
+	for ( u32 i = 0; i < 40; i++ ) {
+		Entity e = reg.CreateEntity();
+		auto & farm = reg.AssignComponent< CpntBuilding >( e );
+		farm.kind = BuildingKind::FARM;
+		farm.cell = Cell( ( rng() % 20 ) * 10 + 1 + rng() % 7, ( rng() % 20 ) * 10 + 1 );
+		farm.tileSizeX = 2;
+		farm.tileSizeZ = 2;
+		farms.PushBack( e );
+	}
+	// Right next to the origin, but on a road of its own
+	map.SetTile( 54, 56, MapTile::ROAD );
+	Entity lonelyFarm = reg.CreateEntity();
+	auto & lonely = reg.AssignComponent< CpntBuilding >( lonelyFarm );
+	lonely.kind = BuildingKind::FARM;
+	lonely.cell = Cell( 55, 56 );
+	lonely.tileSizeX = 2;
+	lonely.tileSizeZ = 2;
+	theGame->systemManager.Update( reg, 1 );
+
+	auto roadDistance = [ & ]( const CpntBuilding & origin, const ng::DynamicArray< Entity > & candidates ) {
+		ng::DynamicArray< Cell >         startCells;
+		ng::DynamicArray< CpntBuilding > goals;
+		ng::DynamicArray< Cell >         path;
+		GetRoadCellsAroundBuilding( origin, map, startCells );
+		for ( Entity e : candidates ) {
+			goals.PushBack( reg.GetComponent< CpntBuilding >( e ) );
+		}
+		u32 goalIndex = 0;
+		u32 distance = ULONG_MAX;
+		FindPathToClosestBuilding( startCells, goals, map, theGame->roadNetwork, path, goalIndex, ULONG_MAX,
+		                           &distance );
+		return distance;
+	};
+
+	SECTION( "finds a building as close as walking every road would" ) {
+		ng::DynamicArray< Cell > path;
+		for ( u32 i = 0; i < 20; i++ ) {
+			Cell         cell( ( rng() % 20 ) * 10 + 1 + rng() % 7, ( rng() % 19 ) * 10 + 9 );
+			CpntBuilding origin{ BuildingKind::HOUSE, cell, 2, 1 };
+			if ( i == 0 ) {
+				origin.cell = Cell( 55, 59 );
+			}
+			Entity closest = LookForClosestBuildingKind( reg, BuildingKind::FARM, origin, ULONG_MAX, path );
+			REQUIRE( closest != INVALID_ENTITY );
+			REQUIRE( closest != lonelyFarm );
+			REQUIRE( !path.Empty() );
+			ng::DynamicArray< Entity > found;
+			found.PushBack( closest );
+			REQUIRE( roadDistance( origin, found ) == roadDistance( origin, farms ) );
+		}
+	}
+
+	SECTION( "respects max distance and kind" ) {
+		CpntBuilding             origin{ BuildingKind::HOUSE, Cell( 55, 59 ), 2, 1 };
+		u32                      distance = roadDistance( origin, farms );
+		ng::DynamicArray< Cell > path;
+		REQUIRE( LookForClosestBuildingKind( reg, BuildingKind::FARM, origin, distance, path ) == INVALID_ENTITY );
+		REQUIRE( LookForClosestBuildingKind( reg, BuildingKind::FARM, origin, distance + 1, path ) != INVALID_ENTITY );
+		REQUIRE( LookForClosestBuildingKind( reg, BuildingKind::MARKET, origin, ULONG_MAX, path ) == INVALID_ENTITY );
+	}
+
+	SECTION( "forgets removed buildings" ) {
+		for ( Entity e : farms ) {
+			reg.MarkForDelete( e );
+		}
+		theGame->systemManager.Update( reg, 1 );
+		CpntBuilding             origin{ BuildingKind::HOUSE, Cell( 55, 59 ), 2, 1 };
+		ng::DynamicArray< Cell > path;
+		REQUIRE( LookForClosestBuildingKind( reg, BuildingKind::FARM, origin, ULONG_MAX, path ) == INVALID_ENTITY );
+		const SystemBuilding & system = theGame->systemManager.GetSystem< SystemBuilding >();
+		REQUIRE( system.buildingsOfKind[ ( int )BuildingKind::FARM ].Size() == 1 );
+
+		// The grid stays around once the last farm is gone
+		reg.MarkForDelete( lonelyFarm );
+		theGame->systemManager.Update( reg, 1 );
+		REQUIRE( system.buildingsOfKind[ ( int )BuildingKind::FARM ].Size() == 0 );
+		REQUIRE( system.buildingsOfKind[ ( int )BuildingKind::FARM ].IsInitialized() );
+		REQUIRE( LookForClosestBuildingKind( reg, BuildingKind::FARM, origin, ULONG_MAX, path ) == INVALID_ENTITY );
+		Entity e = reg.CreateEntity();
+		auto & farm = reg.AssignComponent< CpntBuilding >( e );
+		farm.kind = BuildingKind::FARM;
+		farm.cell = Cell( 51, 61 );
+		farm.tileSizeX = 2;
+		farm.tileSizeZ = 2;
+		theGame->systemManager.Update( reg, 1 );
+		REQUIRE( LookForClosestBuildingKind( reg, BuildingKind::FARM, origin, ULONG_MAX, path ) == e );
+	}
+}
+
+TEST_CASE( "Flow field", "[flow field]" ) {
+	theGame = new Game();
+	Map map;
+	theGame->roadNetwork.nodes.clear();
+	map.AllocateGrid( 200, 50 );
+	for ( u32 x = 0; x <= 20; x++ ) {
+		map.SetTile( x, 10, MapTile::ROAD );
+	}
+	for ( u32 z = 11; z <= 20; z++ ) {
+		map.SetTile( 20, z, MapTile::ROAD );
+	}
+
+	CpntBuilding             building{ BuildingKind::STORAGE_HOUSE, Cell( 5, 11 ), 2, 2 };
+	Entity                   destination = { 1, 1 };
+	FlowField                field;
+	ng::DynamicArray< Cell > cellsToReach;
+	field.destination = destination;
+
+	SECTION( "leads to the building on roads" ) {
+		cellsToReach.PushBack( Cell( 20, 20 ) );
+		field.Build( building, map, cellsToReach, 0 );
+		REQUIRE( field.IsDestination( Cell( 5, 10 ) ) );
+		REQUIRE( field.IsDestination( Cell( 6, 10 ) ) );
+		REQUIRE( field.costs[ Cell( 20, 20 ) ] == 24 );
+		REQUIRE( field.costs.contains( Cell( 30, 30 ) ) == false );
+
+		Cell current = Cell( 20, 20 );
+		u32  steps = 0;
+		Cell next;
+		while ( !field.IsDestination( current ) && field.GetNextCell( current, map, next ) ) {
+			current = next;
+			steps++;
+		}
+		REQUIRE( current == Cell( 6, 10 ) );
+		REQUIRE( steps == 24 );
+	}
+
+	SECTION( "stops once the agents are reached" ) {
+		cellsToReach.PushBack( Cell( 10, 10 ) );
+		field.Build( building, map, cellsToReach, 0 );
+		REQUIRE( field.Reaches( Cell( 10, 10 ) ) );
+		REQUIRE( field.Reaches( Cell( 1, 10 ) ) );
+		REQUIRE( field.Reaches( Cell( 0, 10 ) ) == false );
+		REQUIRE( field.Reaches( Cell( 20, 20 ) ) == false );
+		REQUIRE( field.maxCost == 4 );
+		REQUIRE( field.isComplete == false );
+
+		// Going at least as far as the previous field
+		field.Build( building, map, cellsToReach, 10 );
+		REQUIRE( field.Reaches( Cell( 15, 10 ) ) );
+		REQUIRE( field.maxCost == 10 );
+
+		// A cell that can't be reached floods everything
+		cellsToReach.PushBack( Cell( 30, 30 ) );
+		field.Build( building, map, cellsToReach, 0 );
+		REQUIRE( field.Reaches( Cell( 20, 20 ) ) );
+		REQUIRE( field.isComplete == true );
+	}
+
+	SECTION( "only edits of the chunks it looked at make it outdated" ) {
+		cellsToReach.PushBack( Cell( 20, 20 ) );
+		field.Build( building, map, cellsToReach, 0 );
+		REQUIRE( field.IsUpToDate( map ) );
+		map.SetTile( 150, 10, MapTile::ROAD );
+		REQUIRE( field.IsUpToDate( map ) );
+		map.SetTile( 15, 10, MapTile::EMPTY );
+		REQUIRE( field.IsUpToDate( map ) == false );
+	}
+
+	SECTION( "A* fields are kept when cells open up" ) {
+		field.movement = ASTAR_ALLOW_DIAGONALS;
+		map.SetTile( 12, 14, MapTile::TREE );
+		cellsToReach.PushBack( Cell( 12, 15 ) );
+		field.Build( building, map, cellsToReach, 0 );
+		map.SetTile( 12, 14, MapTile::EMPTY );
+		REQUIRE( field.IsUpToDate( map ) == false );
+		REQUIRE( field.NeedsRebuild( map ) == false );
+		map.SetTile( 12, 13, MapTile::BLOCKED );
+		REQUIRE( field.NeedsRebuild( map ) == true );
+	}
+
+	SECTION( "is built by the pathfinding workers" ) {
+		SystemPathfinding system;
+		system.PublishSnapshot( theGame->logistics, map, theGame->roadNetwork, 1 );
+		cellsToReach.PushBack( Cell( 20, 20 ) );
+		system.flowFieldTasks.enqueue(
+		    SystemPathfinding::FlowFieldTask{ destination, building, ROAD_NETWORK_AND_ROAD_BLOCK, cellsToReach } );
+		system.ParallelJob();
+
+		FlowFieldCache cache;
+		cache.Get( destination, ROAD_NETWORK_AND_ROAD_BLOCK ).isBuilding = true;
+		REQUIRE( cache.IsWaitingForBuilds() );
+		std::shared_ptr< const FlowField > built;
+		REQUIRE( system.builtFlowFields.try_dequeue( built ) == true );
+		cache.Store( std::move( built ) );
+		REQUIRE( cache.IsWaitingForBuilds() == false );
+		REQUIRE( cache.Get( destination, ROAD_NETWORK_AND_ROAD_BLOCK ).field->costs.at( Cell( 20, 20 ) ) == 24 );
+	}
+
+	SECTION( "queues the cell of each waiting agent once" ) {
+		FlowFieldCache          cache;
+		FlowFieldCache::Entry & entry = cache.Get( destination, ROAD_NETWORK_AND_ROAD_BLOCK );
+		for ( u32 tick = 0; tick < 10; tick++ ) {
+			entry.QueueCell( Cell( 20, 20 ) );
+			entry.QueueCell( Cell( 21, 20 ) );
+		}
+		REQUIRE( entry.cellsToReach.Size() == 2 );
+	}
+
+	SECTION( "evicts the least recently used field" ) {
+		FlowFieldCache cache;
+		for ( u32 i = 0; i < FlowFieldCache::MAX_FIELDS; i++ ) {
+			cache.Get( Entity{ i, 1 }, ROAD_NETWORK_AND_ROAD_BLOCK );
+		}
+		cache.Get( Entity{ 0, 1 }, ROAD_NETWORK_AND_ROAD_BLOCK );
+		cache.Get( Entity{ 100, 1 }, ROAD_NETWORK_AND_ROAD_BLOCK );
+		REQUIRE( cache.entries.size() == FlowFieldCache::MAX_FIELDS );
+		bool hasFirst = false;
+		bool hasSecond = false;
+		for ( const FlowFieldCache::Entry & entry : cache.entries ) {
+			hasFirst |= entry.destination == Entity{ 0, 1 };
+			hasSecond |= entry.destination == Entity{ 1, 1 };
+		}
+		REQUIRE( hasFirst == true );
+		REQUIRE( hasSecond == false );
+	}
+}
+
+TEST_CASE( "Path cache", "[path cache]" ) {
+	theGame = new Game();
+	Map & map = theGame->map;
+	map.AllocateGrid( 200, 200 );
+	PathCache                cache;
+	ng::DynamicArray< Cell > path;
+	path.PushBack( Cell( 1, 1 ) );
+	path.PushBack( Cell( 0, 0 ) );
+
+	PathfindingTask task{};
+	task.type = PathfindingTask::Type::FROM_CELL_TO_CELL;
+	task.start.cell = Cell( 0, 0 );
+	task.goal.cell = Cell( 1, 1 );
+	task.movementAllowed = ASTAR_ALLOW_DIAGONALS;
+	PathCache::Key key;
+	REQUIRE( PathCache::MakeKey( task, key ) == true );
+
+	REQUIRE( cache.Find( key, map ) == nullptr );
+	cache.Store( key, map, true, path );
+	const PathCache::CachedPath * cached = cache.Find( key, map );
+	REQUIRE( cached != nullptr );
+	REQUIRE( cached->found == true );
+	REQUIRE( cached->path.Size() == 2 );
+	REQUIRE( cache.hits == 1 );
+	REQUIRE( cache.misses == 1 );
+
+	// A tree in another chunk does not matter to the path
+	map.SetTile( 150, 150, MapTile::TREE );
+	REQUIRE( cache.Find( key, map ) != nullptr );
+
+	// The path lost a cell of its chunk, it has to be computed again
+	map.SetTile( 5, 5, MapTile::TREE );
+	REQUIRE( cache.Find( key, map ) == nullptr );
+	REQUIRE( cache.numEntries == 0 );
+	REQUIRE( cache.memoryUsage == 0 );
+
+	SECTION( "opening cells only drops the paths that were not found" ) {
+		cache.Store( key, map, true, path );
+		task.goal.cell = Cell( 10, 10 );
+		PathCache::Key unreachableKey;
+		PathCache::MakeKey( task, unreachableKey );
+		cache.Store( unreachableKey, map, false, ng::DynamicArray< Cell >() );
+		map.SetTile( 5, 5, MapTile::EMPTY );
+		REQUIRE( cache.Find( key, map ) != nullptr );
+		REQUIRE( cache.Find( unreachableKey, map ) == nullptr );
+	}
+
+	SECTION( "diagonal steps depend on the chunks of the corners they go around" ) {
+		ng::DynamicArray< Cell > acrossCorner;
+		acrossCorner.PushBack( Cell( 64, 64 ) );
+		acrossCorner.PushBack( Cell( 62, 62 ) );
+		ng::DynamicArray< u32 > chunks;
+		PathCache::ListCrossedChunks( acrossCorner, map, chunks );
+		REQUIRE( chunks.Size() == 4 );
+		REQUIRE( chunks[ 0 ] == map.GetChunkIndex( Cell( 0, 0 ) ) );
+		REQUIRE( chunks[ 3 ] == map.GetChunkIndex( Cell( 64, 64 ) ) );
+	}
+
+	SECTION( "storage lookups are not cached" ) {
+		PathfindingTask storageTask{};
+		storageTask.type = PathfindingTask::Type::FROM_CELL_TO_RESOURCE_STORAGE_WITH_STOCK;
+		REQUIRE( PathCache::MakeKey( storageTask, key ) == false );
+	}
+
+	SECTION( "least recently used entries are evicted" ) {
+		for ( u32 i = 0; i <= PathCache::MAX_ENTRIES; i++ ) {
+			task.goal.cell = Cell( i, 0 );
+			PathCache::MakeKey( task, key );
+			cache.Store( key, map, false, path );
+		}
+		REQUIRE( cache.numEntries == PathCache::MAX_ENTRIES );
+		task.goal.cell = Cell( 0, 0 );
+		PathCache::MakeKey( task, key );
+		REQUIRE( cache.Find( key, map ) == nullptr );
+	}
+}
+
+TEST_CASE( "Pathfinding queues", "[pathfinding]" ) {
+	theGame = new Game();
+	SystemPathfinding system;
+	Registery         reg( &theGame->systemManager );
+
+	PathfindingTask aStarTask{};
+	aStarTask.type = PathfindingTask::Type::FROM_CELL_TO_CELL;
+	aStarTask.movementAllowed = ASTAR_ALLOW_DIAGONALS;
+	aStarTask.requester = Entity{ 1, 1 };
+	PathfindingTask roadTask{};
+	roadTask.type = PathfindingTask::Type::FROM_CELL_TO_BUILDING;
+	roadTask.movementAllowed = ROAD_NETWORK_AND_ROAD_BLOCK;
+	roadTask.requester = Entity{ 2, 1 };
+
+	Message msg{};
+	msg.type = MESSAGE_PATHFINDING_REQUEST;
+	system.HandleMessage( reg, FillMessagePayload( msg, aStarTask ) );
+	system.HandleMessage( reg, FillMessagePayload( msg, roadTask ) );
+
+	SECTION( "road lookups go first" ) {
+		SystemPathfinding::QueuedTask queued;
+		REQUIRE( system.DequeueMostUrgentTask( queued ) == true );
+		REQUIRE( queued.task.requester == roadTask.requester );
+		REQUIRE( system.DequeueMostUrgentTask( queued ) == true );
+		REQUIRE( queued.task.requester == aStarTask.requester );
+		REQUIRE( system.DequeueMostUrgentTask( queued ) == false );
+	}
+
+	SECTION( "tasks of deleted requesters are cancelled" ) {
+		Message deleted{};
+		deleted.type = MESSAGE_ENTITY_DELETED;
+		deleted.recipient = aStarTask.requester;
+		system.HandleMessage( reg, deleted );
+		REQUIRE( system.ReleasePendingTask( aStarTask.requester ) == true );
+		REQUIRE( system.ReleasePendingTask( roadTask.requester ) == false );
+		REQUIRE( system.pendingTasks.empty() );
+	}
+}
+
+TEST_CASE( "World snapshot", "[pathfinding]" ) {
+	theGame = new Game();
+	theGame->roadNetwork.nodes.clear();
+	Map & map = theGame->map;
+	map.AllocateGrid( 20, 20 );
+	for ( u32 x = 0; x < 10; x++ ) {
+		map.SetTile( x, 5, MapTile::ROAD );
+	}
+	SystemPathfinding system;
+	Registery         reg( &theGame->systemManager );
+
+	system.PublishSnapshot( theGame->logistics, map, theGame->roadNetwork, 1 );
+	std::shared_ptr< const WorldSnapshot > first = system.GetSnapshot();
+	REQUIRE( first != nullptr );
+	REQUIRE( first->clock == 1 );
+
+	// Nothing changed on the map, everything is shared
+	system.PublishSnapshot( theGame->logistics, map, theGame->roadNetwork, 2 );
+	REQUIRE( system.GetSnapshot()->map == first->map );
+	REQUIRE( system.GetSnapshot()->roadNetwork == first->roadNetwork );
+
+	// A tree does not touch the roads, only the map is copied
+	map.SetTile( 15, 15, MapTile::TREE );
+	system.PublishSnapshot( theGame->logistics, map, theGame->roadNetwork, 3 );
+	std::shared_ptr< const WorldSnapshot > second = system.GetSnapshot();
+	REQUIRE( second->map != first->map );
+	REQUIRE( second->roadNetwork == first->roadNetwork );
+	REQUIRE( system.numMapCopies == 2 );
+	REQUIRE( system.numRoadNetworkCopies == 1 );
+
+	map.SetTile( 5, 5, MapTile::EMPTY );
+	system.PublishSnapshot( theGame->logistics, map, theGame->roadNetwork, 4 );
+	std::shared_ptr< const WorldSnapshot > third = system.GetSnapshot();
+	REQUIRE( third->roadNetwork != first->roadNetwork );
+	REQUIRE( system.numRoadNetworkCopies == 2 );
+	REQUIRE( first->map->GetTile( 5, 5 ) == MapTile::ROAD );
+	REQUIRE( first->roadNetwork->AreCellsConnected( Cell( 0, 5 ), Cell( 9, 5 ) ) == true );
+	REQUIRE( third->map->GetTile( 5, 5 ) == MapTile::EMPTY );
+	REQUIRE( third->roadNetwork->AreCellsConnected( Cell( 0, 5 ), Cell( 9, 5 ) ) == false );
+
+	// The storages are shared until the logistics index changes
+	REQUIRE( third->storages == first->storages );
+	REQUIRE( system.numStorageCopies == 1 );
+	CpntResourceInventory inventory;
+	inventory.SetResourceMaxCapacity( GameResource::WOOD, 8 );
+	theGame->logistics.AddStorage( Entity{ 1, 0 }, CpntBuilding{ BuildingKind::STORAGE_HOUSE, Cell( 2, 2 ), 2, 2 },
+	                               inventory, map );
+	system.PublishSnapshot( theGame->logistics, map, theGame->roadNetwork, 5 );
+	std::shared_ptr< const WorldSnapshot > fourth = system.GetSnapshot();
+	REQUIRE( fourth->storages != first->storages );
+	REQUIRE( fourth->storages->Size() == 1 );
+	REQUIRE( first->storages->Size() == 0 );
+
+	inventory.StoreRessource( GameResource::WOOD, 3 );
+	theGame->logistics.Refresh( Entity{ 1, 0 }, inventory );
+	system.PublishSnapshot( theGame->logistics, map, theGame->roadNetwork, 6 );
+	REQUIRE( system.GetSnapshot()->storages != fourth->storages );
+	REQUIRE( ( *system.GetSnapshot()->storages )[ 0 ].inventory.GetResourceAmount( GameResource::WOOD ) == 3 );
+	REQUIRE( system.numStorageCopies == 3 );
+}
+
+TEST_CASE( "Pathfinding results", "[pathfinding]" ) {
+	theGame = new Game();
+	SystemPathfinding system;
+
+	u32 index = 0;
+	REQUIRE( system.freeSlots.try_dequeue( index ) == true );
+	system.slots[ index ].path.PushBack( Cell( 1, 2 ) );
+	system.slots[ index ].path.PushBack( Cell( 3, 4 ) );
+	Cell *        buffer = system.slots[ index ].path.data;
+	pathfindingID id = system.PublishSlot( index, Entity{ 1, 1 } );
+	REQUIRE( id != INVALID_PATHFINDING_ID );
+
+	ng::DynamicArray< Cell > path;
+	system.TakePath( id, path );
+	REQUIRE( path.Size() == 2 );
+	REQUIRE( path.data == buffer );
+	REQUIRE( path[ 1 ] == Cell( 3, 4 ) );
+
+	// The slot went back to the free list with a new generation, the old id is stale
+	REQUIRE( system.FindReadySlot( id ) == nullptr );
+	REQUIRE( system.freeSlots.size_approx() == SystemPathfinding::NUM_RESULT_SLOTS );
+	REQUIRE( system.slots[ index ].generation == 1 );
+
+	SECTION( "paths nobody takes are reclaimed" ) {
+		REQUIRE( system.freeSlots.try_dequeue( index ) == true );
+		pathfindingID forgotten = system.PublishSlot( index, Entity{ 1, 1 } );
+		REQUIRE( system.freeSlots.try_dequeue( index ) == true );
+		pathfindingID orphan = system.PublishSlot( index, Entity{ 2, 1 } );
+
+		Registery reg( &theGame->systemManager );
+		Message   deleted{};
+		deleted.type = MESSAGE_ENTITY_DELETED;
+		deleted.recipient = Entity{ 2, 1 };
+		system.HandleMessage( reg, deleted );
+		system.ReclaimUnclaimedSlots( 10 );
+		REQUIRE( system.FindReadySlot( orphan ) == nullptr );
+		REQUIRE( system.FindReadySlot( forgotten ) != nullptr );
+
+		system.ReclaimUnclaimedSlots( 10 + SystemPathfinding::UNCLAIMED_SLOT_TIMEOUT );
+		REQUIRE( system.FindReadySlot( forgotten ) != nullptr );
+		system.ReclaimUnclaimedSlots( 11 + SystemPathfinding::UNCLAIMED_SLOT_TIMEOUT );
+		REQUIRE( system.FindReadySlot( forgotten ) == nullptr );
+		REQUIRE( system.freeSlots.size_approx() == SystemPathfinding::NUM_RESULT_SLOTS );
+		REQUIRE( system.numReclaimedSlots == 2 );
+	}
+}
+
+TEST_CASE( "Sliced searches", "[pathfinding]" ) {
+	theGame = new Game();
+	Map map;
+	map.AllocateGrid( 100, 100 );
+	// A wall with a single gap
+	for ( u32 z = 0; z < 90; z++ ) {
+		map.SetTile( 50, z, MapTile::BLOCKED );
+	}
+
+	SECTION( "a search run by slices finds the same path" ) {
+		ng::DynamicArray< Cell > expected;
+		REQUIRE( AStar( Cell( 10, 10 ), Cell( 90, 10 ), ASTAR_FORBID_DIAGONALS, map, expected ) == true );
+
+		AStarSearch search;
+		search.Start( Cell( 10, 10 ), Cell( 90, 10 ), ASTAR_FORBID_DIAGONALS, map );
+		u32 numSlices = 0;
+		while ( search.Step( map, 7 ) == ResumableSearch::Status::RUNNING ) {
+			numSlices++;
+		}
+		REQUIRE( numSlices > 10 );
+		REQUIRE( search.status == ResumableSearch::Status::FOUND );
+		ng::DynamicArray< Cell > path;
+		search.BuildPath( path );
+		REQUIRE( path.Size() == expected.Size() );
+		for ( u32 i = 0; i < path.Size(); i++ ) {
+			REQUIRE( path[ i ] == expected[ i ] );
+		}
+	}
+
+	SECTION( "the partial path heads to the goal" ) {
+		AStarSearch search;
+		search.Start( Cell( 10, 10 ), Cell( 90, 10 ), ASTAR_FORBID_DIAGONALS, map );
+		REQUIRE( search.Step( map, 200 ) == ResumableSearch::Status::RUNNING );
+		ng::DynamicArray< Cell > path;
+		REQUIRE( search.BuildBestPartialPath( path ) == true );
+		REQUIRE( path.Last() == Cell( 10, 10 ) );
+		REQUIRE( path[ 0 ].x > 10 );
+	}
+
+	SECTION( "agents on a partial path join the final one" ) {
+		// Both go from the destination to the start at ( 0, 0 )
+		ng::DynamicArray< Cell > partial;
+		partial.PushBack( Cell( 5, 5 ) );
+		partial.PushBack( Cell( 5, 0 ) );
+		partial.PushBack( Cell( 0, 0 ) );
+		ng::DynamicArray< Cell > finalPath;
+		finalPath.PushBack( Cell( 9, 0 ) );
+		finalPath.PushBack( Cell( 5, 0 ) );
+		finalPath.PushBack( Cell( 0, 0 ) );
+
+		// Walking from ( 5, 0 ) to ( 5, 5 ), back to ( 5, 0 ) where the paths split
+		ng::DynamicArray< Cell > nextSteps;
+		nextSteps.PushBack( Cell( 5, 5 ) );
+		SwapInFinalPath( partial, finalPath, nextSteps );
+		REQUIRE( nextSteps.Size() == 2 );
+		REQUIRE( nextSteps[ 0 ] == Cell( 9, 0 ) );
+		REQUIRE( nextSteps[ 1 ] == Cell( 5, 0 ) );
+
+		// Waiting at the end of the partial path
+		nextSteps.Clear();
+		SwapInFinalPath( partial, finalPath, nextSteps );
+		REQUIRE( nextSteps.Size() == 3 );
+		REQUIRE( nextSteps.Last() == Cell( 5, 5 ) );
+		REQUIRE( nextSteps[ 1 ] == Cell( 5, 0 ) );
+
+		// Not moved yet, the final path is taken as is
+		nextSteps = partial;
+		SwapInFinalPath( partial, finalPath, nextSteps );
+		REQUIRE( nextSteps.Size() == 3 );
+		REQUIRE( nextSteps.Last() == Cell( 0, 0 ) );
+		REQUIRE( nextSteps[ 0 ] == Cell( 9, 0 ) );
+	}
+
+	SECTION( "workers park searches when the budget is spent" ) {
+		SystemPathfinding system;
+		Registery         reg( &theGame->systemManager );
+		system.PublishSnapshot( theGame->logistics, map, theGame->roadNetwork, 1 );
+
+		PathfindingTask task{};
+		task.type = PathfindingTask::Type::FROM_CELL_TO_CELL;
+		task.movementAllowed = ASTAR_FORBID_DIAGONALS;
+		task.start.cell = Cell( 10, 10 );
+		task.goal.cell = Cell( 90, 10 );
+		task.requester = Entity{ 1, 1 };
+		task.acceptPartialPath = true;
+		Message msg{};
+		msg.type = MESSAGE_PATHFINDING_REQUEST;
+		system.HandleMessage( reg, FillMessagePayload( msg, task ) );
+
+		constexpr u32 normal = ( u32 )PathfindingTask::Priority::NORMAL;
+		system.expansionBudget = SystemPathfinding::SEARCH_SLICE;
+		system.ParallelJob();
+		REQUIRE( system.numSlicesRun == 1 );
+		REQUIRE( system.suspendedSearches[ normal ].size_approx() == 1 );
+		// The task holds its own slot, and the partial path was published in another one
+		REQUIRE( system.freeSlots.size_approx() == SystemPathfinding::NUM_RESULT_SLOTS - 2 );
+		REQUIRE( system.pendingTasks.size() == 1 );
+
+		// Nothing left this tick, the search stays parked
+		system.ParallelJob();
+		REQUIRE( system.numSlicesRun == 1 );
+
+		// Tasks solved in one go don't wait behind it
+		PathfindingTask roadTask{};
+		roadTask.type = PathfindingTask::Type::FROM_CELL_TO_CELL;
+		roadTask.movementAllowed = ROAD_NETWORK;
+		roadTask.start.cell = Cell( 10, 10 );
+		roadTask.goal.cell = Cell( 20, 10 );
+		roadTask.requester = Entity{ 2, 1 };
+		system.HandleMessage( reg, FillMessagePayload( msg, roadTask ) );
+		system.ParallelJob();
+		REQUIRE( system.numSlicesRun == 1 );
+		REQUIRE( system.suspendedSearches[ normal ].size_approx() == 1 );
+		REQUIRE( system.taskQueues[ normal ].size_approx() == 0 );
+		REQUIRE( system.pendingTasks.size() == 1 );
+
+		system.expansionBudget = 1000 * SystemPathfinding::SEARCH_SLICE;
+		system.ParallelJob();
+		REQUIRE( system.numSlicesRun > 2 );
+		REQUIRE( system.suspendedSearches[ normal ].size_approx() == 0 );
+		REQUIRE( system.freeSlots.size_approx() == SystemPathfinding::NUM_RESULT_SLOTS - 2 );
+		REQUIRE( system.pendingTasks.empty() );
+	}
+}
+
 TEST_CASE( "A star", "[astar]" ) {
 	theGame = new Game();
 	SECTION( "can find a path in a large network" ) {
@@ -556,6 +1301,32 @@ TEST_CASE( "A star", "[astar]" ) {
 		REQUIRE( found == true );
 		REQUIRE( out.Size() == 191 );
 		REQUIRE( out[ 0 ] == Cell( 164, 90 ) );
+
+		// Only the corners are left, every cell in between can be found again by walking straight
+		CompressPath( out );
+		REQUIRE( out.Size() < 191 / 10 );
+		REQUIRE( out.Capacity() == out.Size() );
+		REQUIRE( out[ 0 ] == Cell( 164, 90 ) );
+		REQUIRE( out.Last() == Cell( 34, 30 ) );
+		for ( u32 i = 0; i + 1 < out.Size(); i++ ) {
+			REQUIRE( ( out[ i ].x == out[ i + 1 ].x || out[ i ].z == out[ i + 1 ].z ) );
+		}
+	}
+
+	SECTION( "path compression keeps corners and diagonals" ) {
+		ng::DynamicArray< Cell > path;
+		path.PushBack( Cell( 0, 0 ) );
+		path.PushBack( Cell( 1, 1 ) );
+		path.PushBack( Cell( 2, 2 ) );
+		path.PushBack( Cell( 3, 2 ) );
+		path.PushBack( Cell( 4, 2 ) );
+		path.PushBack( Cell( 3, 2 ) );
+		CompressPath( path );
+		REQUIRE( path.Size() == 4 );
+		REQUIRE( path[ 0 ] == Cell( 0, 0 ) );
+		REQUIRE( path[ 1 ] == Cell( 2, 2 ) );
+		REQUIRE( path[ 2 ] == Cell( 4, 2 ) );
+		REQUIRE( path[ 3 ] == Cell( 3, 2 ) );
 	}
 }
 
@@ -622,3 +1393,684 @@ TEST_CASE( "Wanderer", "[wanderer]" ) {
 		//REQUIRE( path[ 8 ] == Cell( 10, 10 ) );
 	}
 }
+
+TEST_CASE( "Agent movement", "[navigation]" ) {
+	SECTION( "packed agents move toward their targets" ) {
+		// 6 agents so both the packed lanes and the leftover ones are covered
+		float posX[ 6 ] = { 0.0f, 0.0f, 1.0f, 2.0f, 0.0f, 5.0f };
+		float posZ[ 6 ] = { 0.0f, 0.0f, 1.0f, 2.0f, 0.0f, 5.0f };
+		float targetX[ 6 ] = { 10.0f, 3.0f, 1.0f, 2.0f, 3.0f, 5.0f };
+		float targetZ[ 6 ] = { 0.0f, 4.0f, 1.0f, 6.0f, 4.0f, 1.0f };
+		float step[ 6 ] = { 2.0f, 5.0f, 0.5f, 1.0f, 7.0f, 2.0f };
+		MoveAgentsTowardTargets( posX, posZ, targetX, targetZ, step, 6 );
+
+		// Still walking, step tells how far away the target is
+		REQUIRE( posX[ 0 ] == Approx( 2.0f ) );
+		REQUIRE( posZ[ 0 ] == Approx( 0.0f ) );
+		REQUIRE( step[ 0 ] == Approx( -8.0f ) );
+		// Exactly on the target
+		REQUIRE( posX[ 1 ] == 3.0f );
+		REQUIRE( posZ[ 1 ] == 4.0f );
+		REQUIRE( step[ 1 ] == Approx( 0.0f ) );
+		// Already standing on it
+		REQUIRE( posX[ 2 ] == 1.0f );
+		REQUIRE( posZ[ 2 ] == 1.0f );
+		REQUIRE( step[ 2 ] == Approx( 0.5f ) );
+		REQUIRE( posX[ 3 ] == Approx( 2.0f ) );
+		REQUIRE( posZ[ 3 ] == Approx( 3.0f ) );
+		REQUIRE( step[ 3 ] < 0.0f );
+		// Leftover lanes
+		REQUIRE( posX[ 4 ] == 3.0f );
+		REQUIRE( posZ[ 4 ] == 4.0f );
+		REQUIRE( step[ 4 ] == Approx( 2.0f ) );
+		REQUIRE( posZ[ 5 ] == Approx( 3.0f ) );
+		REQUIRE( step[ 5 ] == Approx( -2.0f ) );
+	}
+	SECTION( "agents go around corners in a single tick" ) {
+		theGame = new Game();
+		SystemManager systemManager;
+		systemManager.CreateSystem< System< CpntTransform > >();
+		SystemNavAgent & system = systemManager.CreateSystem< SystemNavAgent >();
+		Registery        reg( &systemManager );
+
+		Entity         e = reg.CreateEntity();
+		CpntNavAgent & agent = reg.AssignComponent< CpntNavAgent >( e );
+		agent.movementSpeed = 3.0f;
+		agent.pathfindingNextSteps.PushBack( Cell( 2, 3 ) );
+		agent.pathfindingNextSteps.PushBack( Cell( 2, 0 ) );
+		reg.AssignComponent< CpntTransform >( e ).SetTranslation( GetPointInMiddleOfCell( Cell( 0, 0 ) ) );
+		reg.FlushCreationQueues();
+
+		system.Update( reg, 1 );
+		glm::vec3 position = reg.GetComponent< CpntTransform >( e ).GetTranslation();
+		REQUIRE( position.x == Approx( 2.5f ) );
+		REQUIRE( position.z == Approx( 1.5f ) );
+		REQUIRE( reg.GetComponent< CpntNavAgent >( e ).pathfindingNextSteps.Size() == 1 );
+
+		system.Update( reg, 1 );
+		REQUIRE( reg.GetComponent< CpntTransform >( e ).GetTranslation() == GetPointInMiddleOfCell( Cell( 2, 3 ) ) );
+		REQUIRE( reg.GetComponent< CpntNavAgent >( e ).pathfindingNextSteps.Empty() );
+	}
+}
+
+TEST_CASE( "Bulk road edits", "[road network]" ) {
+	theGame = new Game();
+	// The same edits are made cell by cell on one map and in a single edit on the other
+	Map         mapOneByOne;
+	Map         mapBulk;
+	RoadNetwork networkOneByOne;
+	mapOneByOne.AllocateGrid( 60, 60 );
+	mapBulk.AllocateGrid( 60, 60 );
+	theGame->roadNetwork = RoadNetwork();
+
+	auto setTiles = [ & ]( auto callback ) {
+		std::swap( theGame->roadNetwork, networkOneByOne );
+		callback( mapOneByOne );
+		std::swap( theGame->roadNetwork, networkOneByOne );
+		mapBulk.BeginEdit();
+		callback( mapBulk );
+		mapBulk.CommitEdit();
+	};
+	auto requireSameNetworks = [ & ]() {
+		RoadNetwork & networkBulk = theGame->roadNetwork;
+		REQUIRE( networkBulk.CheckNetworkIntegrity() );
+		Cell cells[] = {
+		    Cell( 10, 10 ), Cell( 50, 50 ), Cell( 10, 50 ), Cell( 20, 35 ), Cell( 50, 13 ), Cell( 33, 57 ),
+		};
+		for ( const Cell & start : cells ) {
+			for ( const Cell & goal : cells ) {
+				if ( !mapBulk.IsTileWalkable( start ) || !mapBulk.IsTileWalkable( goal ) ) {
+					continue;
+				}
+				ng::DynamicArray< Cell > path;
+				u32                      distanceOneByOne = 0;
+				u32                      distanceBulk = 0;
+				bool foundOneByOne = networkOneByOne.FindPath( start, goal, mapOneByOne, path, &distanceOneByOne );
+				bool foundBulk = networkBulk.FindPath( start, goal, mapBulk, path, &distanceBulk );
+				REQUIRE( foundBulk == foundOneByOne );
+				REQUIRE( distanceBulk == distanceOneByOne );
+				REQUIRE( networkBulk.AreCellsConnected( start, goal ) == foundOneByOne );
+			}
+		}
+	};
+
+	setTiles( []( Map & map ) {
+		for ( u32 x = 5; x <= 55; x++ ) {
+			for ( u32 z = 5; z <= 55; z++ ) {
+				if ( x % 10 == 0 || z % 10 == 0 ) {
+					map.SetTile( x, z, MapTile::ROAD );
+				}
+			}
+		}
+	} );
+	requireSameNetworks();
+
+	// Cuts the grid in two
+	setTiles( []( Map & map ) {
+		for ( u32 x = 28; x <= 32; x++ ) {
+			for ( u32 z = 0; z < 60; z++ ) {
+				if ( map.IsTileWalkable( x, z ) ) {
+					map.SetTile( x, z, MapTile::EMPTY );
+				}
+			}
+		}
+	} );
+	requireSameNetworks();
+
+	// Removes and adds roads in the same edit, a new road along the top joins both sides again
+	setTiles( []( Map & map ) {
+		for ( u32 x = 5; x <= 55; x++ ) {
+			map.SetTile( x, 57, MapTile::ROAD );
+		}
+		map.SetTile( 10, 56, MapTile::ROAD );
+		map.SetTile( 50, 56, MapTile::ROAD );
+		map.SetTile( 40, 10, MapTile::EMPTY );
+		map.SetTile( 40, 10, MapTile::ROAD );
+		map.SetTile( 20, 20, MapTile::EMPTY );
+	} );
+	requireSameNetworks();
+	REQUIRE( theGame->roadNetwork.AreCellsConnected( Cell( 10, 10 ), Cell( 50, 50 ) ) );
+
+	// Random strokes all over the place, cell by cell edits don't cope with every shape (closing a loop without
+	// crossroads crashes) so the distances are checked against a breadth-first search on the map instead
+	auto walkingDistance = [ & ]( Cell start, Cell goal ) {
+		std::unordered_map< Cell, u32, CellHash > distances;
+		std::queue< Cell >                        queue;
+		distances[ start ] = 0;
+		queue.push( start );
+		while ( !queue.empty() ) {
+			Cell current = queue.front();
+			queue.pop();
+			if ( current == goal ) {
+				return distances[ current ];
+			}
+			ng::StaticArray< Cell, 4 > neighbors;
+			GetNeighborsOfCell( current, mapBulk, neighbors );
+			for ( const Cell & neighbor : neighbors ) {
+				if ( mapBulk.IsTileWalkable( neighbor ) &&
+				     distances.try_emplace( neighbor, distances[ current ] + 1 ).second ) {
+					queue.push( neighbor );
+				}
+			}
+		}
+		return ( u32 )-1;
+	};
+	std::default_random_engine           generator;
+	std::uniform_int_distribution< u32 > randomCells( 0, 59 );
+	std::uniform_int_distribution< u32 > randomLengths( 1, 12 );
+	for ( u32 round = 0; round < 20; round++ ) {
+		mapBulk.BeginEdit();
+		if ( round == 0 ) {
+			// A loop without any crossroad
+			for ( u32 i = 0; i <= 3; i++ ) {
+				mapBulk.SetTile( i, 0, MapTile::ROAD );
+				mapBulk.SetTile( i, 3, MapTile::ROAD );
+			}
+			mapBulk.SetTile( 0, 1, MapTile::ROAD );
+			mapBulk.SetTile( 0, 2, MapTile::ROAD );
+			mapBulk.SetTile( 3, 1, MapTile::ROAD );
+			mapBulk.SetTile( 3, 2, MapTile::ROAD );
+		}
+		for ( u32 stroke = 0; stroke < 4 && round > 0; stroke++ ) {
+			u32     x = randomCells( generator );
+			u32     z = randomCells( generator );
+			u32     length = randomLengths( generator );
+			bool    alongX = randomCells( generator ) % 2 == 0;
+			MapTile tile = randomCells( generator ) % 3 == 0 ? MapTile::EMPTY : MapTile::ROAD;
+			for ( u32 i = 0; i < length && x < 60 && z < 60; i++ ) {
+				mapBulk.SetTile( x, z, tile );
+				alongX ? x++ : z++;
+			}
+		}
+		mapBulk.CommitEdit();
+
+		RoadNetwork & network = theGame->roadNetwork;
+		REQUIRE( network.CheckNetworkIntegrity() );
+		ng::DynamicArray< Cell > roads;
+		for ( u32 i = 0; i < 10; i++ ) {
+			// The first two are on the loop
+			Cell cell = i == 0   ? Cell( 0, 0 )
+			            : i == 1 ? Cell( 3, 2 )
+			                     : Cell( randomCells( generator ), randomCells( generator ) );
+			if ( mapBulk.IsTileWalkable( cell ) ) {
+				roads.PushBack( cell );
+			}
+		}
+		for ( const Cell & start : roads ) {
+			for ( const Cell & goal : roads ) {
+				ng::DynamicArray< Cell > path;
+				u32                      distance = 0;
+				u32                      expected = walkingDistance( start, goal );
+				bool                     found = network.FindPath( start, goal, mapBulk, path, &distance );
+				REQUIRE( found == ( expected != ( u32 )-1 ) );
+				REQUIRE( network.AreCellsConnected( start, goal ) == found );
+				if ( found ) {
+					REQUIRE( distance == expected );
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE( "Map tile storage", "[map]" ) {
+	SECTION( "tiles read back on a map that is not made of whole blocks" ) {
+		Map map;
+		map.AllocateGrid( 21, 13 );
+		MapTile types[] = { MapTile::EMPTY, MapTile::ROAD, MapTile::ROAD_BLOCK, MapTile::BLOCKED, MapTile::TREE };
+		map.BeginEdit();
+		for ( u32 x = 0; x < map.sizeX; x++ ) {
+			for ( u32 z = 0; z < map.sizeZ; z++ ) {
+				map.SetTile( x, z, types[ ( x * 7 + z * 3 ) % 5 ] );
+			}
+		}
+		Map copy = map;
+		for ( u32 x = 0; x < map.sizeX; x++ ) {
+			for ( u32 z = 0; z < map.sizeZ; z++ ) {
+				MapTile type = types[ ( x * 7 + z * 3 ) % 5 ];
+				REQUIRE( map.GetTile( x, z ) == type );
+				REQUIRE( copy.GetTile( x, z ) == type );
+				REQUIRE( map.IsTileWalkable( x, z ) == map.IsTileWalkable( type ) );
+				REQUIRE( map.IsTileAStarNavigable( Cell( x, z ) ) == map.IsTileAStarNavigable( type ) );
+			}
+		}
+		// Leave the edit with an empty map so the global road network is not touched
+		for ( u32 x = 0; x < map.sizeX; x++ ) {
+			for ( u32 z = 0; z < map.sizeZ; z++ ) {
+				map.SetTile( x, z, MapTile::EMPTY );
+			}
+		}
+		map.CommitEdit();
+	}
+
+	SECTION( "empty areas match a cell by cell check" ) {
+		Map map;
+		map.AllocateGrid( 30, 30 );
+		map.SetTile( 9, 7, MapTile::TREE );
+		map.SetTile( 16, 24, MapTile::BLOCKED );
+		for ( u32 x = 0; x < map.sizeX; x++ ) {
+			for ( u32 z = 0; z < map.sizeZ; z++ ) {
+				for ( u32 size = 1; x + size <= map.sizeX && z + size <= map.sizeZ && size <= 10; size += 3 ) {
+					bool expected = true;
+					for ( u32 ax = x; ax < x + size; ax++ ) {
+						for ( u32 az = z; az < z + size; az++ ) {
+							expected &= map.GetTile( ax, az ) == MapTile::EMPTY;
+						}
+					}
+					REQUIRE( map.IsAreaEmpty( x, z, size, size ) == expected );
+				}
+			}
+		}
+	}
+
+	SECTION( "a big map fits in 16MB" ) {
+		Map map;
+		map.AllocateGrid( 4096, 4096 );
+		REQUIRE( map.ComputeMemoryUsage() < 16 * 1024 * 1024 );
+		REQUIRE( map.IsTileAStarNavigable( Cell( 4095, 4095 ) ) );
+	}
+}
+
+TEST_CASE( "Map chunks", "[map]" ) {
+	SECTION( "a huge map only allocates the chunks that are used" ) {
+		Map map;
+		map.AllocateGrid( 16384, 16384 );
+		u64 emptyMemory = map.ComputeMemoryUsage();
+		REQUIRE( emptyMemory < 8 * 1024 * 1024 );
+		map.SetTile( 10000, 12000, MapTile::TREE );
+		map.SetTile( 10001, 12000, MapTile::TREE );
+		REQUIRE( map.ComputeMemoryUsage() == emptyMemory + sizeof( TileChunk ) );
+		REQUIRE( map.GetTile( 10000, 12000 ) == MapTile::TREE );
+		REQUIRE( map.GetTile( 10002, 12000 ) == MapTile::EMPTY );
+		REQUIRE( !map.IsAreaEmpty( 9999, 11999, 2, 2 ) );
+		REQUIRE( map.IsAreaEmpty( 9000, 11000, 1000, 1000 ) );
+
+		// Emptying a chunk gives its memory back
+		map.SetTile( 10000, 12000, MapTile::EMPTY );
+		map.SetTile( 10001, 12000, MapTile::EMPTY );
+		REQUIRE( map.ComputeMemoryUsage() == emptyMemory );
+		REQUIRE( map.IsTileAStarNavigable( Cell( 10000, 12000 ) ) );
+	}
+
+	SECTION( "copies share chunks until one of them is edited" ) {
+		Map map;
+		map.AllocateGrid( 200, 200 );
+		map.SetTile( 5, 5, MapTile::BLOCKED );
+		map.SetTile( 150, 150, MapTile::TREE );
+		Map copy = map;
+		REQUIRE( copy.GetChunk( copy.GetChunkIndex( Cell( 5, 5 ) ) ).tiles ==
+		         map.GetChunk( map.GetChunkIndex( Cell( 5, 5 ) ) ).tiles );
+
+		map.SetTile( 6, 5, MapTile::TREE );
+		REQUIRE( copy.GetTile( 6, 5 ) == MapTile::EMPTY );
+		REQUIRE( map.GetTile( 6, 5 ) == MapTile::TREE );
+		REQUIRE( copy.GetTile( 5, 5 ) == MapTile::BLOCKED );
+		REQUIRE( copy.GetChunk( copy.GetChunkIndex( Cell( 5, 5 ) ) ).tiles !=
+		         map.GetChunk( map.GetChunkIndex( Cell( 5, 5 ) ) ).tiles );
+		// The other chunk was not touched and is still shared
+		REQUIRE( copy.GetChunk( copy.GetChunkIndex( Cell( 150, 150 ) ) ).tiles ==
+		         map.GetChunk( map.GetChunkIndex( Cell( 150, 150 ) ) ).tiles );
+	}
+
+	SECTION( "edited chunks are reported once with their version" ) {
+		Map map;
+		map.AllocateGrid( 200, 200 );
+		map.SetTile( 5, 5, MapTile::TREE );
+		map.SetTile( 6, 5, MapTile::TREE );
+		map.SetTile( 130, 70, MapTile::BLOCKED );
+
+		ng::DynamicArray< u32 > dirty;
+		map.ConsumeDirtyChunks( dirty );
+		REQUIRE( dirty.Size() == 2 );
+		REQUIRE( dirty[ 0 ] == map.GetChunkIndex( Cell( 5, 5 ) ) );
+		REQUIRE( dirty[ 1 ] == map.GetChunkIndex( Cell( 130, 70 ) ) );
+		REQUIRE( map.GetChunk( dirty[ 1 ] ).version == map.tileVersion );
+		REQUIRE( map.GetChunk( dirty[ 0 ] ).version < map.tileVersion );
+
+		dirty.Clear();
+		map.ConsumeDirtyChunks( dirty );
+		REQUIRE( dirty.Size() == 0 );
+	}
+}
+
+TEST_CASE( "Building occupancy", "[map]" ) {
+	Map map;
+	map.AllocateGrid( 150, 150 );
+	Entity a{ 1, 0 };
+	Entity b{ 2, 0 };
+	Entity c{ 3, 0 };
+	map.SetBuildingArea( Cell( 10, 10 ), 2, 3, a );
+	map.SetBuildingArea( Cell( 12, 10 ), 1, 1, b );
+	map.SetBuildingArea( Cell( 62, 62 ), 4, 4, c ); // across four chunks
+
+	SECTION( "cells know the building on them" ) {
+		REQUIRE( map.GetBuildingAt( Cell( 10, 10 ) ) == a );
+		REQUIRE( map.GetBuildingAt( Cell( 11, 12 ) ) == a );
+		REQUIRE( map.GetBuildingAt( Cell( 11, 13 ) ) == INVALID_ENTITY );
+		REQUIRE( map.GetBuildingAt( Cell( 12, 10 ) ) == b );
+		REQUIRE( map.GetBuildingAt( Cell( 65, 65 ) ) == c );
+		REQUIRE( map.GetBuildingAt( Cell( 150, 10 ) ) == INVALID_ENTITY );
+		REQUIRE( map.GetBuildingAt( INVALID_CELL ) == INVALID_ENTITY );
+	}
+
+	SECTION( "area queries report each overlapping building once" ) {
+		ng::DynamicArray< Entity > found;
+		map.FindBuildingsInArea( 0, 0, 150, 150, found );
+		REQUIRE( found.Size() == 3 );
+
+		found.Clear();
+		map.FindBuildingsInArea( 11, 11, 2, 2, found );
+		REQUIRE( found.Size() == 1 );
+		REQUIRE( found[ 0 ] == a );
+
+		found.Clear();
+		map.FindBuildingsInArea( 11, 9, 2, 2, found );
+		REQUIRE( found.Size() == 2 );
+
+		found.Clear();
+		map.FindBuildingsInArea( 64, 50, 1000, 1000, found );
+		REQUIRE( found.Size() == 1 );
+		REQUIRE( found[ 0 ] == c );
+	}
+
+	SECTION( "walkers find the buildings next to them" ) {
+		ng::StaticArray< Entity, 4 > adjacent;
+		map.FindBuildingsAdjacentToCell( Cell( 12, 11 ), adjacent );
+		REQUIRE( adjacent.Size() == 2 );
+		REQUIRE( adjacent.At( 0 ) == a );
+		REQUIRE( adjacent.At( 1 ) == b );
+
+		// Inside a building, only the others count
+		ng::StaticArray< Entity, 4 > fromInside;
+		map.FindBuildingsAdjacentToCell( Cell( 11, 10 ), fromInside );
+		REQUIRE( fromInside.Size() == 1 );
+		REQUIRE( fromInside.At( 0 ) == b );
+
+		ng::StaticArray< Entity, 4 > none;
+		map.FindBuildingsAdjacentToCell( Cell( 0, 0 ), none );
+		map.FindBuildingsAdjacentToCell( Cell( 11, 11 ), none );
+		map.FindBuildingsAdjacentToCell( Cell( 9, 9 ), none );
+		REQUIRE( none.Size() == 0 );
+	}
+
+	SECTION( "freeing the cells gives the memory back" ) {
+		u64 memory = map.ComputeMemoryUsage();
+		map.SetBuildingArea( Cell( 10, 10 ), 2, 3, INVALID_ENTITY );
+		REQUIRE( map.ComputeMemoryUsage() == memory );
+		map.SetBuildingArea( Cell( 12, 10 ), 1, 1, INVALID_ENTITY );
+		map.SetBuildingArea( Cell( 62, 62 ), 4, 4, INVALID_ENTITY );
+		REQUIRE( map.ComputeMemoryUsage() == memory - 4 * sizeof( BuildingChunk ) );
+		REQUIRE( map.GetBuildingAt( Cell( 10, 10 ) ) == INVALID_ENTITY );
+	}
+
+	SECTION( "copies keep their buildings" ) {
+		Map copy = map;
+		map.SetBuildingArea( Cell( 10, 10 ), 2, 3, INVALID_ENTITY );
+		REQUIRE( copy.GetBuildingAt( Cell( 10, 10 ) ) == a );
+		REQUIRE( map.GetBuildingAt( Cell( 10, 10 ) ) == INVALID_ENTITY );
+	}
+}
+
+TEST_CASE( "Building road connection", "[buildings]" ) {
+	theGame = new Game();
+	theGame->registery = new Registery( &theGame->systemManager );
+	theGame->systemManager.CreateSystem< SystemBuilding >();
+	theGame->roadNetwork.nodes.clear();
+	Map &       map = theGame->map;
+	Registery & reg = *theGame->registery;
+	map.AllocateGrid( 100, 100 );
+
+	Entity e = reg.CreateEntity();
+	auto & newBuilding = reg.AssignComponent< CpntBuilding >( e );
+	newBuilding.cell = Cell( 10, 10 );
+	newBuilding.tileSizeX = 2;
+	newBuilding.tileSizeZ = 2;
+	map.SetBuildingArea( Cell( 10, 10 ), 2, 2, e );
+	map.SetTile( 9, 10, MapTile::ROAD );
+	theGame->systemManager.Update( reg, 1 );
+	CpntBuilding & building = reg.GetComponent< CpntBuilding >( e );
+	REQUIRE( building.numAdjacentRoads == 1 );
+	REQUIRE( building.hasRoadConnection );
+
+	map.SetTile( 12, 11, MapTile::ROAD );
+	map.SetTile( 12, 12, MapTile::ROAD ); // diagonal, does not count
+	theGame->systemManager.Update( reg, 1 );
+	REQUIRE( building.numAdjacentRoads == 2 );
+
+	map.SetTile( 9, 10, MapTile::EMPTY );
+	map.SetTile( 12, 11, MapTile::EMPTY );
+	theGame->systemManager.Update( reg, 1 );
+	REQUIRE( building.numAdjacentRoads == 0 );
+	REQUIRE( !building.hasRoadConnection );
+
+	map.BeginEdit();
+	for ( u32 x = 5; x < 20; x++ ) {
+		map.SetTile( x, 9, MapTile::ROAD );
+	}
+	map.CommitEdit();
+	theGame->systemManager.Update( reg, 1 );
+	REQUIRE( building.numAdjacentRoads == 2 );
+	REQUIRE( building.hasRoadConnection );
+}
+
+TEST_CASE( "Navigable regions", "[trees]" ) {
+	Map map;
+	map.AllocateGrid( 200, 200 );
+	NavigableRegions regions;
+	REQUIRE( regions.AreConnected( Cell( 0, 0 ), Cell( 199, 199 ), map ) );
+	// 4x4 chunks, none of them allocated
+	REQUIRE( regions.numChunksLabeled == 16 );
+
+	SECTION( "walls split the map" ) {
+		for ( u32 x = 0; x < 200; x++ ) {
+			map.SetTile( x, 100, MapTile::BLOCKED );
+		}
+		REQUIRE( regions.AreConnected( Cell( 10, 10 ), Cell( 10, 150 ), map ) == false );
+		REQUIRE( regions.GetRegion( Cell( 10, 100 ), map ) == NavigableRegions::NO_REGION );
+		u64 numChunksLabeled = regions.numChunksLabeled;
+		// On the border of two chunks
+		map.SetTile( 64, 100, MapTile::EMPTY );
+		REQUIRE( regions.AreConnected( Cell( 10, 10 ), Cell( 10, 150 ), map ) );
+		REQUIRE( regions.numChunksLabeled == numChunksLabeled + 1 );
+	}
+
+	SECTION( "regions meet diagonally across chunk corners" ) {
+		for ( u32 z = 0; z < 200; z++ ) {
+			map.SetTile( 63, z, MapTile::BLOCKED );
+			map.SetTile( 64, z, MapTile::BLOCKED );
+		}
+		REQUIRE( regions.AreConnected( Cell( 10, 10 ), Cell( 150, 10 ), map ) == false );
+		map.SetTile( 63, 63, MapTile::EMPTY );
+		map.SetTile( 64, 64, MapTile::EMPTY );
+		REQUIRE( regions.AreConnected( Cell( 10, 10 ), Cell( 150, 10 ), map ) );
+		map.SetTile( 63, 63, MapTile::BLOCKED );
+		map.SetTile( 64, 64, MapTile::BLOCKED );
+		REQUIRE( regions.AreConnected( Cell( 10, 10 ), Cell( 150, 10 ), map ) == false );
+		map.SetTile( 63, 64, MapTile::EMPTY );
+		map.SetTile( 64, 63, MapTile::EMPTY );
+		REQUIRE( regions.AreConnected( Cell( 10, 10 ), Cell( 150, 10 ), map ) );
+	}
+
+	SECTION( "matches a flood of the whole map" ) {
+		std::mt19937 rng( 48 );
+		for ( u32 i = 0; i < 20000; i++ ) {
+			map.SetTile( rng() % 200, rng() % 200, MapTile::BLOCKED );
+		}
+		for ( u32 i = 0; i < 200; i++ ) {
+			Cell a( rng() % 200, rng() % 200 );
+			Cell b( rng() % 200, rng() % 200 );
+			if ( !map.IsTileAStarNavigable( a ) || !map.IsTileAStarNavigable( b ) ) {
+				continue;
+			}
+			ng::DynamicArray< Cell > path;
+			bool                     found = AStar( a, b, ASTAR_ALLOW_DIAGONALS, map, path );
+			REQUIRE( regions.AreConnected( a, b, map ) == found );
+		}
+	}
+}
+
+TEST_CASE( "Tree reservation", "[trees]" ) {
+	Map map;
+	map.AllocateGrid( 200, 200 );
+	TreeIndex                                      index;
+	std::unordered_map< Entity, Cell, EntityHash > cellOfTree;
+	auto                                           plantTree = [ & ]( Entity e, Cell cell ) {
+		map.SetTile( cell, MapTile::TREE );
+		index.AddTree( e, cell, map );
+		cellOfTree[ e ] = cell;
+	};
+
+	// A small forest, the tree in its middle can't be reached
+	u32 numTrees = 0;
+	for ( u32 x = 50; x < 53; x++ ) {
+		for ( u32 z = 50; z < 53; z++ ) {
+			plantTree( Entity{ numTrees++, 0 }, Cell( x, z ) );
+		}
+	}
+	Entity middleTree{ 4, 0 };
+	Entity lonelyTree{ numTrees++, 0 };
+	plantTree( lonelyTree, Cell( 20, 20 ) );
+	REQUIRE( index.GetNumTrees() == 10 );
+
+	SECTION( "woodworkers never go for the same tree" ) {
+		Cell   approach;
+		Entity first = index.ReserveClosestTree( Cell( 10, 10 ), Entity{ 100, 0 }, map, approach );
+		REQUIRE( first == lonelyTree );
+		REQUIRE( ( approach == Cell( 19, 20 ) || approach == Cell( 20, 19 ) ) );
+		REQUIRE( index.GetReservation( lonelyTree ) == Entity{ 100, 0 } );
+
+		for ( u32 i = 0; i < 8; i++ ) {
+			Entity tree = index.ReserveClosestTree( Cell( 10, 10 ), Entity{ 101 + i, 0 }, map, approach );
+			REQUIRE( tree != INVALID_ENTITY );
+			REQUIRE( tree != lonelyTree );
+			REQUIRE( tree != middleTree );
+			REQUIRE( map.IsTileAStarNavigable( approach ) );
+		}
+		REQUIRE( index.GetNumReserved() == 9 );
+		REQUIRE( index.ReserveClosestTree( Cell( 10, 10 ), Entity{ 200, 0 }, map, approach ) == INVALID_ENTITY );
+
+		// The woodworker died on its way
+		index.ReleaseTree( lonelyTree );
+		REQUIRE( index.GetReservation( lonelyTree ) == INVALID_ENTITY );
+		REQUIRE( index.ReserveClosestTree( Cell( 10, 10 ), Entity{ 200, 0 }, map, approach ) == lonelyTree );
+	}
+
+	SECTION( "chopped trees are forgotten" ) {
+		Cell   approach;
+		Entity tree = index.ReserveClosestTree( Cell( 10, 10 ), Entity{ 100, 0 }, map, approach );
+		index.RemoveTree( tree );
+		index.ReleaseTree( tree );
+		REQUIRE( !index.IsTree( tree ) );
+		REQUIRE( index.GetNumTrees() == 9 );
+		REQUIRE( index.GetNumReserved() == 0 );
+		REQUIRE( index.ReserveClosestTree( Cell( 10, 10 ), Entity{ 100, 0 }, map, approach ) != tree );
+	}
+
+	SECTION( "trees out of reach are skipped" ) {
+		// A wall all around the lonely tree
+		for ( u32 i = 17; i <= 23; i++ ) {
+			map.SetTile( i, 17, MapTile::BLOCKED );
+			map.SetTile( i, 23, MapTile::BLOCKED );
+			map.SetTile( 17, i, MapTile::BLOCKED );
+			map.SetTile( 23, i, MapTile::BLOCKED );
+		}
+		NavigableRegions regions;
+		Entity           unreachable = Entity{ 0, 0 };
+
+		auto canApproach = [ & ]( Entity tree, Cell approach ) {
+			return tree != unreachable && regions.AreConnected( Cell( 10, 10 ), approach, map );
+		};
+		Cell   approach;
+		Entity tree = index.ReserveClosestTree( Cell( 10, 10 ), Entity{ 100, 0 }, map, approach, canApproach );
+		REQUIRE( tree != lonelyTree );
+		REQUIRE( tree != unreachable );
+		REQUIRE( regions.AreConnected( Cell( 10, 10 ), approach, map ) );
+		index.ReleaseTree( tree );
+
+		// A hole in the wall, only its chunk is labeled again
+		u64 numChunksLabeled = regions.numChunksLabeled;
+		map.SetTile( 20, 17, MapTile::EMPTY );
+		REQUIRE( regions.AreConnected( Cell( 10, 10 ), Cell( 20, 19 ), map ) );
+		REQUIRE( index.ReserveClosestTree( Cell( 10, 10 ), Entity{ 100, 0 }, map, approach, canApproach ) ==
+		         lonelyTree );
+		REQUIRE( regions.AreConnected( Cell( 10, 10 ), approach, map ) );
+		REQUIRE( regions.numChunksLabeled == numChunksLabeled + 1 );
+
+		map.SetTile( 20, 17, MapTile::BLOCKED );
+		REQUIRE( regions.AreConnected( Cell( 10, 10 ), Cell( 20, 19 ), map ) == false );
+		REQUIRE( regions.GetRegion( Cell( 20, 17 ), map ) == NavigableRegions::NO_REGION );
+	}
+
+	SECTION( "picks the closest tree wherever they are filed" ) {
+		std::mt19937 rng( 48 );
+		for ( u32 i = 0; i < 300; i++ ) {
+			Cell cell( rng() % 200, rng() % 200 );
+			if ( map.GetTile( cell ) == MapTile::EMPTY ) {
+				plantTree( Entity{ numTrees++, 0 }, cell );
+			}
+		}
+		cellOfTree.erase( middleTree );
+		auto distanceTo = []( Cell origin, Cell cell ) {
+			return MAX( std::abs( ( int64 )cell.x - origin.x ), std::abs( ( int64 )cell.z - origin.z ) );
+		};
+		for ( u32 i = 0; i < 50; i++ ) {
+			Cell  origin( rng() % 200, rng() % 200 );
+			int64 closestDistance = INT64_MAX;
+			for ( auto [ tree, cell ] : cellOfTree ) {
+				if ( index.GetReservation( tree ) == INVALID_ENTITY ) {
+					closestDistance = MIN( closestDistance, distanceTo( origin, cell ) );
+				}
+			}
+			Cell   approach;
+			Entity tree = index.ReserveClosestTree( origin, Entity{ 1000 + i, 0 }, map, approach );
+			REQUIRE( tree != INVALID_ENTITY );
+			REQUIRE( distanceTo( origin, cellOfTree[ tree ] ) == closestDistance );
+		}
+	}
+}
+
+TEST_CASE( "Service coverage", "[services]" ) {
+	ServiceCoverage coverage;
+	coverage.Init( 200, 200 );
+	REQUIRE( coverage.GetLastVisit( GameService::WATER, Cell( 10, 10 ) ) == 0 );
+
+	coverage.Stamp( GameService::WATER, Cell( 9, 11 ), 100 );
+	coverage.Stamp( GameService::WATER, Cell( 130, 64 ), 200 );
+	REQUIRE( coverage.GetLastVisit( GameService::WATER, Cell( 9, 11 ) ) == 100 );
+	REQUIRE( coverage.GetLastVisit( GameService::WATER, Cell( 130, 64 ) ) == 200 );
+
+	// A 2x2 house at (10, 10) sees the cell along its side, but not the one at its corner
+	REQUIRE( coverage.GetLastVisitAround( GameService::WATER, Cell( 10, 10 ), 2, 2 ) == 100 );
+	coverage.Stamp( GameService::WATER, Cell( 9, 11 ), 0 );
+	coverage.Stamp( GameService::WATER, Cell( 9, 9 ), 300 );
+	REQUIRE( coverage.GetLastVisitAround( GameService::WATER, Cell( 10, 10 ), 2, 2 ) == 0 );
+	coverage.Stamp( GameService::WATER, Cell( 12, 10 ), 400 );
+	REQUIRE( coverage.GetLastVisitAround( GameService::WATER, Cell( 10, 10 ), 2, 2 ) == 400 );
+
+	// Along the borders of the map
+	coverage.Stamp( GameService::WATER, Cell( 0, 1 ), 500 );
+	REQUIRE( coverage.GetLastVisitAround( GameService::WATER, Cell( 0, 0 ), 1, 1 ) == 500 );
+	coverage.Stamp( GameService::WATER, Cell( 200, 0 ), 600 );
+	REQUIRE( coverage.GetLastVisitAround( GameService::WATER, Cell( 198, 0 ), 2, 2 ) == 0 );
+}
+
+TEST_CASE( "House service access", "[services]" ) {
+	theGame = new Game();
+	theGame->serviceCoverage.Init( 100, 100 );
+	SystemManager systemManager;
+	systemManager.CreateSystem< SystemHousing >();
+	Registery reg( &systemManager );
+
+	// A walker went by before the house was built
+	theGame->serviceCoverage.Stamp( GameService::WATER, Cell( 9, 11 ), 100 );
+	theGame->clock = 150;
+	Entity e = reg.CreateEntity();
+	reg.AssignComponent< CpntHousing >( e );
+	reg.FlushCreationQueues();
+	const CpntHousing & housing = reg.GetComponent< CpntHousing >( e );
+	CpntBuilding        building{ BuildingKind::HOUSE, Cell( 10, 10 ), 2, 2 };
+	REQUIRE( housing.builtAt == 150 );
+	REQUIRE( GetLastServiceAccess( building, housing, GameService::WATER ) == 0 );
+
+	theGame->serviceCoverage.Stamp( GameService::WATER, Cell( 12, 11 ), 200 );
+	REQUIRE( GetLastServiceAccess( building, housing, GameService::WATER ) == 200 );
+}